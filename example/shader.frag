@@ -7,6 +7,7 @@ uniform sampler2D vFBOMap;
 uniform vec2 vMouse;
 uniform float vTimer;
 uniform vec2 vResolution;
+uniform vec2 vFBOScale;
 uniform int vPass;
 
 in vec2 finalTexCoord;
@@ -35,7 +36,7 @@ vec4 tvScreen(vec4 lIn, sampler2D lTex)
         }
         //lDisplacement = lDistance*float(lNoiseValue);
         //lOut.r = lDistance;
-        lOut = texture(lTex, finalTexCoord.st+vec2(0, lDisplacement/vResolution.y));
+        lOut = texture(lTex, (finalTexCoord.st+vec2(0, lDisplacement/vResolution.y))*vFBOScale);
     }
     else
     {
@@ -74,7 +75,7 @@ void main(void)
     }
     else if(vPass == 1)
     {
-        fragColor = texture(vFBOMap, finalTexCoord.st);
+        fragColor = texture(vFBOMap, finalTexCoord.st*vFBOScale);
         fragColor = tvScreen(fragColor, vFBOMap);
 
         // Intégration du HUD
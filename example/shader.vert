@@ -2,6 +2,7 @@
 
 in vec4 vVertex;
 in vec2 vTexCoord;
+in mat4 vInstanceMatrix;
 
 uniform mat4 vMVP;
 uniform vec2 vMouse;
@@ -10,7 +11,7 @@ smooth out vec2 finalTexCoord;
 
 void main(void)
 {
-    gl_Position.xyz = (vMVP*vVertex).xyz;
+    gl_Position.xyz = (vMVP*vInstanceMatrix*vVertex).xyz;
 
     finalTexCoord = vTexCoord;
 }
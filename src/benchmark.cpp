@@ -0,0 +1,124 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+
+using namespace std;
+
+/*************/
+FrameStats Benchmark::computeStats(vector<double> values)
+{
+    FrameStats lStats;
+    lStats.count = values.size();
+    if (values.size() == 0)
+        return lStats;
+
+    sort(values.begin(), values.end());
+    auto percentile = [&](double p) {
+        int lRank = (int)ceil(p * values.size()) - 1;
+        return values[max(0, min((int)values.size() - 1, lRank))];
+    };
+
+    double lSum = 0.0;
+    for (auto v : values)
+        lSum += v;
+    lStats.mean = lSum / values.size();
+
+    double lSquares = 0.0;
+    for (auto v : values)
+        lSquares += (v - lStats.mean) * (v - lStats.mean);
+    lStats.stddev = values.size() > 1 ? sqrt(lSquares / (values.size() - 1)) : 0.0;
+
+    lStats.p50 = percentile(0.50);
+    lStats.p95 = percentile(0.95);
+    lStats.p99 = percentile(0.99);
+    lStats.max = values.back();
+    return lStats;
+}
+
+/*************/
+string Benchmark::escapeJson(const string& text)
+{
+    string lEscaped;
+    for (unsigned char c : text)
+    {
+        if (c == '"' || c == '\\')
+            lEscaped += string("\\") + (char)c;
+        else if (c < 0x20)
+        {
+            char lCode[8];
+            snprintf(lCode, sizeof(lCode), "\\u%04x", c);
+            lEscaped += lCode;
+        }
+        else
+            lEscaped += c;
+    }
+    return lEscaped;
+}
+
+/*************/
+void Benchmark::compare(const FrameStats& reference, const FrameStats& other, double& difference, double& interval)
+{
+    difference = 0.0;
+    interval = 0.0;
+    if (reference.count < 2 || other.count < 2 || reference.mean == 0.0)
+        return;
+
+    // Welch's approximation, large samples so the normal quantile is used
+    double lError = sqrt(reference.stddev * reference.stddev / reference.count + other.stddev * other.stddev / other.count);
+    difference = (other.mean - reference.mean) / reference.mean;
+    interval = 1.96 * lError / reference.mean;
+}
+
+/*************/
+void Benchmark::print(ostream& stream) const
+{
+    auto printStats = [&](const string& name, const FrameStats& stats) {
+        stream << "  " << name << " (ms, " << stats.count << " frames): "
+               << "p50 " << stats.p50 << " - p95 " << stats.p95 << " - p99 " << stats.p99 << " - max " << stats.max
+               << " - mean " << stats.mean << " - stddev " << stats.stddev << endl;
+    };
+
+    stream << fixed << setprecision(3);
+    stream << "Benchmark results for " << mName << endl;
+    printStats("CPU", getCpuStats());
+    printStats("GPU", getGpuStats());
+    if (mGlCalls.size() != 0)
+    {
+        stream << "  GL calls per frame (mean):";
+        for (auto& calls : mGlCalls)
+            stream << " " << calls.first << " " << computeStats(calls.second).mean;
+        stream << endl;
+    }
+    stream.unsetf(ios::fixed);
+}
+
+/*************/
+void Benchmark::writeJson(ostream& stream, const string& indent) const
+{
+    auto writeStats = [&](const string& name, const FrameStats& stats, bool last) {
+        stream << indent << "    \"" << name << "\": {"
+               << "\"frames\": " << stats.count << ", "
+               << "\"p50\": " << stats.p50 << ", "
+               << "\"p95\": " << stats.p95 << ", "
+               << "\"p99\": " << stats.p99 << ", "
+               << "\"max\": " << stats.max << ", "
+               << "\"mean\": " << stats.mean << ", "
+               << "\"stddev\": " << stats.stddev << "}" << (last ? "" : ",") << endl;
+    };
+
+    stream << indent << "{" << endl;
+    stream << indent << "    \"shader\": \"" << escapeJson(mName) << "\"," << endl;
+    writeStats("cpu_ms", getCpuStats(), false);
+    writeStats("gpu_ms", getGpuStats(), mGlCalls.size() == 0);
+    if (mGlCalls.size() != 0)
+    {
+        stream << indent << "    \"gl_calls\": {";
+        for (auto it = mGlCalls.begin(); it != mGlCalls.end(); ++it)
+            stream << (it != mGlCalls.begin() ? ", " : "") << "\"" << it->first << "\": " << computeStats(it->second).mean;
+        stream << "}" << endl;
+    }
+    stream << indent << "}";
+}
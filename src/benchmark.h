@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @benchmark.h
+ * Frame time statistics for the benchmark mode
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*************/
+struct FrameStats
+{
+    int count {0};
+    double mean {0.0};
+    double stddev {0.0};
+    double p50 {0.0};
+    double p95 {0.0};
+    double p99 {0.0};
+    double max {0.0};
+};
+
+/*************/
+class Benchmark
+{
+public:
+    Benchmark(const std::string& name) : mName(name) {}
+
+    void addCpuTime(double ms) {mCpuTimes.push_back(ms);}
+    void addGpuTime(double ms) {mGpuTimes.push_back(ms);}
+    // GL calls of a frame, for one category
+    void addGlCalls(const std::string& category, int calls) {mGlCalls[category].push_back(calls);}
+
+    const std::string& getName() const {return mName;}
+    FrameStats getCpuStats() const {return computeStats(mCpuTimes);}
+    FrameStats getGpuStats() const {return computeStats(mGpuTimes);}
+
+    void print(std::ostream& stream) const;
+    void writeJson(std::ostream& stream, const std::string& indent) const;
+
+    // Relative difference of the means of other compared to this,
+    // with the half width of its 95% confidence interval
+    static void compare(const FrameStats& reference, const FrameStats& other, double& difference, double& interval);
+    // Quotes, backslashes and control characters escaped, for a JSON string
+    static std::string escapeJson(const std::string& text);
+
+private:
+    std::string mName;
+    std::vector<double> mCpuTimes;
+    std::vector<double> mGpuTimes;
+    std::map<std::string, std::vector<double>> mGlCalls;
+
+    static FrameStats computeStats(std::vector<double> values);
+};
+
+#endif // BENCHMARK_H
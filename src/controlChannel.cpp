@@ -0,0 +1,334 @@
+#include "controlChannel.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+/*************/
+bool isPath(const string& address)
+{
+    return address.find('/') != string::npos;
+}
+
+/*************/
+// OSC strings are null terminated, and padded to four bytes
+int paddedSize(const char* data, int size)
+{
+    int lLength = strnlen(data, size);
+    if (lLength == size)
+        return -1;
+    return (lLength + 4) & ~3;
+}
+
+/*************/
+uint32_t readWord(const char* data)
+{
+    uint32_t lWord;
+    memcpy(&lWord, data, 4);
+    return ntohl(lWord);
+}
+}
+
+/*************/
+ControlChannel::~ControlChannel()
+{
+    stop();
+}
+
+/*************/
+bool ControlChannel::start(const string& address, function<void()> onReceive)
+{
+    stop();
+
+    if (isPath(address))
+    {
+        sockaddr_un lAddress;
+        memset(&lAddress, 0, sizeof(lAddress));
+        lAddress.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(lAddress.sun_path))
+        {
+            cerr << "Control socket path is too long: " << address << endl;
+            return false;
+        }
+        strncpy(lAddress.sun_path, address.c_str(), sizeof(lAddress.sun_path) - 1);
+
+        // Only a socket left by a previous run is removed, never a file given by mistake
+        struct stat lStat;
+        if (lstat(address.c_str(), &lStat) == 0)
+        {
+            if (!S_ISSOCK(lStat.st_mode))
+            {
+                cerr << "Unable to listen for controls on " << address << ": the path exists and is not a socket" << endl;
+                return false;
+            }
+            unlink(address.c_str());
+        }
+
+        mSocket = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (mSocket < 0 || ::bind(mSocket, (sockaddr*)&lAddress, sizeof(lAddress)) < 0)
+        {
+            cerr << "Unable to listen for controls on " << address << ": " << strerror(errno) << endl;
+            stop();
+            return false;
+        }
+        mSocketPath = address;
+    }
+    else
+    {
+        sockaddr_in lAddress;
+        memset(&lAddress, 0, sizeof(lAddress));
+        lAddress.sin_family = AF_INET;
+        lAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        try
+        {
+            lAddress.sin_port = htons(stoi(address));
+        }
+        catch (...)
+        {
+            cerr << "Invalid control port: " << address << endl;
+            return false;
+        }
+
+        mSocket = socket(AF_INET, SOCK_DGRAM, 0);
+        if (mSocket < 0 || ::bind(mSocket, (sockaddr*)&lAddress, sizeof(lAddress)) < 0)
+        {
+            cerr << "Unable to listen for controls on port " << address << ": " << strerror(errno) << endl;
+            stop();
+            return false;
+        }
+    }
+
+    // A large receive buffer absorbs bursts while the listener is not scheduled
+    int lBufferSize = 1 << 20;
+    setsockopt(mSocket, SOL_SOCKET, SO_RCVBUF, &lBufferSize, sizeof(lBufferSize));
+
+    cout << "Listening for controls on " << address << endl;
+    mOnReceive = onReceive;
+    mRunning = true;
+    mThread = thread(&ControlChannel::listen, this);
+    return true;
+}
+
+/*************/
+void ControlChannel::stop()
+{
+    mRunning = false;
+    if (mThread.joinable())
+        mThread.join();
+    if (mSocket >= 0)
+        close(mSocket);
+    mSocket = -1;
+    if (mSocketPath != "")
+        unlink(mSocketPath.c_str());
+    mSocketPath = "";
+}
+
+/*************/
+void ControlChannel::listen()
+{
+    char lBuffer[65536];
+    pollfd lPoll;
+    lPoll.fd = mSocket;
+    lPoll.events = POLLIN;
+
+    while (mRunning)
+    {
+        // Wakes up regularly to check whether to stop
+        if (poll(&lPoll, 1, 100) <= 0)
+            continue;
+
+        // Everything already received is parsed before notifying
+        int lSize;
+        int lBatch = 0;
+        while ((lSize = recv(mSocket, lBuffer, sizeof(lBuffer), MSG_DONTWAIT)) > 0)
+        {
+            parse(lBuffer, lSize);
+            lBatch++;
+        }
+
+        if (lBatch > 0 && mOnReceive)
+            mOnReceive();
+    }
+}
+
+/*************/
+void ControlChannel::parse(const char* data, int size)
+{
+    if (size > 0 && (data[0] == '/' || data[0] == '#'))
+        parseOSC(data, size);
+    else
+        parseText(data, size);
+}
+
+/*************/
+void ControlChannel::parseOSC(const char* data, int size)
+{
+    // Bundles hold a time tag, then elements each preceded by their size
+    if (size >= 16 && strncmp(data, "#bundle", 8) == 0)
+    {
+        int lOffset = 16;
+        while (lOffset + 4 <= size)
+        {
+            int lElementSize = readWord(data + lOffset);
+            lOffset += 4;
+            if (lElementSize <= 0 || lOffset + lElementSize > size)
+                return;
+            parseOSC(data + lOffset, lElementSize);
+            lOffset += lElementSize;
+        }
+        return;
+    }
+
+    int lOffset = paddedSize(data, size);
+    if (lOffset < 0 || lOffset >= size || data[lOffset] != ',')
+        return;
+
+    // Uniform name, from the last part of the address
+    ControlMessage lMessage;
+    string lAddress(data);
+    string lName = lAddress.substr(lAddress.rfind('/') + 1);
+    if (lName.empty() || lName.size() >= sizeof(lMessage.name))
+        return;
+    strcpy(lMessage.name, lName.c_str());
+
+    const char* lTags = data + lOffset + 1;
+    int lTagsSize = paddedSize(data + lOffset, size - lOffset);
+    if (lTagsSize < 0)
+        return;
+    lOffset += lTagsSize;
+
+    for (; *lTags != 0 && lMessage.count < 4; ++lTags)
+    {
+        float lValue;
+        if (*lTags == 'f' || *lTags == 'i')
+        {
+            if (lOffset + 4 > size)
+                return;
+            uint32_t lWord = readWord(data + lOffset);
+            if (*lTags == 'f')
+                memcpy(&lValue, &lWord, 4);
+            else
+                lValue = (float)(int32_t)lWord;
+            lOffset += 4;
+        }
+        else if (*lTags == 'd')
+        {
+            if (lOffset + 8 > size)
+                return;
+            uint64_t lLong = ((uint64_t)readWord(data + lOffset) << 32) | readWord(data + lOffset + 4);
+            double lDouble;
+            memcpy(&lDouble, &lLong, 8);
+            lValue = (float)lDouble;
+            lOffset += 8;
+        }
+        else if (*lTags == 'T' || *lTags == 'F')
+            lValue = *lTags == 'T' ? 1.f : 0.f;
+        else
+            return;
+        lMessage.values[lMessage.count++] = lValue;
+    }
+
+    if (lMessage.count > 0)
+        queue(lMessage);
+}
+
+/*************/
+void ControlChannel::parseText(const char* data, int size)
+{
+    istringstream lStream(string(data, size));
+    string lLine;
+    while (getline(lStream, lLine))
+    {
+        ControlMessage lMessage;
+        istringstream lLineStream(lLine);
+        string lName;
+        if (!(lLineStream >> lName) || lName.size() >= sizeof(lMessage.name))
+            continue;
+        strcpy(lMessage.name, lName.c_str());
+        while (lMessage.count < 4 && lLineStream >> lMessage.values[lMessage.count])
+            lMessage.count++;
+        if (lMessage.count > 0)
+            queue(lMessage);
+    }
+}
+
+/*************/
+void ControlChannel::queue(const ControlMessage& message)
+{
+    mReceived++;
+    if (!mRing.push(message))
+        mDropped++;
+}
+
+/*************/
+int ControlChannel::encodeOSC(const string& name, const float* values, int count, char* buffer, int size)
+{
+    string lAddress = "/" + name;
+    int lAddressSize = (lAddress.size() + 4) & ~3;
+    int lTagsSize = (count + 2 + 3) & ~3;
+    int lSize = lAddressSize + lTagsSize + count * 4;
+    if (lSize > size)
+        return 0;
+
+    memset(buffer, 0, lSize);
+    memcpy(buffer, lAddress.c_str(), lAddress.size());
+    buffer[lAddressSize] = ',';
+    for (int i = 0; i < count; ++i)
+    {
+        buffer[lAddressSize + 1 + i] = 'f';
+        uint32_t lWord;
+        memcpy(&lWord, &values[i], 4);
+        lWord = htonl(lWord);
+        memcpy(buffer + lAddressSize + lTagsSize + i * 4, &lWord, 4);
+    }
+    return lSize;
+}
+
+/*************/
+int ControlChannel::connectTo(const string& address)
+{
+    int lSocket = -1;
+    int lResult = -1;
+    if (isPath(address))
+    {
+        sockaddr_un lAddress;
+        memset(&lAddress, 0, sizeof(lAddress));
+        lAddress.sun_family = AF_UNIX;
+        strncpy(lAddress.sun_path, address.c_str(), sizeof(lAddress.sun_path) - 1);
+        lSocket = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (lSocket >= 0)
+            lResult = connect(lSocket, (sockaddr*)&lAddress, sizeof(lAddress));
+    }
+    else
+    {
+        sockaddr_in lAddress;
+        memset(&lAddress, 0, sizeof(lAddress));
+        lAddress.sin_family = AF_INET;
+        lAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        lAddress.sin_port = htons(atoi(address.c_str()));
+        lSocket = socket(AF_INET, SOCK_DGRAM, 0);
+        if (lSocket >= 0)
+            lResult = connect(lSocket, (sockaddr*)&lAddress, sizeof(lAddress));
+    }
+
+    if (lResult < 0)
+    {
+        if (lSocket >= 0)
+            close(lSocket);
+        return -1;
+    }
+    return lSocket;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @controlChannel.h
+ * Receives named uniform values from other programs, over UDP or a Unix socket
+ *
+ * Datagrams hold either OSC messages and bundles, addressed to /<name> with
+ * float, int, double or boolean arguments, or text lines as "<name> <values...>".
+ * Messages are queued in a lock-free ring, read by the render thread.
+ */
+
+#ifndef CONTROLCHANNEL_H
+#define CONTROLCHANNEL_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "spscRing.h"
+
+/*************/
+struct ControlMessage
+{
+    char name[32];
+    float values[4];
+    int count {0};
+};
+
+/*************/
+class ControlChannel
+{
+public:
+    ~ControlChannel();
+
+    // Listens on a UDP port of localhost, or on a Unix socket if address is a path.
+    // onReceive is called from the listener thread after each batch of messages
+    bool start(const std::string& address, std::function<void()> onReceive);
+    void stop();
+    bool isStarted() const {return mSocket >= 0;}
+
+    // Render thread side
+    bool pop(ControlMessage& message) {return mRing.pop(message);}
+
+    unsigned long getReceived() const {return mReceived;}
+    unsigned long getDropped() const {return mDropped;}
+
+    // Shared with the test sender. Returns the size of the OSC message, 0 if too small
+    static int encodeOSC(const std::string& name, const float* values, int count, char* buffer, int size);
+    // Opens a datagram socket connected to the given address, -1 on failure
+    static int connectTo(const std::string& address);
+
+private:
+    int mSocket {-1};
+    std::string mSocketPath {""};
+    std::thread mThread;
+    std::atomic<bool> mRunning {false};
+    std::function<void()> mOnReceive;
+
+    SpscRing<ControlMessage, 4096> mRing;
+    std::atomic<unsigned long> mReceived {0};
+    std::atomic<unsigned long> mDropped {0};
+
+    void listen();
+    void parse(const char* data, int size);
+    void parseOSC(const char* data, int size);
+    void parseText(const char* data, int size);
+    void queue(const ControlMessage& message);
+};
+
+#endif // CONTROLCHANNEL_H
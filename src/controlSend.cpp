@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "controlChannel.h"
+
+using namespace std;
+
+/*************/
+bool parseFloat(const string& text, float& value)
+{
+    try
+    {
+        size_t lEnd = 0;
+        value = stof(text, &lEnd);
+        return lEnd == text.size();
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+/*************/
+// Sends uniform values to a running shader-0-matic, to check the control channel
+int main(int argc, char** argv)
+{
+    float lRate {1000.f};
+    float lDuration {10.f};
+    vector<string> lArgs;
+    bool lValid = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (string(argv[i]) == "--rate" && i < argc - 1)
+            lValid &= parseFloat(argv[++i], lRate);
+        else if (string(argv[i]) == "--duration" && i < argc - 1)
+            lValid &= parseFloat(argv[++i], lDuration);
+        else
+            lArgs.push_back(string(argv[i]));
+    }
+
+    float lValues[4];
+    int lCount = max(0, (int)lArgs.size() - 2);
+    for (int i = 0; i < lCount && i < 4; ++i)
+        lValid &= parseFloat(lArgs[i + 2], lValues[i]);
+
+    if (!lValid || lArgs.size() < 2 || lArgs.size() > 6)
+    {
+        cout << "Usage: shaderomatic-send [--rate hz] [--duration sec] <port|socket> <uniform> [values...]" << endl;
+        cout << "Sends the values once, or without values a sine wave at the given rate (defaults to 1000Hz for 10 sec)" << endl;
+        return 1;
+    }
+
+    int lSocket = ControlChannel::connectTo(lArgs[0]);
+    if (lSocket < 0)
+    {
+        cerr << "Unable to connect to " << lArgs[0] << endl;
+        return 1;
+    }
+
+    char lBuffer[256];
+    if (lCount > 0)
+    {
+        int lSize = ControlChannel::encodeOSC(lArgs[1], lValues, lCount, lBuffer, sizeof(lBuffer));
+        send(lSocket, lBuffer, lSize, 0);
+        close(lSocket);
+        return 0;
+    }
+
+    // Messages are sent on a fixed schedule, to measure what gets through
+    auto lStart = chrono::steady_clock::now();
+    auto lPeriod = chrono::duration<double>(1.0 / max(1.f, lRate));
+    unsigned long lSent = 0;
+    unsigned long lFailed = 0;
+    for (unsigned long i = 0; ; ++i)
+    {
+        auto lNext = lStart + chrono::duration_cast<chrono::steady_clock::duration>(lPeriod * (double)i);
+        if (chrono::duration<float>(lNext - lStart).count() >= lDuration)
+            break;
+        this_thread::sleep_until(lNext);
+
+        lValues[0] = 0.5f + 0.5f * sinf(chrono::duration<float>(lNext - lStart).count() * 6.2831853f);
+        int lSize = ControlChannel::encodeOSC(lArgs[1], lValues, 1, lBuffer, sizeof(lBuffer));
+        if (send(lSocket, lBuffer, lSize, 0) == lSize)
+            lSent++;
+        else
+            lFailed++;
+    }
+
+    float lElapsed = chrono::duration<float>(chrono::steady_clock::now() - lStart).count();
+    cout << "Sent " << lSent << " messages in " << lElapsed << " sec (" << (int)(lSent / lElapsed) << "/s), " << lFailed << " failed" << endl;
+    close(lSocket);
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include "debugLog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+// Period of the logger thread, and minimum time between two prints of a message ID, in seconds
+#define DEBUG_LOG_PERIOD 0.1
+#define DEBUG_LOG_INTERVAL 1.0
+
+/*************/
+DebugLog::~DebugLog()
+{
+    stop();
+}
+
+/*************/
+void DebugLog::start()
+{
+    if (mRunning)
+        return;
+    mRunning = true;
+    mThread = thread(&DebugLog::run, this);
+}
+
+/*************/
+void DebugLog::stop()
+{
+    if (!mRunning)
+        return;
+    mRunning = false;
+    if (mThread.joinable())
+        mThread.join();
+
+    for (auto& entry : mEntries)
+    {
+        unsigned long lHidden = entry.second.count - entry.second.printed;
+        if (lHidden > 0)
+            cout << "GL::debug - [" << getTypeName(get<1>(entry.first)) << "] - " << get<3>(entry.first)
+                 << " (" << lHidden << (entry.second.printed > 0 ? " more times)" : " times, not shown)") << "\n";
+    }
+    if (mDropped > 0)
+        cout << "GL::debug - " << mDropped << " messages dropped" << "\n";
+    cout.flush();
+    mEntries.clear();
+    mLastPrint.clear();
+}
+
+/*************/
+void DebugLog::callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* log)
+{
+    DebugLog* lLog = (DebugLog*)log;
+    if (lLog == nullptr)
+        return;
+
+    DebugMessage lMessage;
+    lMessage.source = source;
+    lMessage.type = type;
+    lMessage.id = id;
+    lMessage.severity = severity;
+    size_t lLength = length >= 0 ? (size_t)length : strlen(message);
+    lLength = min(lLength, sizeof(lMessage.text) - 1);
+    memcpy(lMessage.text, message, lLength);
+    lMessage.text[lLength] = 0;
+
+    while (lLog->mProducerFlag.test_and_set(memory_order_acquire))
+        ;
+    bool lPushed = lLog->mRing.push(lMessage);
+    lLog->mProducerFlag.clear(memory_order_release);
+    if (!lPushed)
+        lLog->mDropped++;
+}
+
+/*************/
+string DebugLog::getLastPerformance()
+{
+    lock_guard<mutex> lLock(mPerformanceMutex);
+    return mLastPerformance;
+}
+
+/*************/
+void DebugLog::run()
+{
+    auto lStart = chrono::steady_clock::now();
+    DebugMessage lMessage;
+    while (true)
+    {
+        // Checked before emptying the ring, so that nothing queued before stopping is lost
+        bool lRunning = mRunning;
+        double lNow = chrono::duration<double>(chrono::steady_clock::now() - lStart).count();
+        bool lPrinted = false;
+        while (mRing.pop(lMessage))
+        {
+            handle(lMessage, lNow);
+            lPrinted = true;
+        }
+        if (lPrinted)
+            cout.flush();
+
+        if (!lRunning)
+            break;
+        this_thread::sleep_for(chrono::duration<double>(DEBUG_LOG_PERIOD));
+    }
+}
+
+/*************/
+void DebugLog::handle(const DebugMessage& message, double now)
+{
+    Entry& lEntry = mEntries[make_tuple(message.source, message.type, message.id, string(message.text))];
+    lEntry.count++;
+
+    if (message.type == GL_DEBUG_TYPE_PERFORMANCE)
+    {
+        mPerformanceCount++;
+        lock_guard<mutex> lLock(mPerformanceMutex);
+        mLastPerformance = message.text;
+    }
+
+    // Performance warnings are only printed once, the others once per interval and per ID
+    if (lEntry.printed > 0 && message.type == GL_DEBUG_TYPE_PERFORMANCE)
+        return;
+    auto lLastIt = mLastPrint.find(message.id);
+    if (lLastIt != mLastPrint.end() && now - lLastIt->second < DEBUG_LOG_INTERVAL)
+        return;
+    mLastPrint[message.id] = now;
+
+    print(message, lEntry.count - lEntry.printed - 1);
+    lEntry.printed = lEntry.count;
+}
+
+/*************/
+void DebugLog::print(const DebugMessage& message, unsigned long repeated)
+{
+    cout << "GL::debug - [" << getTypeName(message.type) << "] - " << message.text;
+    if (repeated > 0)
+        cout << " (" << repeated << " more times since last shown)";
+    cout << "\n";
+}
+
+/*************/
+const char* DebugLog::getTypeName(GLenum type)
+{
+    switch (type)
+    {
+    case GL_DEBUG_TYPE_ERROR:
+        return "Error";
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:
+        return "Deprecated behavior";
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:
+        return "Undefined behavior";
+    case GL_DEBUG_TYPE_PORTABILITY:
+        return "Portability";
+    case GL_DEBUG_TYPE_PERFORMANCE:
+        return "Performance";
+    case GL_DEBUG_TYPE_OTHER:
+        return "Other";
+    default:
+        return "";
+    }
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @debugLog.h
+ * Sink for the GL debug messages, written to the console by a thread of
+ * its own so that the driver never waits on it
+ *
+ * Messages are queued in a lock-free ring. Identical ones are counted
+ * rather than repeated, and each message ID is printed at most once per
+ * interval. Performance warnings are printed once, then only counted and
+ * shown in the HUD.
+ */
+
+#ifndef DEBUGLOG_H
+#define DEBUGLOG_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include "GLFW/glfw3.h"
+
+#include "spscRing.h"
+
+/*************/
+struct DebugMessage
+{
+    GLenum source;
+    GLenum type;
+    GLuint id;
+    GLenum severity;
+    char text[256];
+};
+
+/*************/
+class DebugLog
+{
+public:
+    ~DebugLog();
+
+    void start();
+    // Prints the counts of the messages not shown yet
+    void stop();
+
+    // Given to glDebugMessageCallback, with the log as user parameter
+    static void callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* log);
+
+    unsigned long getPerformanceCount() const {return mPerformanceCount;}
+    std::string getLastPerformance();
+    unsigned long getDropped() const {return mDropped;}
+
+private:
+    struct Entry
+    {
+        unsigned long count {0};
+        unsigned long printed {0};
+    };
+
+    SpscRing<DebugMessage, 1024> mRing;
+    // The driver may call back from several threads, the ring has a single producer
+    std::atomic_flag mProducerFlag = ATOMIC_FLAG_INIT;
+    std::atomic<unsigned long> mDropped {0};
+
+    std::thread mThread;
+    std::atomic<bool> mRunning {false};
+
+    // Logger thread only
+    std::map<std::tuple<GLenum, GLenum, GLuint, std::string>, Entry> mEntries;
+    std::map<GLuint, double> mLastPrint;
+
+    std::atomic<unsigned long> mPerformanceCount {0};
+    std::mutex mPerformanceMutex;
+    std::string mLastPerformance {""};
+
+    void run();
+    void handle(const DebugMessage& message, double now);
+    void print(const DebugMessage& message, unsigned long repeated);
+    static const char* getTypeName(GLenum type);
+};
+
+#endif // DEBUGLOG_H
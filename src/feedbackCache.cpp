@@ -0,0 +1,274 @@
+#include "feedbackCache.h"
+
+#include <iostream>
+
+#include "glState.h"
+
+using namespace std;
+
+namespace
+{
+/*************/
+bool isLinked(GLuint program, const char* name)
+{
+    GLint lStatus;
+    glGetProgramiv(program, GL_LINK_STATUS, &lStatus);
+    if (lStatus)
+        return true;
+
+    GLchar lLog[1024];
+    glGetProgramInfoLog(program, sizeof(lLog), nullptr, lLog);
+    cerr << "Transform feedback cache: failed to link the " << name << " program." << endl << lLog << endl;
+    return false;
+}
+
+/*************/
+string glslType(int size)
+{
+    return size == 1 ? string("float") : string("vec") + to_string(size);
+}
+
+/*************/
+string inputName(const string& output)
+{
+    return output == "gl_Position" ? string("tfPosition") : string("tf_") + output;
+}
+}
+
+/*************/
+FeedbackCache::~FeedbackCache()
+{
+    if (mQueries[0])
+        glDeleteQueries(2, mQueries);
+}
+
+/*************/
+bool FeedbackCache::link(const vector<GLuint>& shaders, GLuint fragmentShader, FeedbackPrograms& programs)
+{
+    programs = FeedbackPrograms();
+
+    // Only the output of tessellation or geometry shaders is worth capturing
+    bool lGeometry = false;
+    bool lTessellation = false;
+    for (auto shader : shaders)
+    {
+        GLint lType;
+        glGetShaderiv(shader, GL_SHADER_TYPE, &lType);
+        lGeometry |= lType == GL_GEOMETRY_SHADER;
+        lTessellation |= lType == GL_TESS_EVALUATION_SHADER;
+    }
+    if (!lGeometry && !lTessellation)
+        return false;
+
+    // Separable, so that all the outputs of the last stage are kept
+    GLProgram lCapture;
+    lCapture.create("feedback capture");
+    for (auto shader : shaders)
+        glAttachShader(lCapture, shader);
+    glBindAttribLocation(lCapture, 0, "vVertex");
+    glBindAttribLocation(lCapture, 1, "vTexCoord");
+    glBindAttribLocation(lCapture, 2, "vInstanceMatrix");
+    glProgramParameteri(lCapture, GL_PROGRAM_SEPARABLE, GL_TRUE);
+    glLinkProgram(lCapture);
+    if (!isLinked(lCapture, "capture"))
+        return false;
+
+    GLint lCount = 0;
+    glGetProgramInterfaceiv(lCapture, GL_PROGRAM_OUTPUT, GL_ACTIVE_RESOURCES, &lCount);
+    programs.attributes.push_back(FeedbackPrograms::Attribute());
+    programs.attributes[0].name = "gl_Position";
+    programs.stride = 4 * sizeof(float);
+    for (GLint i = 0; i < lCount; ++i)
+    {
+        GLchar lName[256];
+        glGetProgramResourceName(lCapture, GL_PROGRAM_OUTPUT, i, sizeof(lName), nullptr, lName);
+        GLenum lProperties[2] {GL_TYPE, GL_ARRAY_SIZE};
+        GLint lValues[2];
+        glGetProgramResourceiv(lCapture, GL_PROGRAM_OUTPUT, i, 2, lProperties, 2, nullptr, lValues);
+
+        string lOutput(lName);
+        if (lOutput.compare(0, 3, "gl_") == 0)
+            continue;
+
+        FeedbackPrograms::Attribute lAttribute;
+        lAttribute.name = lOutput;
+        lAttribute.offset = programs.stride;
+        switch (lValues[0])
+        {
+        case GL_FLOAT:
+            lAttribute.size = 1;
+            break;
+        case GL_FLOAT_VEC2:
+            lAttribute.size = 2;
+            break;
+        case GL_FLOAT_VEC3:
+            lAttribute.size = 3;
+            break;
+        case GL_FLOAT_VEC4:
+            lAttribute.size = 4;
+            break;
+        default:
+            lAttribute.size = 0;
+        }
+
+        if (lAttribute.size == 0 || lValues[1] > 1 || lOutput.find('.') != string::npos)
+        {
+            cout << "Transform feedback cache: output " << lOutput << " can not be captured, only float and vector outputs are supported" << endl;
+            return false;
+        }
+        programs.stride += lAttribute.size * sizeof(float);
+        programs.attributes.push_back(lAttribute);
+    }
+
+    vector<const char*> lVaryings;
+    for (auto& attribute : programs.attributes)
+        lVaryings.push_back(attribute.name.c_str());
+    glTransformFeedbackVaryings(lCapture, lVaryings.size(), lVaryings.data(), GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(lCapture);
+    if (!isLinked(lCapture, "capture"))
+        return false;
+
+    // Strips are captured as separate primitives
+    GLint lMode;
+    if (lGeometry)
+        glGetProgramiv(lCapture, GL_GEOMETRY_OUTPUT_TYPE, &lMode);
+    else
+    {
+        GLint lPointMode;
+        glGetProgramiv(lCapture, GL_TESS_GEN_POINT_MODE, &lPointMode);
+        glGetProgramiv(lCapture, GL_TESS_GEN_MODE, &lMode);
+        if (lPointMode)
+            lMode = GL_POINTS;
+        else if (lMode == GL_ISOLINES)
+            lMode = GL_LINE_STRIP;
+    }
+    if (lMode == GL_POINTS)
+    {
+        programs.primitive = GL_POINTS;
+        programs.verticesPerPrimitive = 1;
+    }
+    else if (lMode == GL_LINE_STRIP)
+    {
+        programs.primitive = GL_LINES;
+        programs.verticesPerPrimitive = 2;
+    }
+
+    // Passthrough vertex stage, feeding the captured outputs to the fragment shader
+    string lSource = "#version 440 core\n\n";
+    for (auto& attribute : programs.attributes)
+    {
+        lSource += "in " + glslType(attribute.size) + " " + inputName(attribute.name) + ";\n";
+        if (attribute.name != "gl_Position")
+            lSource += "out " + glslType(attribute.size) + " " + attribute.name + ";\n";
+    }
+    lSource += "\nvoid main(void)\n{\n";
+    for (auto& attribute : programs.attributes)
+        lSource += "    " + attribute.name + " = " + inputName(attribute.name) + ";\n";
+    lSource += "}\n";
+
+    const GLchar* lSourcePtr = lSource.c_str();
+    GLShader lPassthrough;
+    lPassthrough.create("feedback passthrough", GL_VERTEX_SHADER);
+    glShaderSource(lPassthrough, 1, &lSourcePtr, 0);
+    glCompileShader(lPassthrough);
+
+    GLProgram lDraw;
+    lDraw.create("feedback draw");
+    glAttachShader(lDraw, lPassthrough);
+    glAttachShader(lDraw, fragmentShader);
+    for (int i = 0; i < programs.attributes.size(); ++i)
+        glBindAttribLocation(lDraw, i, inputName(programs.attributes[i].name).c_str());
+    glLinkProgram(lDraw);
+    if (!isLinked(lDraw, "draw"))
+        return false;
+
+    programs.capture = move(lCapture);
+    programs.draw = move(lDraw);
+    programs.passthrough = move(lPassthrough);
+    return true;
+}
+
+/*************/
+bool FeedbackCache::isValid(const FeedbackPrograms& programs, const vector<double>& key) const
+{
+    return mProgram != 0 && mProgram == programs.capture && mKey == key;
+}
+
+/*************/
+void FeedbackCache::capture(const FeedbackPrograms& programs, const vector<double>& key, const function<void()>& func)
+{
+    if (mBuffer == 0)
+    {
+        mBuffer.create("feedback capture");
+        mVertexArray.create("feedback capture");
+        glGenQueries(2, mQueries);
+    }
+    if (mBufferSize == 0)
+    {
+        mBufferSize = 1 << 20;
+        glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+        glBufferData(GL_ARRAY_BUFFER, mBufferSize, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        mBuffer.setSize(mBufferSize);
+    }
+
+    // The amount of output is only known once generated: if it overflowed, it is captured
+    // again in a buffer large enough. Waiting for the queries stalls, but only when capturing
+    GLState::enable(GL_RASTERIZER_DISCARD);
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, mBuffer);
+        glBeginQuery(GL_PRIMITIVES_GENERATED, mQueries[0]);
+        glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, mQueries[1]);
+        glBeginTransformFeedback(programs.primitive);
+        func();
+        glEndTransformFeedback();
+        glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+        glEndQuery(GL_PRIMITIVES_GENERATED);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+
+        GLuint lGenerated, lWritten;
+        glGetQueryObjectuiv(mQueries[0], GL_QUERY_RESULT, &lGenerated);
+        glGetQueryObjectuiv(mQueries[1], GL_QUERY_RESULT, &lWritten);
+        mPrimitives = lWritten;
+        if (lGenerated <= lWritten)
+            break;
+
+        mBufferSize = (size_t)lGenerated * programs.verticesPerPrimitive * programs.stride;
+        glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+        glBufferData(GL_ARRAY_BUFFER, mBufferSize, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        mBuffer.setSize(mBufferSize);
+    }
+    GLState::disable(GL_RASTERIZER_DISCARD);
+
+    mProgram = programs.capture;
+    mKey = key;
+}
+
+/*************/
+void FeedbackCache::draw(const FeedbackPrograms& programs)
+{
+    if (mLayoutProgram != programs.draw)
+        setLayout(programs);
+
+    GLState::bindVertexArray(mVertexArray);
+    GLState::drawArrays(programs.primitive, 0, mPrimitives * programs.verticesPerPrimitive);
+}
+
+/*************/
+void FeedbackCache::setLayout(const FeedbackPrograms& programs)
+{
+    GLState::bindVertexArray(mVertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+    for (int i = 0; i < programs.attributes.size(); ++i)
+    {
+        auto& lAttribute = programs.attributes[i];
+        glEnableVertexAttribArray(i);
+        glVertexAttribPointer(i, lAttribute.size, GL_FLOAT, GL_FALSE, programs.stride, (const GLvoid*)lAttribute.offset);
+    }
+    for (int i = programs.attributes.size(); i < 16; ++i)
+        glDisableVertexAttribArray(i);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    mLayoutProgram = programs.draw;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @feedbackCache.h
+ * Captures the output of the tessellation and geometry stages with transform
+ * feedback, to draw it again without running these stages
+ *
+ * The programs depend on the shaders only, while each pass keeps its own
+ * captured buffer along with the inputs it was captured with.
+ */
+
+#ifndef FEEDBACKCACHE_H
+#define FEEDBACKCACHE_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "GLFW/glfw3.h"
+
+#include "glObject.h"
+
+/*************/
+// Programs capturing the output of the pre-raster stages, and drawing it back
+struct FeedbackPrograms
+{
+    struct Attribute
+    {
+        std::string name;
+        GLint size {4};
+        size_t offset {0};
+    };
+
+    GLProgram capture;
+    GLProgram draw;
+    GLShader passthrough; // Vertex shader of the draw program
+    GLenum primitive {GL_TRIANGLES};
+    int verticesPerPrimitive {3};
+    GLsizei stride {0};
+    std::vector<Attribute> attributes;
+};
+
+/*************/
+class FeedbackCache
+{
+public:
+    ~FeedbackCache();
+
+    // Links the programs for the given pre-raster shaders, drawn back with the fragment shader.
+    // Returns false if there is nothing worth capturing, or if the outputs can not be captured
+    static bool link(const std::vector<GLuint>& shaders, GLuint fragmentShader, FeedbackPrograms& programs);
+
+    // Whether the last capture was done with the same programs and inputs
+    bool isValid(const FeedbackPrograms& programs, const std::vector<double>& key) const;
+    // Captures the primitives drawn by func, with the capture program in use
+    void capture(const FeedbackPrograms& programs, const std::vector<double>& key, const std::function<void()>& func);
+    void draw(const FeedbackPrograms& programs);
+    // Programs are compared by name, which GL reuses once they are deleted
+    void invalidate() {mProgram = 0; mLayoutProgram = 0;}
+
+    int getPrimitives() const {return mPrimitives;}
+    size_t getSize() const {return mBufferSize;}
+
+private:
+    GLBuffer mBuffer;
+    GLVertexArray mVertexArray;
+    GLuint mQueries[2] {0, 0};
+    size_t mBufferSize {0};
+
+    GLuint mProgram {0}; // Capture program of the last capture
+    GLuint mLayoutProgram {0}; // Draw program the vertex array was set for
+    std::vector<double> mKey;
+    int mPrimitives {0};
+
+    void setLayout(const FeedbackPrograms& programs);
+};
+
+#endif // FEEDBACKCACHE_H
@@ -0,0 +1,43 @@
+#include "fileWatcher.h"
+
+#include "boost/filesystem.hpp"
+
+using namespace std;
+
+/*************/
+void FileWatcher::setFiles(const vector<string>& files)
+{
+    map<string, time_t> lTimes;
+    lock_guard<mutex> lLock(mMutex);
+    for (auto& file : files)
+    {
+        auto lTimeIt = mTimes.find(file);
+        lTimes[file] = lTimeIt == mTimes.end() ? getTime(file) : lTimeIt->second;
+    }
+    mTimes.swap(lTimes);
+}
+
+/*************/
+bool FileWatcher::changed()
+{
+    bool lChanged = false;
+    lock_guard<mutex> lLock(mMutex);
+    for (auto& file : mTimes)
+    {
+        time_t lTime = getTime(file.first);
+        if (lTime != file.second)
+        {
+            file.second = lTime;
+            lChanged = true;
+        }
+    }
+    return lChanged;
+}
+
+/*************/
+time_t FileWatcher::getTime(const string& file) const
+{
+    boost::system::error_code lError;
+    time_t lTime = boost::filesystem::last_write_time(file, lError);
+    return lError ? 0 : lTime;
+}
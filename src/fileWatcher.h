@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @fileWatcher.h
+ * Watches the modification time of a list of files, from any thread
+ */
+
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*************/
+class FileWatcher
+{
+public:
+    // Files already watched keep their last known time
+    void setFiles(const std::vector<std::string>& files);
+    // Returns true if a file was modified, created or removed since the last call
+    bool changed();
+
+private:
+    std::mutex mMutex;
+    std::map<std::string, std::time_t> mTimes;
+
+    std::time_t getTime(const std::string& file) const;
+};
+
+#endif // FILEWATCHER_H
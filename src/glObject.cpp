@@ -0,0 +1,212 @@
+#include "glObject.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "glState.h"
+
+using namespace std;
+
+mutex GLRegistry::mMutex;
+map<pair<int, GLuint>, GLRegistry::Entry> GLRegistry::mObjects;
+size_t GLRegistry::mBytes[GLRegistry::CategoryCount] {0};
+size_t GLRegistry::mPeakBytes[GLRegistry::CategoryCount] {0};
+int GLRegistry::mCounts[GLRegistry::CategoryCount] {0};
+
+/*************/
+void GLRegistry::add(Category category, GLuint name, const char* label)
+{
+    if (name == 0)
+        return;
+
+    lock_guard<mutex> lLock(mMutex);
+    Entry& lEntry = mObjects[make_pair((int)category, name)];
+    lEntry.label = label;
+    lEntry.bytes = 0;
+    mCounts[category]++;
+}
+
+/*************/
+void GLRegistry::setSize(Category category, GLuint name, size_t bytes)
+{
+    lock_guard<mutex> lLock(mMutex);
+    auto lObjectIt = mObjects.find(make_pair((int)category, name));
+    if (lObjectIt == mObjects.end())
+        return;
+
+    mBytes[category] = mBytes[category] - lObjectIt->second.bytes + bytes;
+    mPeakBytes[category] = max(mPeakBytes[category], mBytes[category]);
+    lObjectIt->second.bytes = bytes;
+}
+
+/*************/
+void GLRegistry::remove(Category category, GLuint name)
+{
+    // Bindings to the name are forgotten, even for objects not registered
+    GLState::forget(category, name);
+
+    lock_guard<mutex> lLock(mMutex);
+    auto lObjectIt = mObjects.find(make_pair((int)category, name));
+    if (lObjectIt == mObjects.end())
+        return;
+
+    mBytes[category] -= lObjectIt->second.bytes;
+    mCounts[category]--;
+    mObjects.erase(lObjectIt);
+}
+
+/*************/
+size_t GLRegistry::getBytes(Category category)
+{
+    lock_guard<mutex> lLock(mMutex);
+    return mBytes[category];
+}
+
+/*************/
+size_t GLRegistry::getPeakBytes(Category category)
+{
+    lock_guard<mutex> lLock(mMutex);
+    return mPeakBytes[category];
+}
+
+/*************/
+int GLRegistry::getCount(Category category)
+{
+    lock_guard<mutex> lLock(mMutex);
+    return mCounts[category];
+}
+
+/*************/
+const char* GLRegistry::getName(Category category)
+{
+    static const char* lNames[CategoryCount] {"buffers", "textures", "shaders", "programs", "framebuffers", "vertex arrays"};
+    return lNames[category];
+}
+
+/*************/
+size_t GLRegistry::getTextureBytes(GLenum internalFormat, int width, int height, int levels, int samples)
+{
+    size_t lPixelBytes = 4;
+    switch (internalFormat)
+    {
+    case GL_R8:
+        lPixelBytes = 1;
+        break;
+    case GL_R16:
+    case GL_R16F:
+    case GL_RG8:
+        lPixelBytes = 2;
+        break;
+    case GL_RGBA16:
+    case GL_RGBA16F:
+    case GL_RG32F:
+        lPixelBytes = 8;
+        break;
+    case GL_RGBA32F:
+    case GL_RGBA32UI:
+        lPixelBytes = 16;
+        break;
+    default:
+        // 8 bit RGBA, packed formats, single channel 32 bit and depth formats
+        lPixelBytes = 4;
+    }
+
+    size_t lPixels = 0;
+    for (int level = 0; level < max(1, levels); ++level)
+        lPixels += (size_t)max(1, width >> level) * (size_t)max(1, height >> level);
+    return lPixels * lPixelBytes * max(1, samples);
+}
+
+/*************/
+int GLRegistry::reportLeaks()
+{
+    lock_guard<mutex> lLock(mMutex);
+    if (mObjects.size() == 0)
+    {
+        cout << "All GL objects have been released." << endl;
+        return 0;
+    }
+
+    cerr << "GL objects still alive at exit: " << mObjects.size() << endl;
+    for (auto& object : mObjects)
+    {
+        cerr << "  " << getName((Category)object.first.first) << " " << object.first.second << " (" << object.second.label;
+        if (object.second.bytes > 0)
+            cerr << ", " << object.second.bytes / 1024 << " kB";
+        cerr << ")" << endl;
+    }
+    return mObjects.size();
+}
+
+/*************/
+template<GLRegistry::Category C>
+void GLObject<C>::reset()
+{
+    if (mName == 0)
+        return;
+
+    GLRegistry::remove(C, mName);
+    switch (C)
+    {
+    case GLRegistry::Buffer:
+        glDeleteBuffers(1, &mName);
+        break;
+    case GLRegistry::Texture:
+        glDeleteTextures(1, &mName);
+        break;
+    case GLRegistry::Shader:
+        glDeleteShader(mName);
+        break;
+    case GLRegistry::Program:
+        glDeleteProgram(mName);
+        break;
+    case GLRegistry::Framebuffer:
+        glDeleteFramebuffers(1, &mName);
+        break;
+    case GLRegistry::VertexArray:
+        glDeleteVertexArrays(1, &mName);
+        break;
+    default:
+        break;
+    }
+    mName = 0;
+}
+
+/*************/
+template<GLRegistry::Category C>
+GLuint GLObject<C>::create(const char* label, GLenum type)
+{
+    reset();
+    switch (C)
+    {
+    case GLRegistry::Buffer:
+        glGenBuffers(1, &mName);
+        break;
+    case GLRegistry::Texture:
+        glGenTextures(1, &mName);
+        break;
+    case GLRegistry::Shader:
+        mName = glCreateShader(type);
+        break;
+    case GLRegistry::Program:
+        mName = glCreateProgram();
+        break;
+    case GLRegistry::Framebuffer:
+        glGenFramebuffers(1, &mName);
+        break;
+    case GLRegistry::VertexArray:
+        glGenVertexArrays(1, &mName);
+        break;
+    default:
+        break;
+    }
+    GLRegistry::add(C, mName, label);
+    return mName;
+}
+
+template class GLObject<GLRegistry::Buffer>;
+template class GLObject<GLRegistry::Texture>;
+template class GLObject<GLRegistry::Shader>;
+template class GLObject<GLRegistry::Program>;
+template class GLObject<GLRegistry::Framebuffer>;
+template class GLObject<GLRegistry::VertexArray>;
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @glObject.h
+ * Owning wrappers for GL objects, and the registry which keeps track of
+ * them and of the memory they use
+ *
+ * Sizes are given when the storage is allocated, from the format, the
+ * dimensions and the levels of textures or the size of buffers. Objects
+ * still registered once everything has been released are reported as
+ * leaks.
+ */
+
+#ifndef GLOBJECT_H
+#define GLOBJECT_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "GLFW/glfw3.h"
+
+/*************/
+class GLRegistry
+{
+public:
+    enum Category
+    {
+        Buffer = 0,
+        Texture,
+        Shader,
+        Program,
+        Framebuffer,
+        VertexArray,
+        CategoryCount
+    };
+
+    // For objects whose lifetime is handled elsewhere than in a GLObject
+    static void add(Category category, GLuint name, const char* label);
+    static void setSize(Category category, GLuint name, size_t bytes);
+    static void remove(Category category, GLuint name);
+
+    static size_t getBytes(Category category);
+    static size_t getPeakBytes(Category category);
+    static int getCount(Category category);
+    static const char* getName(Category category);
+
+    // Size of a texture, all its levels included
+    static size_t getTextureBytes(GLenum internalFormat, int width, int height, int levels = 1, int samples = 1);
+
+    // Lists the objects still registered, returns their number
+    static int reportLeaks();
+
+private:
+    struct Entry
+    {
+        std::string label;
+        size_t bytes {0};
+    };
+
+    static std::mutex mMutex;
+    static std::map<std::pair<int, GLuint>, Entry> mObjects;
+    static size_t mBytes[CategoryCount];
+    static size_t mPeakBytes[CategoryCount];
+    static int mCounts[CategoryCount];
+};
+
+/*************/
+template<GLRegistry::Category C>
+class GLObject
+{
+public:
+    GLObject() {}
+    ~GLObject() {reset();}
+
+    GLObject(const GLObject&) = delete;
+    GLObject& operator=(const GLObject&) = delete;
+    GLObject(GLObject&& other) : mName(other.mName) {other.mName = 0;}
+    GLObject& operator=(GLObject&& other)
+    {
+        if (this != &other)
+        {
+            reset();
+            mName = other.mName;
+            other.mName = 0;
+        }
+        return *this;
+    }
+
+    // Deletes the current object, if any, and creates a new one. The type is only used by shaders
+    GLuint create(const char* label, GLenum type = 0);
+    void reset();
+
+    void setSize(size_t bytes) {GLRegistry::setSize(C, mName, bytes);}
+    GLuint get() const {return mName;}
+    operator GLuint() const {return mName;}
+
+private:
+    GLuint mName {0};
+};
+
+typedef GLObject<GLRegistry::Buffer> GLBuffer;
+typedef GLObject<GLRegistry::Texture> GLTexture;
+typedef GLObject<GLRegistry::Shader> GLShader;
+typedef GLObject<GLRegistry::Program> GLProgram;
+typedef GLObject<GLRegistry::Framebuffer> GLFramebuffer;
+typedef GLObject<GLRegistry::VertexArray> GLVertexArray;
+
+#endif // GLOBJECT_H
@@ -0,0 +1,347 @@
+#include "glState.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// Value of the state not known yet, never a valid name nor enum
+#define GL_STATE_UNKNOWN 0xFFFFFFFF
+
+map<GLenum, bool> GLState::mCapabilities;
+GLuint GLState::mActiveUnit {GL_STATE_UNKNOWN};
+GLuint GLState::mTextures[GL_STATE_TEXTURE_UNITS][2];
+GLuint GLState::mProgram {GL_STATE_UNKNOWN};
+GLuint GLState::mVertexArray {GL_STATE_UNKNOWN};
+GLuint GLState::mDrawFramebuffer {GL_STATE_UNKNOWN};
+GLuint GLState::mReadFramebuffer {GL_STATE_UNKNOWN};
+map<GLuint, vector<GLenum>> GLState::mDrawBuffers;
+GLint GLState::mViewport[4] {-1, -1, -1, -1};
+GLenum GLState::mPolygonMode {GL_STATE_UNKNOWN};
+GLenum GLState::mCullFace {GL_STATE_UNKNOWN};
+GLenum GLState::mDepthFunc {GL_STATE_UNKNOWN};
+GLuint GLState::mDepthMask {GL_STATE_UNKNOWN};
+GLuint GLState::mColorMask {GL_STATE_UNKNOWN};
+GLenum GLState::mBlendFunc[2] {GL_STATE_UNKNOWN, GL_STATE_UNKNOWN};
+
+int GLState::mCalls[GLState::CategoryCount] {0};
+int GLState::mElided[GLState::CategoryCount] {0};
+int GLState::mLastCalls[GLState::CategoryCount] {0};
+int GLState::mLastElided[GLState::CategoryCount] {0};
+
+/*************/
+void GLState::invalidate()
+{
+    mCapabilities.clear();
+    mActiveUnit = GL_STATE_UNKNOWN;
+    for (auto& unit : mTextures)
+        unit[0] = unit[1] = GL_STATE_UNKNOWN;
+    mProgram = GL_STATE_UNKNOWN;
+    mVertexArray = GL_STATE_UNKNOWN;
+    mDrawFramebuffer = GL_STATE_UNKNOWN;
+    mReadFramebuffer = GL_STATE_UNKNOWN;
+    mDrawBuffers.clear();
+    for (auto& v : mViewport)
+        v = -1;
+    mPolygonMode = GL_STATE_UNKNOWN;
+    mCullFace = GL_STATE_UNKNOWN;
+    mDepthFunc = GL_STATE_UNKNOWN;
+    mDepthMask = GL_STATE_UNKNOWN;
+    mColorMask = GL_STATE_UNKNOWN;
+    mBlendFunc[0] = mBlendFunc[1] = GL_STATE_UNKNOWN;
+}
+
+/*************/
+void GLState::forget(GLRegistry::Category category, GLuint name)
+{
+    // Deleting a bound object binds 0 instead, except for programs which stay in use
+    switch (category)
+    {
+    case GLRegistry::Texture:
+        for (auto& unit : mTextures)
+            for (auto& texture : unit)
+                if (texture == name)
+                    texture = 0;
+        break;
+    case GLRegistry::Program:
+        if (mProgram == name)
+            mProgram = GL_STATE_UNKNOWN;
+        break;
+    case GLRegistry::Framebuffer:
+        if (mDrawFramebuffer == name)
+            mDrawFramebuffer = 0;
+        if (mReadFramebuffer == name)
+            mReadFramebuffer = 0;
+        mDrawBuffers.erase(name);
+        break;
+    case GLRegistry::VertexArray:
+        if (mVertexArray == name)
+            mVertexArray = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+/*************/
+bool GLState::change(Category category, GLuint& current, GLuint value)
+{
+    if (current == value)
+    {
+        mElided[category]++;
+        return false;
+    }
+    current = value;
+    mCalls[category]++;
+    return true;
+}
+
+/*************/
+void GLState::enable(GLenum capability)
+{
+    auto lCapabilityIt = mCapabilities.find(capability);
+    if (lCapabilityIt != mCapabilities.end() && lCapabilityIt->second)
+    {
+        mElided[Capability]++;
+        return;
+    }
+    mCapabilities[capability] = true;
+    mCalls[Capability]++;
+    glEnable(capability);
+}
+
+/*************/
+void GLState::disable(GLenum capability)
+{
+    auto lCapabilityIt = mCapabilities.find(capability);
+    if (lCapabilityIt != mCapabilities.end() && !lCapabilityIt->second)
+    {
+        mElided[Capability]++;
+        return;
+    }
+    mCapabilities[capability] = false;
+    mCalls[Capability]++;
+    glDisable(capability);
+}
+
+/*************/
+void GLState::activeTexture(int unit)
+{
+    if (change(Texture, mActiveUnit, unit))
+        glActiveTexture(GL_TEXTURE0 + unit);
+}
+
+/*************/
+void GLState::bindTexture(int unit, GLenum target, GLuint texture)
+{
+    // Other targets are not tracked, and always bound
+    int lTarget = target == GL_TEXTURE_2D ? 0 : target == GL_TEXTURE_2D_MULTISAMPLE ? 1 : -1;
+    if (unit >= 0 && unit < GL_STATE_TEXTURE_UNITS && lTarget >= 0)
+    {
+        if (!change(Texture, mTextures[unit][lTarget], texture))
+            return;
+    }
+    else
+        mCalls[Texture]++;
+
+    activeTexture(unit);
+    glBindTexture(target, texture);
+}
+
+/*************/
+void GLState::editTexture(GLenum target, GLuint texture, int unit)
+{
+    bindTexture(unit, target, texture);
+    activeTexture(unit);
+}
+
+/*************/
+void GLState::useProgram(GLuint program)
+{
+    if (change(Program, mProgram, program))
+        glUseProgram(program);
+}
+
+/*************/
+void GLState::bindVertexArray(GLuint vertexArray)
+{
+    if (change(VertexArray, mVertexArray, vertexArray))
+        glBindVertexArray(vertexArray);
+}
+
+/*************/
+void GLState::bindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    if (target == GL_DRAW_FRAMEBUFFER)
+    {
+        if (change(Framebuffer, mDrawFramebuffer, framebuffer))
+            glBindFramebuffer(target, framebuffer);
+    }
+    else if (target == GL_READ_FRAMEBUFFER)
+    {
+        if (change(Framebuffer, mReadFramebuffer, framebuffer))
+            glBindFramebuffer(target, framebuffer);
+    }
+    else if (mDrawFramebuffer != framebuffer || mReadFramebuffer != framebuffer)
+    {
+        mDrawFramebuffer = framebuffer;
+        mReadFramebuffer = framebuffer;
+        mCalls[Framebuffer]++;
+        glBindFramebuffer(target, framebuffer);
+    }
+    else
+        mElided[Framebuffer]++;
+}
+
+/*************/
+void GLState::drawBuffers(GLsizei count, const GLenum* buffers)
+{
+    if (mDrawFramebuffer != GL_STATE_UNKNOWN)
+    {
+        vector<GLenum>& lCurrent = mDrawBuffers[mDrawFramebuffer];
+        if (lCurrent.size() == (size_t)count && equal(lCurrent.begin(), lCurrent.end(), buffers))
+        {
+            mElided[Framebuffer]++;
+            return;
+        }
+        lCurrent.assign(buffers, buffers + count);
+    }
+    mCalls[Framebuffer]++;
+    glDrawBuffers(count, buffers);
+}
+
+/*************/
+void GLState::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (mViewport[0] == x && mViewport[1] == y && mViewport[2] == width && mViewport[3] == height)
+    {
+        mElided[Raster]++;
+        return;
+    }
+    mViewport[0] = x;
+    mViewport[1] = y;
+    mViewport[2] = width;
+    mViewport[3] = height;
+    mCalls[Raster]++;
+    glViewport(x, y, width, height);
+}
+
+/*************/
+void GLState::polygonMode(GLenum mode)
+{
+    if (change(Raster, mPolygonMode, mode))
+        glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+/*************/
+void GLState::cullFace(GLenum face)
+{
+    if (change(Raster, mCullFace, face))
+        glCullFace(face);
+}
+
+/*************/
+void GLState::depthFunc(GLenum func)
+{
+    if (change(Raster, mDepthFunc, func))
+        glDepthFunc(func);
+}
+
+/*************/
+void GLState::depthMask(GLboolean mask)
+{
+    if (change(Raster, mDepthMask, mask))
+        glDepthMask(mask);
+}
+
+/*************/
+void GLState::colorMask(GLboolean mask)
+{
+    if (change(Raster, mColorMask, mask))
+        glColorMask(mask, mask, mask, mask);
+}
+
+/*************/
+void GLState::blendFunc(GLenum source, GLenum destination)
+{
+    if (mBlendFunc[0] == source && mBlendFunc[1] == destination)
+    {
+        mElided[Raster]++;
+        return;
+    }
+    mBlendFunc[0] = source;
+    mBlendFunc[1] = destination;
+    mCalls[Raster]++;
+    glBlendFunc(source, destination);
+}
+
+/*************/
+void GLState::drawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    mCalls[Draw]++;
+    glDrawArrays(mode, first, count);
+}
+
+/*************/
+void GLState::drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+    mCalls[Draw]++;
+    glDrawArraysInstanced(mode, first, count, instances);
+}
+
+/*************/
+void GLState::multiDrawArrays(GLenum mode, const GLint* first, const GLsizei* count, GLsizei drawCount)
+{
+    mCalls[Draw]++;
+    glMultiDrawArrays(mode, first, count, drawCount);
+}
+
+/*************/
+void GLState::multiDrawArraysIndirect(GLenum mode, const void* indirect, GLsizei drawCount, GLsizei stride)
+{
+    mCalls[Draw]++;
+    glMultiDrawArraysIndirect(mode, indirect, drawCount, stride);
+}
+
+/*************/
+void GLState::dispatchCompute(GLuint x, GLuint y, GLuint z)
+{
+    mCalls[Draw]++;
+    glDispatchCompute(x, y, z);
+}
+
+/*************/
+void GLState::endFrame()
+{
+    for (int c = 0; c < CategoryCount; ++c)
+    {
+        mLastCalls[c] = mCalls[c];
+        mLastElided[c] = mElided[c];
+        mCalls[c] = 0;
+        mElided[c] = 0;
+    }
+}
+
+/*************/
+int GLState::getTotalCalls()
+{
+    int lTotal = 0;
+    for (auto calls : mLastCalls)
+        lTotal += calls;
+    return lTotal;
+}
+
+/*************/
+int GLState::getTotalElided()
+{
+    int lTotal = 0;
+    for (auto elided : mLastElided)
+        lTotal += elided;
+    return lTotal;
+}
+
+/*************/
+const char* GLState::getName(Category category)
+{
+    static const char* lNames[CategoryCount] {"capabilities", "textures", "programs", "vertex arrays", "framebuffers", "raster", "draws"};
+    return lNames[category];
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @glState.h
+ * Cache of the GL state set by the renderer, which skips the calls
+ * changing nothing and counts those issued, per frame
+ *
+ * Everything binding textures, programs, vertex arrays or framebuffers,
+ * or changing the capabilities and the raster state, has to go through
+ * it for the cache to stay right. Deleted objects are forgotten through
+ * GLRegistry, as their names can be given again. GL calls are made from
+ * the render thread only, so there is no locking.
+ */
+
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <map>
+#include <vector>
+
+#include "GLFW/glfw3.h"
+
+#include "glObject.h"
+
+// Texture units whose bindings are tracked
+#define GL_STATE_TEXTURE_UNITS 16
+// Unit used to create and update textures which have no unit of their own
+#define GL_STATE_EDIT_UNIT 14
+
+/*************/
+class GLState
+{
+public:
+    enum Category
+    {
+        Capability = 0,
+        Texture,
+        Program,
+        VertexArray,
+        Framebuffer,
+        Raster,
+        Draw,
+        CategoryCount
+    };
+
+    // Everything is considered unknown, and set again by the next calls.
+    // To be called once the context is created
+    static void invalidate();
+    static void forget(GLRegistry::Category category, GLuint name);
+
+    static void enable(GLenum capability);
+    static void disable(GLenum capability);
+
+    // The active unit only changes if the binding does. Call editTexture
+    // instead before glTex* calls, which need the texture unit to be active
+    static void bindTexture(int unit, GLenum target, GLuint texture);
+    static void editTexture(GLenum target, GLuint texture, int unit = GL_STATE_EDIT_UNIT);
+    static void activeTexture(int unit);
+
+    static void useProgram(GLuint program);
+    static void bindVertexArray(GLuint vertexArray);
+    // Draw buffers are kept for each framebuffer, as GL does
+    static void bindFramebuffer(GLenum target, GLuint framebuffer);
+    static void drawBuffers(GLsizei count, const GLenum* buffers);
+
+    static void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    static void polygonMode(GLenum mode);
+    static void cullFace(GLenum face);
+    static void depthFunc(GLenum func);
+    static void depthMask(GLboolean mask);
+    static void colorMask(GLboolean mask);
+    static void blendFunc(GLenum source, GLenum destination);
+
+    static void drawArrays(GLenum mode, GLint first, GLsizei count);
+    static void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances);
+    static void multiDrawArrays(GLenum mode, const GLint* first, const GLsizei* count, GLsizei drawCount);
+    static void multiDrawArraysIndirect(GLenum mode, const void* indirect, GLsizei drawCount, GLsizei stride);
+    static void dispatchCompute(GLuint x, GLuint y, GLuint z);
+
+    // Counts of the last frame, kept until the next one ends
+    static void endFrame();
+    static int getCalls(Category category) {return mLastCalls[category];}
+    static int getElided(Category category) {return mLastElided[category];}
+    static int getTotalCalls();
+    static int getTotalElided();
+    static const char* getName(Category category);
+
+private:
+    static std::map<GLenum, bool> mCapabilities;
+    static GLuint mActiveUnit;
+    static GLuint mTextures[GL_STATE_TEXTURE_UNITS][2];
+    static GLuint mProgram;
+    static GLuint mVertexArray;
+    static GLuint mDrawFramebuffer;
+    static GLuint mReadFramebuffer;
+    static std::map<GLuint, std::vector<GLenum>> mDrawBuffers;
+    static GLint mViewport[4];
+    static GLenum mPolygonMode;
+    static GLenum mCullFace;
+    static GLenum mDepthFunc;
+    static GLuint mDepthMask;
+    static GLuint mColorMask;
+    static GLenum mBlendFunc[2];
+
+    static int mCalls[CategoryCount];
+    static int mElided[CategoryCount];
+    static int mLastCalls[CategoryCount];
+    static int mLastElided[CategoryCount];
+
+    // Returns true if the call is needed, and counts it either way
+    static bool change(Category category, GLuint& current, GLuint value);
+};
+
+#endif // GLSTATE_H
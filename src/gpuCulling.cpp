@@ -0,0 +1,357 @@
+#include "gpuCulling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "glm/gtc/type_ptr.hpp"
+
+#include "glState.h"
+
+using namespace std;
+
+// Bindings used by the culling shaders, kept clear of the ones used by the user shaders
+#define CULL_CHUNK_BINDING 5
+#define CULL_COMMAND_BINDING 6
+#define CULL_STATS_BINDING 7
+#define CULL_IMAGE_UNIT 6
+#define CULL_TEXTURE_UNIT 15
+#define CULL_READBACK_COUNT 4
+
+char gCullShader[] =
+    "#version 430 core\n"
+    "\n"
+    "layout(local_size_x = 64) in;\n"
+    "\n"
+    "struct Chunk {vec4 boundsMin; vec4 boundsMax; uvec4 range;};\n"
+    "struct Command {uint count; uint instanceCount; uint first; uint baseInstance;};\n"
+    "\n"
+    "layout(std430, binding = 5) readonly buffer Chunks {Chunk chunks[];};\n"
+    "layout(std430, binding = 6) writeonly buffer Commands {Command commands[];};\n"
+    "layout(std430, binding = 7) buffer Stats {uint visibleChunks; uint visibleTriangles; uint occludedChunks; uint pad;};\n"
+    "\n"
+    "uniform mat4 vMVP;\n"
+    "uniform vec2 vFBOScale;\n"
+    "uniform int vChunkCount;\n"
+    "uniform bool vOcclusion;\n"
+    "uniform sampler2D vHiZ;\n"
+    "\n"
+    "bool inFrustum(vec3 boundsMin, vec3 boundsMax)\n"
+    "{\n"
+    "    for (int i = 0; i < 3; ++i)\n"
+    "    {\n"
+    "        vec4 row = vec4(vMVP[0][i], vMVP[1][i], vMVP[2][i], vMVP[3][i]);\n"
+    "        vec4 last = vec4(vMVP[0][3], vMVP[1][3], vMVP[2][3], vMVP[3][3]);\n"
+    "        for (int s = 0; s < 2; ++s)\n"
+    "        {\n"
+    "            vec4 plane = s == 0 ? last + row : last - row;\n"
+    "            vec3 farthest = mix(boundsMin, boundsMax, step(0.0, plane.xyz));\n"
+    "            if (dot(plane.xyz, farthest) + plane.w < 0.0)\n"
+    "                return false;\n"
+    "        }\n"
+    "    }\n"
+    "    return true;\n"
+    "}\n"
+    "\n"
+    "bool isOccluded(vec3 boundsMin, vec3 boundsMax)\n"
+    "{\n"
+    "    vec3 ndcMin = vec3(1.0);\n"
+    "    vec3 ndcMax = vec3(-1.0);\n"
+    "    for (int i = 0; i < 8; ++i)\n"
+    "    {\n"
+    "        vec3 corner = mix(boundsMin, boundsMax, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));\n"
+    "        vec4 clip = vMVP * vec4(corner, 1.0);\n"
+    "        if (clip.w <= 0.0)\n"
+    "            return false;\n"
+    "        ndcMin = min(ndcMin, clip.xyz / clip.w);\n"
+    "        ndcMax = max(ndcMax, clip.xyz / clip.w);\n"
+    "    }\n"
+    "\n"
+    "    // The footprint of the box covers at most two texels per axis at this level\n"
+    "    vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5, 0.0, 1.0) * vFBOScale;\n"
+    "    vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5, 0.0, 1.0) * vFBOScale;\n"
+    "    vec2 size = (uvMax - uvMin) * vec2(textureSize(vHiZ, 0));\n"
+    "    float level = ceil(log2(max(max(size.x, size.y), 1.0)));\n"
+    "    float depth = max(max(textureLod(vHiZ, uvMin, level).r, textureLod(vHiZ, vec2(uvMax.x, uvMin.y), level).r),\n"
+    "                      max(textureLod(vHiZ, vec2(uvMin.x, uvMax.y), level).r, textureLod(vHiZ, uvMax, level).r));\n"
+    "    return ndcMin.z * 0.5 + 0.5 > depth;\n"
+    "}\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint index = gl_GlobalInvocationID.x;\n"
+    "    if (index >= uint(vChunkCount))\n"
+    "        return;\n"
+    "\n"
+    "    Chunk chunk = chunks[index];\n"
+    "    bool visible = inFrustum(chunk.boundsMin.xyz, chunk.boundsMax.xyz);\n"
+    "    if (visible && vOcclusion && isOccluded(chunk.boundsMin.xyz, chunk.boundsMax.xyz))\n"
+    "    {\n"
+    "        visible = false;\n"
+    "        atomicAdd(occludedChunks, 1u);\n"
+    "    }\n"
+    "\n"
+    "    commands[index] = Command(chunk.range.y, visible ? 1u : 0u, chunk.range.x, 0u);\n"
+    "    if (visible)\n"
+    "    {\n"
+    "        atomicAdd(visibleChunks, 1u);\n"
+    "        atomicAdd(visibleTriangles, chunk.range.y / 3u);\n"
+    "    }\n"
+    "}\n";
+
+char gHiZShader[] =
+    "#version 430 core\n"
+    "\n"
+    "layout(local_size_x = 8, local_size_y = 8) in;\n"
+    "\n"
+    "uniform sampler2D vDepth;\n"
+    "layout(r32f, binding = 6) readonly uniform image2D vSource;\n"
+    "layout(r32f, binding = 7) writeonly uniform image2D vDestination;\n"
+    "uniform int vLevel;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    ivec2 dst = ivec2(gl_GlobalInvocationID.xy);\n"
+    "    ivec2 size = imageSize(vDestination);\n"
+    "    if (any(greaterThanEqual(dst, size)))\n"
+    "        return;\n"
+    "\n"
+    "    float depth = 0.0;\n"
+    "    if (vLevel == 0)\n"
+    "        depth = texelFetch(vDepth, dst, 0).r;\n"
+    "    else\n"
+    "    {\n"
+    "        // Farthest depth of the texels covered, the last ones taking the odd row or column\n"
+    "        ivec2 srcSize = imageSize(vSource);\n"
+    "        ivec2 extent = ivec2(2) + ivec2(equal(dst, size - 1)) * (srcSize & 1);\n"
+    "        for (int y = 0; y < extent.y; ++y)\n"
+    "            for (int x = 0; x < extent.x; ++x)\n"
+    "                depth = max(depth, imageLoad(vSource, min(dst * 2 + ivec2(x, y), srcSize - 1)).r);\n"
+    "    }\n"
+    "    imageStore(vDestination, dst, vec4(depth));\n"
+    "}\n";
+
+/*************/
+struct GpuChunk
+{
+    GLfloat boundsMin[4];
+    GLfloat boundsMax[4];
+    GLuint range[4];
+};
+
+/*************/
+GpuCulling::~GpuCulling()
+{
+    release();
+}
+
+/*************/
+void GpuCulling::release()
+{
+    mChunkBuffer.reset();
+    mCommandBuffer.reset();
+    mCullProgram.reset();
+    mHiZProgram.reset();
+    mHiZTexture.reset();
+    mHiZValid = false;
+    for (auto& readback : mReadbacks)
+        if (readback.fence)
+            glDeleteSync(readback.fence);
+    mReadbacks.clear();
+    mChunkCount = 0;
+}
+
+/*************/
+bool GpuCulling::init(const vector<MeshBVH::Chunk>& chunks)
+{
+    mChunkCount = chunks.size();
+    if (mChunkCount == 0)
+        return false;
+
+    if (!compileProgram(gCullShader, "culling", mCullProgram) || !compileProgram(gHiZShader, "depth pyramid", mHiZProgram))
+        return false;
+
+    vector<GpuChunk> lChunks(mChunkCount);
+    for (int i = 0; i < mChunkCount; ++i)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            lChunks[i].boundsMin[axis] = chunks[i].min[axis];
+            lChunks[i].boundsMax[axis] = chunks[i].max[axis];
+        }
+        lChunks[i].boundsMin[3] = lChunks[i].boundsMax[3] = 1.f;
+        lChunks[i].range[0] = chunks[i].first;
+        lChunks[i].range[1] = chunks[i].count;
+        lChunks[i].range[2] = lChunks[i].range[3] = 0;
+    }
+
+    mChunkBuffer.create("culling chunks");
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mChunkBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, lChunks.size() * sizeof(GpuChunk), lChunks.data(), 0);
+    mChunkBuffer.setSize(lChunks.size() * sizeof(GpuChunk));
+
+    // Four uints per command, as expected by glMultiDrawArraysIndirect
+    mCommandBuffer.create("culling commands");
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCommandBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, mChunkCount * 4 * sizeof(GLuint), nullptr, 0);
+    mCommandBuffer.setSize(mChunkCount * 4 * sizeof(GLuint));
+
+    mReadbacks.resize(CULL_READBACK_COUNT);
+    for (auto& readback : mReadbacks)
+    {
+        readback.buffer.create("culling statistics");
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, readback.buffer);
+        glBufferStorage(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
+        readback.buffer.setSize(4 * sizeof(GLuint));
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    cout << "GPU culling: " << mChunkCount << " chunks uploaded." << endl;
+    return true;
+}
+
+/*************/
+bool GpuCulling::compileProgram(const char* source, const char* name, GLProgram& program)
+{
+    GLShader lShader;
+    lShader.create(name, GL_COMPUTE_SHADER);
+    glShaderSource(lShader, 1, (const GLchar**)&source, 0);
+    glCompileShader(lShader);
+
+    GLint lStatus;
+    glGetShaderiv(lShader, GL_COMPILE_STATUS, &lStatus);
+    if (!lStatus)
+    {
+        GLchar lLog[1024];
+        glGetShaderInfoLog(lShader, sizeof(lLog), nullptr, lLog);
+        cerr << "GPU culling: failed to compile the " << name << " shader." << endl << lLog << endl;
+        return false;
+    }
+
+    // The shader is only deleted once detached, with the program
+    program.create(name);
+    glAttachShader(program, lShader);
+    glLinkProgram(program);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &lStatus);
+    if (!lStatus)
+    {
+        cerr << "GPU culling: failed to link the " << name << " program." << endl;
+        program.reset();
+        return false;
+    }
+    return true;
+}
+
+/*************/
+void GpuCulling::cull(const glm::mat4& mvp, const float* fboScale, bool occlusion)
+{
+    if (!isReady())
+        return;
+
+    // Statistics not read back by now are dropped, rather than waited for
+    Readback& lReadback = mReadbacks[mCurrentReadback];
+    mCurrentReadback = (mCurrentReadback + 1) % mReadbacks.size();
+    if (lReadback.fence)
+        glDeleteSync(lReadback.fence);
+    GLuint lZeros[4] {0, 0, 0, 0};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lReadback.buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(lZeros), lZeros);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    GLState::useProgram(mCullProgram);
+    glUniformMatrix4fv(glGetUniformLocation(mCullProgram, "vMVP"), 1, GL_FALSE, glm::value_ptr(mvp));
+    glUniform2fv(glGetUniformLocation(mCullProgram, "vFBOScale"), 1, fboScale);
+    glUniform1i(glGetUniformLocation(mCullProgram, "vChunkCount"), mChunkCount);
+    glUniform1i(glGetUniformLocation(mCullProgram, "vOcclusion"), occlusion && mHiZValid);
+    glUniform1i(glGetUniformLocation(mCullProgram, "vHiZ"), CULL_TEXTURE_UNIT);
+
+    GLState::bindTexture(CULL_TEXTURE_UNIT, GL_TEXTURE_2D, occlusion && mHiZValid ? mHiZTexture : 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_CHUNK_BINDING, mChunkBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COMMAND_BINDING, mCommandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_STATS_BINDING, lReadback.buffer);
+
+    GLState::dispatchCompute((mChunkCount + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    lReadback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/*************/
+void GpuCulling::draw(GLenum primitive)
+{
+    if (!isReady())
+        return;
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mCommandBuffer);
+    GLState::multiDrawArraysIndirect(primitive, nullptr, mChunkCount, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+/*************/
+void GpuCulling::buildHiZ(GLuint depthTexture)
+{
+    if (!isReady() || depthTexture == 0)
+        return;
+
+    GLint lWidth, lHeight;
+    GLState::editTexture(GL_TEXTURE_2D, depthTexture, CULL_TEXTURE_UNIT);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &lWidth);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &lHeight);
+
+    // The pyramid follows the size of the depth target
+    if (lWidth != mHiZWidth || lHeight != mHiZHeight || mHiZTexture == 0)
+    {
+        mHiZWidth = lWidth;
+        mHiZHeight = lHeight;
+        mHiZLevels = 1 + (int)floor(log2((float)max(lWidth, lHeight)));
+
+        mHiZTexture.create("depth pyramid");
+        GLState::editTexture(GL_TEXTURE_2D, mHiZTexture, CULL_TEXTURE_UNIT);
+        glTexStorage2D(GL_TEXTURE_2D, mHiZLevels, GL_R32F, mHiZWidth, mHiZHeight);
+        mHiZTexture.setSize(GLRegistry::getTextureBytes(GL_R32F, mHiZWidth, mHiZHeight, mHiZLevels));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        GLState::bindTexture(CULL_TEXTURE_UNIT, GL_TEXTURE_2D, depthTexture);
+    }
+
+    GLState::useProgram(mHiZProgram);
+    glUniform1i(glGetUniformLocation(mHiZProgram, "vDepth"), CULL_TEXTURE_UNIT);
+    GLint lLevelLocation = glGetUniformLocation(mHiZProgram, "vLevel");
+    for (int level = 0; level < mHiZLevels; ++level)
+    {
+        int lLevelWidth = max(1, mHiZWidth >> level);
+        int lLevelHeight = max(1, mHiZHeight >> level);
+        glUniform1i(lLevelLocation, level);
+        if (level > 0)
+            glBindImageTexture(CULL_IMAGE_UNIT, mHiZTexture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(CULL_IMAGE_UNIT + 1, mHiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        GLState::dispatchCompute((lLevelWidth + 7) / 8, (lLevelHeight + 7) / 8, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    mHiZValid = true;
+}
+
+/*************/
+void GpuCulling::collect()
+{
+    // From the oldest to the newest, so that the latest results available are kept
+    for (int i = 0; i < mReadbacks.size(); ++i)
+    {
+        Readback& lReadback = mReadbacks[(mCurrentReadback + i) % mReadbacks.size()];
+        if (!lReadback.fence)
+            continue;
+
+        GLenum lStatus = glClientWaitSync(lReadback.fence, 0, 0);
+        if (lStatus != GL_ALREADY_SIGNALED && lStatus != GL_CONDITION_SATISFIED)
+            continue;
+
+        glDeleteSync(lReadback.fence);
+        lReadback.fence = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, lReadback.buffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(mStats), mStats);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @gpuCulling.h
+ * Culls the chunks of a mesh with a compute shader, which writes the
+ * indirect draw commands of the visible ones
+ *
+ * Chunks can also be tested against a depth pyramid (Hi-Z) built from
+ * the depth of the previous frame. Statistics are read back a few
+ * frames later, once available, so as not to stall.
+ */
+
+#ifndef GPUCULLING_H
+#define GPUCULLING_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <vector>
+
+#include "GLFW/glfw3.h"
+#include "glm/glm.hpp"
+
+#include "glObject.h"
+#include "meshBVH.h"
+
+/*************/
+class GpuCulling
+{
+public:
+    ~GpuCulling();
+    void release();
+
+    // Uploads the bounds of the chunks, and compiles the compute shaders
+    bool init(const std::vector<MeshBVH::Chunk>& chunks);
+    bool isReady() const {return mCullProgram != 0 && mChunkCount > 0;}
+
+    // Writes the draw commands of the chunks in view. With occlusion, chunks
+    // hidden behind the depth of the previous frame are skipped too.
+    // fboScale is the part of the depth target which is rendered to
+    void cull(const glm::mat4& mvp, const float* fboScale, bool occlusion);
+    void draw(GLenum primitive);
+
+    // Builds the depth pyramid tested by the next culls
+    void buildHiZ(GLuint depthTexture);
+    // Reads back the statistics which are available, without waiting
+    void collect();
+
+    int getChunkCount() const {return mChunkCount;}
+    int getVisibleChunks() const {return mStats[0];}
+    int getVisibleTriangles() const {return mStats[1];}
+    int getOccludedChunks() const {return mStats[2];}
+
+private:
+    struct Readback
+    {
+        GLBuffer buffer;
+        GLsync fence {0};
+    };
+
+    int mChunkCount {0};
+    GLBuffer mChunkBuffer;
+    GLBuffer mCommandBuffer;
+    GLProgram mCullProgram;
+    GLProgram mHiZProgram;
+
+    GLTexture mHiZTexture;
+    int mHiZWidth {0};
+    int mHiZHeight {0};
+    int mHiZLevels {0};
+    bool mHiZValid {false};
+
+    std::vector<Readback> mReadbacks;
+    int mCurrentReadback {0};
+    GLuint mStats[4] {0, 0, 0, 0};
+
+    bool compileProgram(const char* source, const char* name, GLProgram& program);
+};
+
+#endif // GPUCULLING_H
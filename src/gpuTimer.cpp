@@ -0,0 +1,121 @@
+#include "gpuTimer.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+/*************/
+GpuTimer::~GpuTimer()
+{
+    if (mCreated)
+        for (auto& query : mQueries)
+            glDeleteQueries(2, query.ids);
+}
+
+/*************/
+GpuTimer::GpuTimer(GpuTimer&& timer)
+{
+    *this = std::move(timer);
+}
+
+/*************/
+GpuTimer& GpuTimer::operator=(GpuTimer&& timer)
+{
+    if (this == &timer)
+        return *this;
+
+    if (mCreated)
+        for (auto& query : mQueries)
+            glDeleteQueries(2, query.ids);
+
+    mLatency = timer.mLatency;
+    mCreated = timer.mCreated;
+    for (int i = 0; i < mQueryCount; ++i)
+        mQueries[i] = timer.mQueries[i];
+    mFirstPending = timer.mFirstPending;
+    mPendingCount = timer.mPendingCount;
+    mIsRunning = timer.mIsRunning;
+    mLast = timer.mLast;
+
+    timer.mCreated = false;
+    timer.mPendingCount = 0;
+    timer.mIsRunning = false;
+    return *this;
+}
+
+/*************/
+void GpuTimer::begin(int frame)
+{
+    if (mIsRunning)
+        return;
+
+    if (!mCreated)
+    {
+        for (auto& query : mQueries)
+            glGenQueries(2, query.ids);
+        mCreated = true;
+    }
+
+    if (mPendingCount == mQueryCount)
+    {
+        mFirstPending = (mFirstPending + 1) % mQueryCount;
+        mPendingCount--;
+    }
+
+    Query& lQuery = mQueries[(mFirstPending + mPendingCount) % mQueryCount];
+    lQuery.frame = frame;
+    glQueryCounter(lQuery.ids[0], GL_TIMESTAMP);
+    mIsRunning = true;
+}
+
+/*************/
+void GpuTimer::end()
+{
+    if (!mIsRunning)
+        return;
+
+    Query& lQuery = mQueries[(mFirstPending + mPendingCount) % mQueryCount];
+    glQueryCounter(lQuery.ids[1], GL_TIMESTAMP);
+    mPendingCount++;
+    mIsRunning = false;
+}
+
+/*************/
+void GpuTimer::collect(vector<GpuSpan>& spans)
+{
+    read(spans, mPendingCount > min(mLatency * 4, mQueryCount / 2));
+}
+
+/*************/
+void GpuTimer::flush(vector<GpuSpan>& spans)
+{
+    read(spans, true);
+}
+
+/*************/
+void GpuTimer::read(vector<GpuSpan>& spans, bool wait)
+{
+    spans.clear();
+    while (mPendingCount != 0)
+    {
+        Query& lQuery = mQueries[mFirstPending];
+        if (!wait)
+        {
+            GLint lAvailable = 0;
+            glGetQueryObjectiv(lQuery.ids[1], GL_QUERY_RESULT_AVAILABLE, &lAvailable);
+            if (!lAvailable)
+                break;
+        }
+
+        GpuSpan lSpan;
+        lSpan.frame = lQuery.frame;
+        glGetQueryObjectui64v(lQuery.ids[0], GL_QUERY_RESULT, &lSpan.start);
+        glGetQueryObjectui64v(lQuery.ids[1], GL_QUERY_RESULT, &lSpan.end);
+        mLast = lSpan.duration();
+        spans.push_back(lSpan);
+
+        mFirstPending = (mFirstPending + 1) % mQueryCount;
+        mPendingCount--;
+    }
+}
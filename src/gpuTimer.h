@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @gpuTimer.h
+ * Timestamp queries, read back a few frames later so as not to stall
+ */
+
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <vector>
+
+#include "GLFW/glfw3.h"
+
+/*************/
+struct GpuSpan
+{
+    int frame;
+    GLuint64 start;
+    GLuint64 end;
+
+    double duration() const {return (double)(end - start) / 1e6;} // in ms
+};
+
+/*************/
+class GpuTimer
+{
+public:
+    GpuTimer(int latency = 4) : mLatency(latency) {}
+    ~GpuTimer();
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+    GpuTimer(GpuTimer&& timer);
+    GpuTimer& operator=(GpuTimer&& timer);
+
+    void begin(int frame = 0);
+    void end();
+
+    // Fills spans with the results available, without waiting
+    void collect(std::vector<GpuSpan>& spans);
+    // Waits for all pending spans
+    void flush(std::vector<GpuSpan>& spans);
+
+    // Duration of the latest span read back, in ms
+    double getLast() const {return mLast;}
+
+private:
+    // Queries are reused in order, the oldest result is dropped if the ring is full
+    static const int mQueryCount = 32;
+
+    struct Query
+    {
+        GLuint ids[2] {0, 0};
+        int frame {0};
+    };
+
+    int mLatency;
+    bool mCreated {false};
+    Query mQueries[mQueryCount];
+    int mFirstPending {0};
+    int mPendingCount {0};
+    bool mIsRunning {false};
+    double mLast {0.0};
+
+    void read(std::vector<GpuSpan>& spans, bool wait);
+};
+
+#endif // GPUTIMER_H
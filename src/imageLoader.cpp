@@ -0,0 +1,174 @@
+#include "imageLoader.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMAGE_HAS_F16C
+#endif
+
+#include "parallel.h"
+
+using namespace std;
+
+namespace ImageLoader
+{
+
+/*************/
+// Rounds to the nearest even half, overflowing to infinity
+static uint16_t floatToHalf(float value)
+{
+    uint32_t lBits;
+    memcpy(&lBits, &value, sizeof(lBits));
+    uint32_t lSign = (lBits >> 16) & 0x8000;
+    uint32_t lAbs = lBits & 0x7FFFFFFF;
+
+    if (lAbs >= 0x7F800000) // Infinity or NaN
+        return lSign | 0x7C00 | (lAbs > 0x7F800000 ? 0x200 : 0);
+    if (lAbs >= 0x477FF000) // 65520 and above
+        return lSign | 0x7C00;
+
+    if (lAbs < 0x38800000) // Below 2^-14, as a subnormal half
+    {
+        if (lAbs < 0x33000000)
+            return lSign;
+        uint32_t lMantissa = (lAbs & 0x007FFFFF) | 0x00800000;
+        int lShift = 126 - (lAbs >> 23);
+        uint32_t lHalf = lMantissa >> lShift;
+        uint32_t lRemainder = lMantissa & ((1u << lShift) - 1);
+        uint32_t lMiddle = 1u << (lShift - 1);
+        if (lRemainder > lMiddle || (lRemainder == lMiddle && (lHalf & 1)))
+            lHalf++;
+        return lSign | lHalf;
+    }
+
+    uint32_t lHalf = (lAbs - 0x38000000) >> 13;
+    uint32_t lRemainder = lAbs & 0x1FFF;
+    if (lRemainder > 0x1000 || (lRemainder == 0x1000 && (lHalf & 1)))
+        lHalf++;
+    return lSign | lHalf;
+}
+
+#ifdef IMAGE_HAS_F16C
+/*************/
+__attribute__((target("avx,f16c")))
+static void floatToHalfF16C(const float* source, uint16_t* destination, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm_storeu_si128((__m128i*)(destination + i), _mm256_cvtps_ph(_mm256_loadu_ps(source + i), _MM_FROUND_TO_NEAREST_INT));
+    for (; i < count; ++i)
+        destination[i] = floatToHalf(source[i]);
+}
+#endif
+
+/*************/
+void floatToHalf(const float* source, uint16_t* destination, size_t count)
+{
+#ifdef IMAGE_HAS_F16C
+    static const bool lHasF16C = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+#else
+    static const bool lHasF16C = false;
+#endif
+
+    Parallel::forRange(count, [&](size_t begin, size_t end) {
+#ifdef IMAGE_HAS_F16C
+        if (lHasF16C)
+        {
+            floatToHalfF16C(source + begin, destination + begin, end - begin);
+            return;
+        }
+#endif
+        for (size_t i = begin; i < end; ++i)
+            destination[i] = floatToHalf(source[i]);
+    }, 1 << 16);
+}
+
+/*************/
+bool isFormat(const string& name)
+{
+    return name == "auto" || name == "RGBA8" || name == "RGBA16" || name == "RGBA16F" || name == "RGBA32F";
+}
+
+/*************/
+cv::Mat read(const string& filename)
+{
+    cv::Mat lImage = cv::imread(filename, cv::IMREAD_UNCHANGED);
+    if (lImage.empty())
+        return lImage;
+
+    // Gray images with alpha are read as color, other depths as float
+    if (lImage.channels() == 2)
+        lImage = cv::imread(filename, cv::IMREAD_ANYDEPTH | cv::IMREAD_COLOR);
+    if (lImage.depth() != CV_8U && lImage.depth() != CV_16U && lImage.depth() != CV_32F)
+    {
+        cv::Mat lFloat;
+        lImage.convertTo(lFloat, CV_32F);
+        lImage = lFloat;
+    }
+    return lImage;
+}
+
+/*************/
+bool prepare(const cv::Mat& image, const string& format, Upload& upload)
+{
+    upload.name = format;
+    if (format == "auto")
+        upload.name = image.depth() == CV_8U ? "RGBA8" : image.depth() == CV_16U ? "RGBA16" : "RGBA16F";
+
+    int lChannels = image.channels();
+    bool lGray = lChannels == 1;
+    upload.format = lGray ? GL_RED : lChannels == 4 ? GL_BGRA : GL_BGR;
+
+    // Integer images are normalized, as they are when sampled
+    double lScale = image.depth() == CV_8U ? 1.0 / 255.0 : image.depth() == CV_16U ? 1.0 / 65535.0 : 1.0;
+    cv::Mat lFlipped;
+    cv::flip(image, lFlipped, 0);
+
+    auto convert = [&](int depth, double scale) {
+        if (lFlipped.depth() == depth)
+            upload.pixels = lFlipped;
+        else
+            lFlipped.convertTo(upload.pixels, depth, scale * lScale);
+    };
+
+    if (upload.name == "RGBA8")
+    {
+        upload.internalFormat = lGray ? GL_R8 : GL_RGBA8;
+        upload.type = GL_UNSIGNED_BYTE;
+        upload.bytesPerPixel = lGray ? 1 : 4;
+        convert(CV_8U, 255.0);
+    }
+    else if (upload.name == "RGBA16")
+    {
+        upload.internalFormat = lGray ? GL_R16 : GL_RGBA16;
+        upload.type = GL_UNSIGNED_SHORT;
+        upload.bytesPerPixel = lGray ? 2 : 8;
+        convert(CV_16U, 65535.0);
+    }
+    else if (upload.name == "RGBA32F")
+    {
+        upload.internalFormat = lGray ? GL_R32F : GL_RGBA32F;
+        upload.type = GL_FLOAT;
+        upload.bytesPerPixel = lGray ? 4 : 16;
+        convert(CV_32F, 1.0);
+    }
+    else if (upload.name == "RGBA16F")
+    {
+        upload.internalFormat = lGray ? GL_R16F : GL_RGBA16F;
+        upload.type = GL_HALF_FLOAT;
+        upload.bytesPerPixel = lGray ? 2 : 8;
+        convert(CV_32F, 1.0);
+        cv::Mat lHalf(upload.pixels.rows, upload.pixels.cols, CV_MAKETYPE(CV_16U, lChannels));
+        floatToHalf(upload.pixels.ptr<float>(), lHalf.ptr<uint16_t>(), upload.pixels.total() * lChannels);
+        upload.pixels = lHalf;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+} // end of namespace
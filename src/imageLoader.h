@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @imageLoader.h
+ * Reads images with their own depth and channel count, and chooses the
+ * texture format they are uploaded as
+ *
+ * 8 bit images are stored as RGBA8, 16 bit ones as RGBA16 and float ones
+ * (EXR, HDR) as RGBA16F, unless another format is asked for. Gray images
+ * keep a single channel, read as gray through a swizzle.
+ */
+
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <cstdint>
+#include <string>
+
+#include "GLFW/glfw3.h"
+#include "opencv2/opencv.hpp"
+
+namespace ImageLoader
+{
+
+/*************/
+struct Upload
+{
+    cv::Mat pixels; // Flipped and converted, ready for glTexImage2D
+    std::string name;
+    GLenum internalFormat {GL_RGBA8};
+    GLenum format {GL_BGR};
+    GLenum type {GL_UNSIGNED_BYTE};
+    int bytesPerPixel {4};
+};
+
+// Formats which can be asked for, auto keeping the precision of the image
+bool isFormat(const std::string& name);
+// Empty if the image could not be read
+cv::Mat read(const std::string& filename);
+bool prepare(const cv::Mat& image, const std::string& format, Upload& upload);
+// Uses F16C when the processor has it, on all cores
+void floatToHalf(const float* source, uint16_t* destination, size_t count);
+
+} // end of namespace
+
+#endif // IMAGELOADER_H
@@ -0,0 +1,70 @@
+#include "inputRecord.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+#define RECORD_VERSION 1
+
+/*************/
+bool InputRecord::load(const string& file)
+{
+    ifstream lFile(file, ios::in | ios::binary);
+    Header lHeader;
+    if (!lFile.is_open() || !lFile.read((char*)&lHeader, sizeof(lHeader)) || strncmp(lHeader.magic, "SOMR", 4) != 0)
+    {
+        cerr << "Unable to read input record " << file << endl;
+        return false;
+    }
+    if (lHeader.version != RECORD_VERSION)
+    {
+        cerr << "Input record " << file << " has an unsupported version: " << lHeader.version << endl;
+        return false;
+    }
+
+    // The frame count is not trusted further than what the file holds
+    streampos lStart = lFile.tellg();
+    lFile.seekg(0, ios::end);
+    uint64_t lAvailable = (uint64_t)(lFile.tellg() - lStart) / sizeof(RecordedFrame);
+    lFile.seekg(lStart);
+    if (lHeader.frames > lAvailable)
+        cerr << "Input record " << file << " is truncated, " << lAvailable << " frames out of " << lHeader.frames << endl;
+
+    mWidth = lHeader.width;
+    mHeight = lHeader.height;
+    mFrames.resize(min<uint64_t>(lHeader.frames, lAvailable));
+    if (!lFile.read((char*)mFrames.data(), mFrames.size() * sizeof(RecordedFrame)))
+    {
+        cerr << "Unable to read input record " << file << endl;
+        mFrames.clear();
+    }
+
+    cout << "Loaded " << mFrames.size() << " frames from " << file << endl;
+    return mFrames.size() > 0;
+}
+
+/*************/
+bool InputRecord::save(const string& file) const
+{
+    ofstream lFile(file, ios::out | ios::binary);
+    if (!lFile.is_open())
+    {
+        cerr << "Unable to write input record " << file << endl;
+        return false;
+    }
+
+    Header lHeader;
+    memcpy(lHeader.magic, "SOMR", 4);
+    lHeader.version = RECORD_VERSION;
+    lHeader.width = mWidth;
+    lHeader.height = mHeight;
+    lHeader.frames = mFrames.size();
+    lFile.write((const char*)&lHeader, sizeof(lHeader));
+    lFile.write((const char*)mFrames.data(), mFrames.size() * sizeof(RecordedFrame));
+
+    cout << "Recorded " << mFrames.size() << " frames to " << file << endl;
+    return true;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @inputRecord.h
+ * Per frame inputs and timer, saved to a binary file to be replayed
+ *
+ * The file starts with a header holding the resolution and the frame count,
+ * followed by the frames, each as four floats.
+ */
+
+#ifndef INPUTRECORD_H
+#define INPUTRECORD_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*************/
+struct RecordedFrame
+{
+    float timer {0.f};
+    float mouse[2] {0.f, 0.f};
+    float scroll {0.f};
+};
+
+/*************/
+class InputRecord
+{
+public:
+    void setResolution(int width, int height) {mWidth = width; mHeight = height;}
+    int getWidth() const {return mWidth;}
+    int getHeight() const {return mHeight;}
+
+    void add(const RecordedFrame& frame) {mFrames.push_back(frame);}
+    const std::vector<RecordedFrame>& getFrames() const {return mFrames;}
+
+    bool load(const std::string& file);
+    bool save(const std::string& file) const;
+
+private:
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        int32_t width;
+        int32_t height;
+        uint32_t frames;
+    };
+
+    int mWidth {0};
+    int mHeight {0};
+    std::vector<RecordedFrame> mFrames;
+};
+
+#endif // INPUTRECORD_H
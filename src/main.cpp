@@ -30,7 +30,34 @@ string gShadername {};
 string gResolution {};
 int gSwapInterval {1};
 int gCullFace {0};
+int gSubsteps {0};
+string gFBOFormat {};
+string gDepthFormat {};
+string gTextureFormat {};
+bool gFBOMipmaps {false};
+int gSamples {1};
+int gInstances {1};
+int gChunkSize {4096};
+int gGpuCulling {0};
+bool gBenchmark {false};
+int gBenchFrames {500};
+int gBenchWarmup {50};
+string gBenchOutput {"benchmark.json"};
+string gCompareShadername {};
+string gTraceFile {};
 bool gWireframe {false};
+bool gOnDemand {false};
+string gControlAddress {};
+string gRecordFile {};
+string gReplayFile {};
+string gReplayImages {};
+bool gHeadless {false};
+bool gUnthrottled {false};
+bool gFeedbackCache {false};
+bool gDepthPrepass {false};
+int gOverdraw {0};
+int gSpecialize {0};
+bool gVirtualTexture {false};
 
 /*************/
 void parseArgs(int argc, char** argv)
@@ -67,6 +94,134 @@ void parseArgs(int argc, char** argv)
             ++i;
             gCullFace = stoi(string(argv[i]));
         }
+        else if (string(argv[i]) == "--substeps" && i < argc - 1)
+        {
+            ++i;
+            gSubsteps = stoi(string(argv[i]));
+        }
+        else if (string(argv[i]) == "--fbo-format" && i < argc - 1)
+        {
+            ++i;
+            gFBOFormat = string(argv[i]);
+        }
+        else if (string(argv[i]) == "--texture-format" && i < argc - 1)
+        {
+            ++i;
+            gTextureFormat = string(argv[i]);
+        }
+        else if (string(argv[i]) == "--depth-format" && i < argc - 1)
+        {
+            ++i;
+            gDepthFormat = string(argv[i]);
+        }
+        else if (string(argv[i]) == "--fbo-mipmaps")
+        {
+            gFBOMipmaps = true;
+        }
+        else if (string(argv[i]) == "--msaa" && i < argc - 1)
+        {
+            ++i;
+            gSamples = stoi(string(argv[i]));
+        }
+        else if (string(argv[i]) == "--instances" && i < argc - 1)
+        {
+            ++i;
+            gInstances = stoi(string(argv[i]));
+        }
+        else if (string(argv[i]) == "--chunks" && i < argc - 1)
+        {
+            ++i;
+            gChunkSize = stoi(string(argv[i]));
+        }
+        else if (string(argv[i]) == "--gpu-cull" && i < argc - 1)
+        {
+            ++i;
+            gGpuCulling = stoi(string(argv[i]));
+        }
+        else if (string(argv[i]) == "--benchmark")
+        {
+            gBenchmark = true;
+        }
+        else if (string(argv[i]) == "--bench-frames" && i < argc - 1)
+        {
+            ++i;
+            gBenchFrames = stoi(string(argv[i]));
+        }
+        else if (string(argv[i]) == "--bench-warmup" && i < argc - 1)
+        {
+            ++i;
+            gBenchWarmup = stoi(string(argv[i]));
+        }
+        else if (string(argv[i]) == "--bench-output" && i < argc - 1)
+        {
+            ++i;
+            gBenchOutput = string(argv[i]);
+        }
+        else if (string(argv[i]) == "--compare" && i < argc - 1)
+        {
+            ++i;
+            gCompareShadername = string(argv[i]);
+            gBenchmark = true;
+        }
+        else if (string(argv[i]) == "--trace" && i < argc - 1)
+        {
+            ++i;
+            gTraceFile = string(argv[i]);
+        }
+        else if (string(argv[i]) == "--on-demand")
+        {
+            gOnDemand = true;
+        }
+        else if (string(argv[i]) == "--control" && i < argc - 1)
+        {
+            ++i;
+            gControlAddress = string(argv[i]);
+        }
+        else if (string(argv[i]) == "--record" && i < argc - 1)
+        {
+            ++i;
+            gRecordFile = string(argv[i]);
+        }
+        else if (string(argv[i]) == "--replay" && i < argc - 1)
+        {
+            ++i;
+            gReplayFile = string(argv[i]);
+        }
+        else if (string(argv[i]) == "--replay-images" && i < argc - 1)
+        {
+            ++i;
+            gReplayImages = string(argv[i]);
+        }
+        else if (string(argv[i]) == "--headless")
+        {
+            gHeadless = true;
+        }
+        else if (string(argv[i]) == "--unthrottled")
+        {
+            gUnthrottled = true;
+        }
+        else if (string(argv[i]) == "--feedback-cache")
+        {
+            gFeedbackCache = true;
+        }
+        else if (string(argv[i]) == "--depth-prepass")
+        {
+            gDepthPrepass = true;
+        }
+        else if (string(argv[i]) == "--overdraw" && i < argc - 1)
+        {
+            ++i;
+            gOverdraw = stoi(string(argv[i]));
+        }
+        else if (string(argv[i]) == "--specialize" && i < argc - 1)
+        {
+            ++i;
+            gSpecialize = stoi(string(argv[i]));
+        }
+        else if (string(argv[i]) == "--virtual-texture")
+        {
+            gVirtualTexture = true;
+        }
         else if (string(argv[i]) == "--wireframe" || string(argv[i]) == "-w")
         {
             gWireframe = true;
@@ -82,6 +237,33 @@ void parseArgs(int argc, char** argv)
             cout << "-r, --res       \t Specifies the startup resolution (defaults to 640x480)" << endl;
             cout << "--swap          \t Specifies the frame swap interval" << endl;
             cout << "--cull          \t Specifies culling mode: 0 for no culling, 1 for front, 2 for back" << endl;
+            cout << "--substeps      \t Specifies the number of simulation steps per frame (overrides the render graph)" << endl;
+            cout << "--fbo-format    \t Specifies the default format of the render targets: RGBA8, RGB10_A2, R11G11B10F, RGBA16F or RGBA32F" << endl;
+            cout << "--texture-format\t Specifies the format of the input image: auto (keeps its precision), RGBA8, RGBA16, RGBA16F or RGBA32F" << endl;
+            cout << "--depth-format  \t Specifies the default depth format: D24, D32F or none" << endl;
+            cout << "--fbo-mipmaps   \t Builds the mipmaps of every render target, not only of those sampled with explicit levels of detail" << endl;
+            cout << "--msaa          \t Specifies the number of samples for the object passes" << endl;
+            cout << "--instances     \t Specifies the number of instances of the object, doubled and halved with the up and down keys" << endl;
+            cout << "--chunks        \t Specifies the number of triangles per chunk of the object, culled when out of view (0 to disable, defaults to 4096)" << endl;
+            cout << "--gpu-cull      \t Culls the chunks on the GPU: 0 for none, 1 against the view, 2 also against the previous depth" << endl;
+            cout << "--benchmark     \t Runs a fixed number of frames without vsync, then prints and saves frame time statistics" << endl;
+            cout << "--bench-frames  \t Specifies the number of measured frames (defaults to 500)" << endl;
+            cout << "--bench-warmup  \t Specifies the number of frames run before measuring (defaults to 50)" << endl;
+            cout << "--bench-output  \t Specifies the JSON file for the results (defaults to benchmark.json)" << endl;
+            cout << "--compare       \t Benchmarks this shader after the first one, and compares them" << endl;
+            cout << "--trace         \t Records CPU and GPU spans, written to this file as a Chrome trace on T, SIGUSR1 and at exit" << endl;
+            cout << "--on-demand     \t Only redraws when an input used by the shaders changes, or when a file is modified" << endl;
+            cout << "--control       \t Receives uniform values as OSC or text, on this UDP port of localhost or Unix socket path" << endl;
+            cout << "--record        \t Records the inputs and timer of every frame to this file, written at exit" << endl;
+            cout << "--replay        \t Replays the inputs recorded in this file then exits, or feeds them to the benchmark" << endl;
+            cout << "--replay-images \t Saves every replayed frame as <prefix>_<frame>.png" << endl;
+            cout << "--headless      \t Renders in a hidden window" << endl;
+            cout << "--unthrottled   \t Replays as fast as possible instead of at the recorded times, without vsync" << endl;
+            cout << "--feedback-cache\t Captures the tessellation or geometry output, and draws it again until its inputs change" << endl;
+            cout << "--depth-prepass \t Draws the depth of the object passes first, then shades only the visible samples" << endl;
+            cout << "--overdraw      \t Shows the fragments drawn per pixel by the first object pass as a heatmap: 0 for none, 1 for fragments, 2 for quad invocations" << endl;
+            cout << "--specialize    \t Freezes the uniforms unchanged for this number of draws into constants, in variants of the programs compiled in the background (0 to disable)" << endl;
+            cout << "--virtual-texture \t Streams the tiles of the image on demand, for images too large for a single texture" << endl;
             cout << "-w, --wireframe \t Draw objects as wireframe" << endl;
             exit(0);
         }
@@ -116,6 +298,36 @@ int main(int argc, char** argv)
     }
     app.setSwapInterval(gSwapInterval);
     app.setCulling(gCullFace);
+    app.setSubsteps(gSubsteps);
+    if (gFBOFormat != "")
+        app.setFBOFormat(gFBOFormat);
+    if (gTextureFormat != "")
+        app.setTextureFormat(gTextureFormat);
+    if (gDepthFormat != "")
+        app.setDepthFormat(gDepthFormat);
+    app.setFBOMipmaps(gFBOMipmaps);
+    app.setSamples(gSamples);
+    app.setInstances(gInstances);
+    app.setChunkSize(gChunkSize);
+    app.setGpuCulling(gGpuCulling);
+    app.setTraceFile(gTraceFile);
+    app.setOnDemand(gOnDemand);
+    app.setControlAddress(gControlAddress);
+    app.setRecordFile(gRecordFile);
+    app.setReplayFile(gReplayFile);
+    app.setReplayImages(gReplayImages);
+    app.setHeadless(gHeadless);
+    app.setUnthrottled(gUnthrottled);
+    app.setFeedbackCaching(gFeedbackCache);
+    app.setDepthPrepass(gDepthPrepass);
+    app.setOverdraw(gOverdraw);
+    app.setSpecialization(gSpecialize);
+    app.setVirtualTexturing(gVirtualTexture);
+    if (gBenchmark)
+    {
+        app.setBenchmark(gBenchFrames, gBenchWarmup, gBenchOutput);
+        app.setCompareShaderFile(gCompareShadername);
+    }
 
     app.init();
 
@@ -0,0 +1,236 @@
+#include "meshBVH.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "parallel.h"
+
+using namespace std;
+
+// Subtrees above this depth are built on their own thread
+#define BVH_PARALLEL_DEPTH 3
+
+/*************/
+void MeshBVH::clear()
+{
+    mNodes.clear();
+    mChunkCount = 0;
+    mTriangleCount = 0;
+}
+
+/*************/
+void MeshBVH::build(vector<glm::vec4>& vertices, vector<glm::vec2>& uvs, int chunkSize)
+{
+    clear();
+    mTriangleCount = vertices.size() / 3;
+    if (mTriangleCount == 0 || chunkSize <= 0)
+        return;
+
+    // Bounds and centroids of every triangle
+    vector<glm::vec3> lCentroids(mTriangleCount);
+    vector<glm::vec3> lMins(mTriangleCount);
+    vector<glm::vec3> lMaxs(mTriangleCount);
+    Parallel::forRange(mTriangleCount, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            glm::vec3 lPoints[3];
+            for (int v = 0; v < 3; ++v)
+                lPoints[v] = glm::vec3(vertices[i * 3 + v].x, vertices[i * 3 + v].y, vertices[i * 3 + v].z);
+            lMins[i] = glm::min(lPoints[0], glm::min(lPoints[1], lPoints[2]));
+            lMaxs[i] = glm::max(lPoints[0], glm::max(lPoints[1], lPoints[2]));
+            lCentroids[i] = (lPoints[0] + lPoints[1] + lPoints[2]) / 3.f;
+        }
+    });
+
+    vector<int> lTriangles(mTriangleCount);
+    for (int i = 0; i < mTriangleCount; ++i)
+        lTriangles[i] = i;
+
+    BuildNode lRoot;
+    lRoot.first = 0;
+    lRoot.count = mTriangleCount;
+    buildNode(lRoot, lTriangles, lCentroids, lMins, lMaxs, chunkSize, 0);
+    flatten(lRoot);
+
+    // Triangles are stored in the order of the leaves
+    bool lHasUVs = uvs.size() == vertices.size();
+    vector<glm::vec4> lVertices(vertices.size());
+    vector<glm::vec2> lUVs(lHasUVs ? uvs.size() : 0);
+    Parallel::forRange(mTriangleCount, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            for (int v = 0; v < 3; ++v)
+            {
+                lVertices[i * 3 + v] = vertices[lTriangles[i] * 3 + v];
+                if (lHasUVs)
+                    lUVs[i * 3 + v] = uvs[lTriangles[i] * 3 + v];
+            }
+        }
+    });
+    vertices.swap(lVertices);
+    if (lHasUVs)
+        uvs.swap(lUVs);
+}
+
+/*************/
+void MeshBVH::buildNode(BuildNode& node, vector<int>& triangles, const vector<glm::vec3>& centroids,
+                        const vector<glm::vec3>& mins, const vector<glm::vec3>& maxs, int chunkSize, int depth)
+{
+    auto lBegin = triangles.begin() + node.first;
+    auto lEnd = lBegin + node.count;
+
+    node.min = mins[*lBegin];
+    node.max = maxs[*lBegin];
+    glm::vec3 lCentroidMin = centroids[*lBegin];
+    glm::vec3 lCentroidMax = centroids[*lBegin];
+    for (auto it = lBegin; it != lEnd; ++it)
+    {
+        node.min = glm::min(node.min, mins[*it]);
+        node.max = glm::max(node.max, maxs[*it]);
+        lCentroidMin = glm::min(lCentroidMin, centroids[*it]);
+        lCentroidMax = glm::max(lCentroidMax, centroids[*it]);
+    }
+
+    if (node.count <= chunkSize)
+        return;
+
+    // Median split along the largest extent of the centroids
+    glm::vec3 lExtent = lCentroidMax - lCentroidMin;
+    int lAxis = 0;
+    if (lExtent[1] > lExtent[lAxis])
+        lAxis = 1;
+    if (lExtent[2] > lExtent[lAxis])
+        lAxis = 2;
+
+    int lHalf = node.count / 2;
+    nth_element(lBegin, lBegin + lHalf, lEnd, [&](int a, int b) {
+        return centroids[a][lAxis] < centroids[b][lAxis];
+    });
+
+    for (int i = 0; i < 2; ++i)
+    {
+        node.children[i].reset(new BuildNode());
+        node.children[i]->first = i == 0 ? node.first : node.first + lHalf;
+        node.children[i]->count = i == 0 ? lHalf : node.count - lHalf;
+    }
+
+    // Both halves work on separate parts of the triangle list
+    if (depth < BVH_PARALLEL_DEPTH)
+    {
+        thread lWorker([&]() {
+            buildNode(*node.children[1], triangles, centroids, mins, maxs, chunkSize, depth + 1);
+        });
+        buildNode(*node.children[0], triangles, centroids, mins, maxs, chunkSize, depth + 1);
+        lWorker.join();
+    }
+    else
+    {
+        buildNode(*node.children[0], triangles, centroids, mins, maxs, chunkSize, depth + 1);
+        buildNode(*node.children[1], triangles, centroids, mins, maxs, chunkSize, depth + 1);
+    }
+}
+
+/*************/
+void MeshBVH::flatten(const BuildNode& node)
+{
+    int lIndex = mNodes.size();
+    mNodes.push_back(Node());
+    mNodes[lIndex].min = node.min;
+    mNodes[lIndex].max = node.max;
+    mNodes[lIndex].first = node.first;
+    mNodes[lIndex].count = node.count;
+    mNodes[lIndex].leaf = !node.children[0];
+
+    if (mNodes[lIndex].leaf)
+        mChunkCount++;
+    else
+    {
+        flatten(*node.children[0]);
+        flatten(*node.children[1]);
+    }
+    mNodes[lIndex].skip = mNodes.size();
+}
+
+/*************/
+vector<MeshBVH::Chunk> MeshBVH::getChunks() const
+{
+    vector<Chunk> lChunks;
+    for (auto& node : mNodes)
+    {
+        if (!node.leaf)
+            continue;
+        Chunk lChunk;
+        lChunk.min = node.min;
+        lChunk.max = node.max;
+        lChunk.first = node.first * 3;
+        lChunk.count = node.count * 3;
+        lChunks.push_back(lChunk);
+    }
+    return lChunks;
+}
+
+/*************/
+int MeshBVH::cull(const glm::mat4& mvp, vector<GLint>& first, vector<GLsizei>& count) const
+{
+    first.clear();
+    count.clear();
+
+    // Planes of the view volume, from the rows of the matrix
+    glm::vec4 lPlanes[6];
+    for (int i = 0; i < 3; ++i)
+    {
+        glm::vec4 lRow(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+        glm::vec4 lLast(mvp[0][3], mvp[1][3], mvp[2][3], mvp[3][3]);
+        lPlanes[i * 2] = lLast + lRow;
+        lPlanes[i * 2 + 1] = lLast - lRow;
+    }
+
+    int lVertices = 0;
+    auto addRange = [&](int firstTriangle, int triangles) {
+        if (first.size() != 0 && first.back() + count.back() == firstTriangle * 3)
+            count.back() += triangles * 3;
+        else
+        {
+            first.push_back(firstTriangle * 3);
+            count.push_back(triangles * 3);
+        }
+        lVertices += triangles * 3;
+    };
+
+    // Nodes are in depth first order: children follow their parent, skip jumps over the subtree
+    int i = 0;
+    while (i < mNodes.size())
+    {
+        const Node& lNode = mNodes[i];
+        bool lOutside = false;
+        bool lInside = true;
+        for (auto& plane : lPlanes)
+        {
+            glm::vec3 lFar, lNear;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                lFar[axis] = plane[axis] >= 0.f ? lNode.max[axis] : lNode.min[axis];
+                lNear[axis] = plane[axis] >= 0.f ? lNode.min[axis] : lNode.max[axis];
+            }
+            if (plane[0] * lFar[0] + plane[1] * lFar[1] + plane[2] * lFar[2] + plane[3] < 0.f)
+            {
+                lOutside = true;
+                break;
+            }
+            if (plane[0] * lNear[0] + plane[1] * lNear[1] + plane[2] * lNear[2] + plane[3] < 0.f)
+                lInside = false;
+        }
+
+        if (lOutside)
+            i = lNode.skip;
+        else if (lInside || lNode.leaf)
+        {
+            addRange(lNode.first, lNode.count);
+            i = lNode.skip;
+        }
+        else
+            i++;
+    }
+
+    return lVertices;
+}
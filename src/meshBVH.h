@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @meshBVH.h
+ * Splits a triangle soup into spatially coherent chunks, held in a bounding
+ * volume hierarchy, so that the chunks out of view can be skipped
+ */
+
+#ifndef MESHBVH_H
+#define MESHBVH_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <memory>
+#include <vector>
+
+#include "GLFW/glfw3.h"
+#include "glm/glm.hpp"
+
+/*************/
+class MeshBVH
+{
+public:
+    struct Chunk
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+        int first; // First vertex
+        int count; // Vertex count
+    };
+
+    // Reorders the triangles so that each chunk is a contiguous range of vertices.
+    // Texture coordinates, if given for every vertex, follow the same order
+    void build(std::vector<glm::vec4>& vertices, std::vector<glm::vec2>& uvs, int chunkSize);
+    void clear();
+
+    // Fills the vertex ranges of the chunks intersecting the view volume of mvp,
+    // merging neighbouring ones. Returns the number of vertices to draw
+    int cull(const glm::mat4& mvp, std::vector<GLint>& first, std::vector<GLsizei>& count) const;
+
+    // Leaves of the hierarchy, in vertex order
+    std::vector<Chunk> getChunks() const;
+    int getChunkCount() const {return mChunkCount;}
+    int getTriangleCount() const {return mTriangleCount;}
+
+private:
+    struct Node
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+        int skip {0}; // Index of the next node once this subtree is done, children follow it directly
+        int first {0}; // First triangle, for leaves
+        int count {0};
+        bool leaf {false};
+    };
+
+    struct BuildNode
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+        int first {0};
+        int count {0};
+        std::unique_ptr<BuildNode> children[2];
+    };
+
+    std::vector<Node> mNodes;
+    int mChunkCount {0};
+    int mTriangleCount {0};
+
+    void buildNode(BuildNode& node, std::vector<int>& triangles, const std::vector<glm::vec3>& centroids,
+                   const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs, int chunkSize, int depth);
+    void flatten(const BuildNode& node);
+};
+
+#endif // MESHBVH_H
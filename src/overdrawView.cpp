@@ -0,0 +1,356 @@
+#include "overdrawView.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "glState.h"
+
+using namespace std;
+
+// Binding of the statistics, after those of the user shaders, the culling and the virtual texture
+#define OVERDRAW_STATS_BINDING 9
+#define OVERDRAW_GROUP_SIZE 16
+#define OVERDRAW_READBACK_COUNT 3
+
+// Live invocations of the quad are summed from the differences with the neighbours,
+// and each live fragment takes its share of the four invocations run
+char gOverdrawCountShader[] =
+    "#version 450 core\n"
+    "\n"
+    "layout(location = 0) out vec4 fragCount;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    float live = gl_HelperInvocation ? 0.0 : 1.0;\n"
+    "    vec2 side = mix(vec2(1.0), vec2(-1.0), step(0.5, fract(gl_FragCoord.xy * 0.5)));\n"
+    "    float row = 2.0 * live + side.x * dFdxFine(live);\n"
+    "    float quad = 2.0 * row + side.y * dFdyFine(row);\n"
+    "    fragCount = vec4(1.0, 4.0 / max(quad, 1.0), 0.0, 0.0);\n"
+    "}\n";
+
+// Without gl_HelperInvocation, only the fragments are counted
+char gOverdrawFragmentShader[] =
+    "#version 150 core\n"
+    "\n"
+    "out vec4 fragCount;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    fragCount = vec4(1.0, 0.0, 0.0, 0.0);\n"
+    "}\n";
+
+char gHeatmapVertShader[] =
+    "#version 150 core\n"
+    "\n"
+    "in vec4 vVertex;\n"
+    "in vec2 vTexCoord;\n"
+    "\n"
+    "out vec2 texCoord;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    gl_Position = vVertex;\n"
+    "    texCoord = vTexCoord;\n"
+    "}\n";
+
+char gHeatmapFragShader[] =
+    "#version 150 core\n"
+    "\n"
+    "uniform sampler2D vCounts;\n"
+    "uniform sampler2D vHUDMap;\n"
+    "uniform bool vInvocations;\n"
+    "uniform float vScale;\n"
+    "uniform float vHUDScale;\n"
+    "\n"
+    "in vec2 texCoord;\n"
+    "\n"
+    "out vec4 fragColor;\n"
+    "\n"
+    "// From blue for a single fragment to red for the maximum, on a log scale\n"
+    "vec3 heat(float t)\n"
+    "{\n"
+    "    vec3 colors[5] = vec3[](vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 1.0), vec3(0.0, 1.0, 0.0), vec3(1.0, 1.0, 0.0), vec3(1.0, 0.0, 0.0));\n"
+    "    float x = clamp(t, 0.0, 1.0) * 4.0;\n"
+    "    int i = min(int(x), 3);\n"
+    "    return mix(colors[i], colors[i + 1], x - float(i));\n"
+    "}\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    vec2 counts = texture(vCounts, texCoord).rg;\n"
+    "    float count = vInvocations ? counts.g : counts.r;\n"
+    "    fragColor = vec4(0.0, 0.0, 0.0, 1.0);\n"
+    "    if (count > 0.0)\n"
+    "        fragColor.rgb = heat(log2(max(count, 1.0)) / log2(max(vScale, 2.0)));\n"
+    "    fragColor += texture(vHUDMap, vec2(texCoord.s, texCoord.t * vHUDScale));\n"
+    "}\n";
+
+// Sums and maximums of the counts, per group of 16x16 pixels
+char gOverdrawReduceShader[] =
+    "#version 430 core\n"
+    "\n"
+    "layout(local_size_x = 16, local_size_y = 16) in;\n"
+    "\n"
+    "layout(std430, binding = 9) writeonly buffer Stats {vec4 stats[];};\n"
+    "uniform sampler2D vCounts;\n"
+    "\n"
+    "shared vec4 sums[256];\n"
+    "shared vec4 maxs[256];\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);\n"
+    "    vec2 counts = vec2(0.0);\n"
+    "    if (all(lessThan(pixel, textureSize(vCounts, 0))))\n"
+    "        counts = texelFetch(vCounts, pixel, 0).rg;\n"
+    "\n"
+    "    uint index = gl_LocalInvocationIndex;\n"
+    "    sums[index] = vec4(counts, counts.r > 0.0 ? 1.0 : 0.0, 0.0);\n"
+    "    maxs[index] = vec4(counts, 0.0, 0.0);\n"
+    "    memoryBarrierShared();\n"
+    "    barrier();\n"
+    "    for (uint stride = 128u; stride > 0u; stride >>= 1)\n"
+    "    {\n"
+    "        if (index < stride)\n"
+    "        {\n"
+    "            sums[index] += sums[index + stride];\n"
+    "            maxs[index] = max(maxs[index], maxs[index + stride]);\n"
+    "        }\n"
+    "        memoryBarrierShared();\n"
+    "        barrier();\n"
+    "    }\n"
+    "\n"
+    "    if (index == 0u)\n"
+    "    {\n"
+    "        uint group = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;\n"
+    "        stats[group * 2u] = sums[0];\n"
+    "        stats[group * 2u + 1u] = maxs[0];\n"
+    "    }\n"
+    "}\n";
+
+/*************/
+OverdrawView::~OverdrawView()
+{
+    release();
+}
+
+/*************/
+void OverdrawView::release()
+{
+    mCountShader.reset();
+    mHeatmapProgram.reset();
+    mReduceProgram.reset();
+    mTexture.reset();
+    mFramebuffer.reset();
+    mWidth = 0;
+    mHeight = 0;
+    for (auto& readback : mReadbacks)
+        if (readback.fence)
+            glDeleteSync(readback.fence);
+    mReadbacks.clear();
+    for (auto& stat : mStats)
+        stat = 0.f;
+}
+
+/*************/
+bool OverdrawView::init()
+{
+    // Helper invocations can only be told apart from GLSL 4.50 on
+    GLint lMajor = 0, lMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &lMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &lMinor);
+    mInvocations = lMajor * 10 + lMinor >= 45 && compileShader(gOverdrawCountShader, GL_FRAGMENT_SHADER, "overdraw count", mCountShader);
+    if (!mInvocations && !compileShader(gOverdrawFragmentShader, GL_FRAGMENT_SHADER, "overdraw count", mCountShader))
+        return false;
+
+    GLShader lVertex, lFragment, lReduce;
+    if (!compileShader(gHeatmapVertShader, GL_VERTEX_SHADER, "heatmap", lVertex)
+        || !compileShader(gHeatmapFragShader, GL_FRAGMENT_SHADER, "heatmap", lFragment)
+        || !compileShader(gOverdrawReduceShader, GL_COMPUTE_SHADER, "overdraw statistics", lReduce))
+        return false;
+
+    if (!linkProgram({lReduce.get()}, "overdraw statistics", mReduceProgram) || !linkProgram({lVertex.get(), lFragment.get()}, "heatmap", mHeatmapProgram))
+        return false;
+
+    glProgramUniform1i(mReduceProgram, glGetUniformLocation(mReduceProgram, "vCounts"), GL_STATE_EDIT_UNIT);
+    glProgramUniform1i(mHeatmapProgram, glGetUniformLocation(mHeatmapProgram, "vCounts"), GL_STATE_EDIT_UNIT);
+    glProgramUniform1i(mHeatmapProgram, glGetUniformLocation(mHeatmapProgram, "vHUDMap"), 1);
+
+    cout << "Overdraw view: counting fragments" << (mInvocations ? " and quad invocations." : " only, quad invocations need GLSL 4.50.") << endl;
+    return true;
+}
+
+/*************/
+bool OverdrawView::compileShader(const char* source, GLenum type, const char* name, GLShader& shader)
+{
+    shader.create(name, type);
+    glShaderSource(shader, 1, (const GLchar**)&source, 0);
+    glCompileShader(shader);
+
+    GLint lStatus;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &lStatus);
+    if (!lStatus)
+    {
+        GLchar lLog[1024];
+        glGetShaderInfoLog(shader, sizeof(lLog), nullptr, lLog);
+        cerr << "Overdraw view: failed to compile the " << name << " shader." << endl << lLog << endl;
+        shader.reset();
+        return false;
+    }
+    return true;
+}
+
+/*************/
+bool OverdrawView::linkProgram(const vector<GLuint>& shaders, const char* name, GLProgram& program)
+{
+    // Shaders are only deleted once detached, with the program
+    program.create(name);
+    for (auto shader : shaders)
+        glAttachShader(program, shader);
+    glBindAttribLocation(program, 0, "vVertex");
+    glBindAttribLocation(program, 1, "vTexCoord");
+    glLinkProgram(program);
+
+    GLint lStatus;
+    glGetProgramiv(program, GL_LINK_STATUS, &lStatus);
+    if (!lStatus)
+    {
+        cerr << "Overdraw view: failed to link the " << name << " program." << endl;
+        program.reset();
+        return false;
+    }
+    return true;
+}
+
+/*************/
+void OverdrawView::begin(int width, int height)
+{
+    if (!isReady())
+        return;
+
+    // The target follows the size of the pass, the statistics too
+    if (width != mWidth || height != mHeight || mTexture == 0)
+    {
+        mWidth = width;
+        mHeight = height;
+
+        mTexture.create("overdraw counts");
+        GLState::editTexture(GL_TEXTURE_2D, mTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32F, mWidth, mHeight);
+        mTexture.setSize(GLRegistry::getTextureBytes(GL_RG32F, mWidth, mHeight));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        mFramebuffer.create("overdraw counts");
+        GLState::bindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cerr << "Overdraw view: error while preparing the FBO." << endl;
+
+        int lGroups = ((mWidth + OVERDRAW_GROUP_SIZE - 1) / OVERDRAW_GROUP_SIZE) * ((mHeight + OVERDRAW_GROUP_SIZE - 1) / OVERDRAW_GROUP_SIZE);
+        for (auto& readback : mReadbacks)
+            if (readback.fence)
+                glDeleteSync(readback.fence);
+        mReadbacks.clear();
+        mReadbacks.resize(OVERDRAW_READBACK_COUNT);
+        for (auto& readback : mReadbacks)
+        {
+            readback.buffer.create("overdraw statistics");
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, readback.buffer);
+            glBufferStorage(GL_SHADER_STORAGE_BUFFER, lGroups * 8 * sizeof(GLfloat), nullptr, 0);
+            readback.buffer.setSize(lGroups * 8 * sizeof(GLfloat));
+            readback.groups = lGroups;
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    GLState::bindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+    GLenum lAttachment = GL_COLOR_ATTACHMENT0;
+    GLState::drawBuffers(1, &lAttachment);
+    GLState::viewport(0, 0, mWidth, mHeight);
+    GLfloat lZeros[4] {0.f, 0.f, 0.f, 0.f};
+    glClearBufferfv(GL_COLOR, 0, lZeros);
+
+    // Every fragment rasterized is counted, hidden or not
+    GLState::disable(GL_DEPTH_TEST);
+    GLState::enable(GL_BLEND);
+    GLState::blendFunc(GL_ONE, GL_ONE);
+}
+
+/*************/
+void OverdrawView::end()
+{
+    if (!isReady())
+        return;
+
+    GLState::disable(GL_BLEND);
+
+    // Statistics not read back by now are dropped, rather than waited for
+    Readback& lReadback = mReadbacks[mCurrentReadback];
+    mCurrentReadback = (mCurrentReadback + 1) % mReadbacks.size();
+    if (lReadback.fence)
+        glDeleteSync(lReadback.fence);
+
+    GLState::useProgram(mReduceProgram);
+    GLState::bindTexture(GL_STATE_EDIT_UNIT, GL_TEXTURE_2D, mTexture);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OVERDRAW_STATS_BINDING, lReadback.buffer);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    GLState::dispatchCompute((mWidth + OVERDRAW_GROUP_SIZE - 1) / OVERDRAW_GROUP_SIZE, (mHeight + OVERDRAW_GROUP_SIZE - 1) / OVERDRAW_GROUP_SIZE, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    lReadback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/*************/
+void OverdrawView::draw(GLuint screenVertexArray, bool invocations, float windowHeight)
+{
+    if (!isReady() || mTexture == 0)
+        return;
+
+    GLState::useProgram(mHeatmapProgram);
+    glUniform1i(glGetUniformLocation(mHeatmapProgram, "vInvocations"), invocations && mInvocations);
+    glUniform1f(glGetUniformLocation(mHeatmapProgram, "vScale"), invocations && mInvocations ? getMaxInvocations() : getMax());
+    glUniform1f(glGetUniformLocation(mHeatmapProgram, "vHUDScale"), windowHeight / 32.f);
+    GLState::bindTexture(GL_STATE_EDIT_UNIT, GL_TEXTURE_2D, mTexture);
+    GLState::bindVertexArray(screenVertexArray);
+    GLState::drawArrays(GL_TRIANGLES, 0, 6);
+}
+
+/*************/
+void OverdrawView::collect()
+{
+    // From the oldest to the newest, so that the latest results available are kept
+    for (int i = 0; i < mReadbacks.size(); ++i)
+    {
+        Readback& lReadback = mReadbacks[(mCurrentReadback + i) % mReadbacks.size()];
+        if (!lReadback.fence)
+            continue;
+
+        GLenum lStatus = glClientWaitSync(lReadback.fence, 0, 0);
+        if (lStatus != GL_ALREADY_SIGNALED && lStatus != GL_CONDITION_SATISFIED)
+            continue;
+
+        glDeleteSync(lReadback.fence);
+        lReadback.fence = 0;
+        mGroupStats.resize(lReadback.groups * 8);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, lReadback.buffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, mGroupStats.size() * sizeof(GLfloat), mGroupStats.data());
+
+        // Averages are over the pixels covered at least once
+        double lFragments = 0.0, lInvocations = 0.0, lCovered = 0.0;
+        float lMaxFragments = 0.f, lMaxInvocations = 0.f;
+        for (int g = 0; g < lReadback.groups; ++g)
+        {
+            const GLfloat* lGroup = &mGroupStats[g * 8];
+            lFragments += lGroup[0];
+            lInvocations += lGroup[1];
+            lCovered += lGroup[2];
+            lMaxFragments = max(lMaxFragments, lGroup[4]);
+            lMaxInvocations = max(lMaxInvocations, lGroup[5]);
+        }
+        mStats[0] = lCovered > 0.0 ? lFragments / lCovered : 0.f;
+        mStats[1] = lMaxFragments;
+        mStats[2] = lCovered > 0.0 ? lInvocations / lCovered : 0.f;
+        mStats[3] = lMaxInvocations;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
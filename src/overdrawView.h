@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @overdrawView.h
+ * Counts the fragments drawn over each pixel by an object pass, and shows
+ * them as a heatmap
+ *
+ * The object is drawn again with additive blending into a float target,
+ * every fragment rasterized adding one. With GLSL 4.50, the invocations
+ * of the 2x2 quads are counted too, helper invocations included, which is
+ * what the fragment shader actually costs. Average and maximum counts are
+ * reduced on the GPU, and read back a few frames later.
+ */
+
+#ifndef OVERDRAWVIEW_H
+#define OVERDRAWVIEW_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <vector>
+
+#include "GLFW/glfw3.h"
+
+#include "glObject.h"
+
+/*************/
+class OverdrawView
+{
+public:
+    ~OverdrawView();
+    void release();
+
+    bool init();
+    bool isReady() const {return mHeatmapProgram != 0;}
+    bool countsInvocations() const {return mInvocations;}
+
+    // Fragment shader writing the counts, linked with the other stages of a pass
+    GLuint getCountShader() const {return mCountShader;}
+
+    // Counts are accumulated between begin and end, in a target of the given size
+    void begin(int width, int height);
+    void end();
+    // Draws the fragment or invocation counts to the current framebuffer, along with the HUD
+    void draw(GLuint screenVertexArray, bool invocations, float windowHeight);
+    // Reads back the statistics which are available, without waiting
+    void collect();
+
+    float getAverage() const {return mStats[0];}
+    float getMax() const {return mStats[1];}
+    float getAverageInvocations() const {return mStats[2];}
+    float getMaxInvocations() const {return mStats[3];}
+
+private:
+    struct Readback
+    {
+        GLBuffer buffer;
+        GLsync fence {0};
+        int groups {0};
+    };
+
+    bool mInvocations {false};
+    GLShader mCountShader;
+    GLProgram mHeatmapProgram;
+    GLProgram mReduceProgram;
+
+    GLTexture mTexture;
+    GLFramebuffer mFramebuffer;
+    int mWidth {0};
+    int mHeight {0};
+
+    std::vector<Readback> mReadbacks;
+    int mCurrentReadback {0};
+    std::vector<GLfloat> mGroupStats;
+    float mStats[4] {0.f, 0.f, 0.f, 0.f};
+
+    bool compileShader(const char* source, GLenum type, const char* name, GLShader& shader);
+    bool linkProgram(const std::vector<GLuint>& shaders, const char* name, GLProgram& program);
+};
+
+#endif // OVERDRAWVIEW_H
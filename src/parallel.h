@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @parallel.h
+ * Splits a range of work between the available cores
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace Parallel
+{
+
+/*************/
+// Calls func(begin, end) on contiguous slices of [0, count), one per thread,
+// and returns once all of them are done. Small ranges stay on the calling thread.
+inline void forRange(size_t count, const std::function<void(size_t, size_t)>& func, size_t minSlice = 1024)
+{
+    size_t lThreads = std::max(1u, std::thread::hardware_concurrency());
+    lThreads = std::min(lThreads, std::max((size_t)1, count / std::max((size_t)1, minSlice)));
+
+    if (lThreads <= 1)
+    {
+        func(0, count);
+        return;
+    }
+
+    std::vector<std::thread> lWorkers;
+    size_t lSlice = (count + lThreads - 1) / lThreads;
+    for (size_t begin = lSlice; begin < count; begin += lSlice)
+        lWorkers.push_back(std::thread(func, begin, std::min(count, begin + lSlice)));
+    func(0, std::min(count, lSlice));
+
+    for (auto& worker : lWorkers)
+        worker.join();
+}
+
+} // end of namespace
+
+#endif // PARALLEL_H
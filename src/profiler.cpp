@@ -0,0 +1,169 @@
+#include "profiler.h"
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "boost/chrono/chrono.hpp"
+
+#include "benchmark.h"
+
+using namespace std;
+using namespace boost::chrono;
+
+namespace
+{
+    const int gRingSize = 1 << 16;
+    const int gGpuThread = 1000;
+
+    struct Event
+    {
+        char name[32];
+        uint64_t start;
+        uint64_t end;
+    };
+
+    struct Ring
+    {
+        int id;
+        char name[32];
+        vector<Event> events;
+        atomic<uint64_t> head {0};
+        atomic<bool> writing {false}; // Set around each push, waited for by the dump
+    };
+
+    mutex gRingsMutex;
+    vector<Ring*> gRings;
+    atomic<int> gNextThread {1};
+    thread_local Ring* gThreadRing {nullptr};
+    Ring* gGpuRing {nullptr};
+
+    steady_clock::time_point gOrigin = steady_clock::now();
+
+    /*************/
+    Ring* createRing(int id, const char* name)
+    {
+        Ring* lRing = new Ring();
+        lRing->id = id;
+        strncpy(lRing->name, name, sizeof(lRing->name) - 1);
+        lRing->name[sizeof(lRing->name) - 1] = 0;
+        lRing->events.resize(gRingSize);
+
+        lock_guard<mutex> lLock(gRingsMutex);
+        gRings.push_back(lRing);
+        return lRing;
+    }
+
+    /*************/
+    void push(Ring* ring, const char* name, uint64_t start, uint64_t end)
+    {
+        uint64_t lHead = ring->head.load(memory_order_relaxed);
+        Event& lEvent = ring->events[lHead % gRingSize];
+        strncpy(lEvent.name, name, sizeof(lEvent.name) - 1);
+        lEvent.name[sizeof(lEvent.name) - 1] = 0;
+        lEvent.start = start;
+        lEvent.end = end;
+        ring->head.store(lHead + 1, memory_order_release);
+    }
+}
+
+atomic<bool> Profiler::mEnabled {false};
+atomic<int64_t> Profiler::mGpuOffset {0};
+
+/*************/
+void Profiler::setThreadName(const char* name)
+{
+    if (gThreadRing == nullptr)
+        gThreadRing = createRing(gNextThread++, name);
+}
+
+/*************/
+uint64_t Profiler::now()
+{
+    return duration_cast<nanoseconds>(steady_clock::now() - gOrigin).count();
+}
+
+/*************/
+void Profiler::addSpan(const char* name, uint64_t start, uint64_t end)
+{
+    if (!mEnabled)
+        return;
+    if (gThreadRing == nullptr)
+        setThreadName("thread");
+
+    // Checked again once marked as writing, the dump disables the profiler before waiting for the rings
+    gThreadRing->writing.store(true);
+    if (mEnabled)
+        push(gThreadRing, name, start, end);
+    gThreadRing->writing.store(false, memory_order_release);
+}
+
+/*************/
+void Profiler::addGpuSpan(const char* name, GLuint64 start, GLuint64 end)
+{
+    if (!mEnabled)
+        return;
+    if (gGpuRing == nullptr)
+        gGpuRing = createRing(gGpuThread, "GPU");
+    int64_t lOffset = mGpuOffset;
+
+    gGpuRing->writing.store(true);
+    if (mEnabled)
+        push(gGpuRing, name, (uint64_t)((int64_t)start + lOffset), (uint64_t)((int64_t)end + lOffset));
+    gGpuRing->writing.store(false, memory_order_release);
+}
+
+/*************/
+void Profiler::calibrate()
+{
+    GLint64 lGpuTime;
+    glGetInteger64v(GL_TIMESTAMP, &lGpuTime);
+    mGpuOffset = (int64_t)now() - (int64_t)lGpuTime;
+}
+
+/*************/
+bool Profiler::dump(const string& filename)
+{
+    ofstream lFile(filename, ios::out);
+    if (!lFile.is_open())
+    {
+        cerr << "Unable to write the trace to " << filename << endl;
+        return false;
+    }
+
+    lock_guard<mutex> lLock(gRingsMutex);
+
+    // No span is recorded while the rings are read, so the events are not overwritten under us
+    bool lEnabled = mEnabled.exchange(false);
+    for (auto ring : gRings)
+        while (ring->writing.load(memory_order_acquire))
+            this_thread::yield();
+
+    // Microseconds with a nanosecond resolution, whatever the time since the start
+    lFile << fixed << setprecision(3);
+    lFile << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << endl;
+    bool lFirst = true;
+    for (auto ring : gRings)
+    {
+        lFile << (lFirst ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << ring->id
+              << ", \"args\": {\"name\": \"" << Benchmark::escapeJson(ring->name) << "\"}}";
+        lFirst = false;
+
+        uint64_t lHead = ring->head.load(memory_order_acquire);
+        uint64_t lFirstEvent = lHead > gRingSize ? lHead - gRingSize : 0;
+        for (uint64_t i = lFirstEvent; i < lHead; ++i)
+        {
+            const Event& lEvent = ring->events[i % gRingSize];
+            lFile << ",\n{\"name\": \"" << Benchmark::escapeJson(lEvent.name) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << ring->id
+                  << ", \"ts\": " << lEvent.start / 1000.0 << ", \"dur\": " << (lEvent.end - lEvent.start) / 1000.0 << "}";
+        }
+    }
+    lFile << endl << "]}" << endl;
+    mEnabled = lEnabled;
+
+    cout << "Trace written to " << filename << endl;
+    return true;
+}
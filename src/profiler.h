@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @profiler.h
+ * CPU and GPU spans, exported as a Chrome trace (chrome://tracing, Perfetto)
+ *
+ * Each thread writes to its own preallocated ring, so recording a span
+ * never allocates. GPU spans come from timestamp queries, converted to
+ * the CPU clock.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "GLFW/glfw3.h"
+
+/*************/
+class Profiler
+{
+public:
+    static void setEnabled(bool enabled) {mEnabled = enabled;}
+    static bool isEnabled() {return mEnabled;}
+
+    // Names the calling thread in the trace, and allocates its ring
+    static void setThreadName(const char* name);
+
+    // Current time in ns, on the clock used for all spans
+    static uint64_t now();
+    static void addSpan(const char* name, uint64_t start, uint64_t end);
+    static void addGpuSpan(const char* name, GLuint64 start, GLuint64 end);
+
+    // Matches the GPU clock with the CPU one, needs a current GL context
+    static void calibrate();
+
+    static bool dump(const std::string& filename);
+
+private:
+    static std::atomic<bool> mEnabled;
+    static std::atomic<int64_t> mGpuOffset;
+};
+
+/*************/
+class ProfileScope
+{
+public:
+    ProfileScope(const char* name) : mName(name)
+    {
+        if (Profiler::isEnabled())
+            mStart = Profiler::now();
+    }
+
+    ~ProfileScope()
+    {
+        stop();
+    }
+
+    // Ends the span before the end of the scope
+    void stop()
+    {
+        if (Profiler::isEnabled() && mStart)
+            Profiler::addSpan(mName, mStart, Profiler::now());
+        mStart = 0;
+    }
+
+private:
+    const char* mName;
+    uint64_t mStart {0};
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,1234 @@
+#include "renderGraph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include "boost/filesystem.hpp"
+
+#include "glState.h"
+
+using namespace std;
+
+// Units left to the resources of the manifest, the others being used for culling
+#define MAX_BUFFER_BINDINGS 5
+#define MAX_IMAGE_UNITS 6
+
+/*************/
+static const TextureFormat gTextureFormats[] = {
+    {"RGBA8", GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4},
+    {"RGB10_A2", GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, 4},
+    {"R11G11B10F", GL_R11F_G11F_B10F, GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV, 4},
+    {"RGBA16F", GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8},
+    {"RGBA32F", GL_RGBA32F, GL_RGBA, GL_FLOAT, 16},
+    {"D24", GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 4},
+    {"D32F", GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, 4}
+};
+
+/*************/
+RenderGraph::~RenderGraph()
+{
+    release();
+}
+
+/*************/
+bool RenderGraph::getFormat(const string& name, TextureFormat& format)
+{
+    for (auto& f : gTextureFormats)
+    {
+        if (f.name == name)
+        {
+            format = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*************/
+vector<string> RenderGraph::listShaders(const string& filename)
+{
+    vector<string> lShaders;
+    ifstream lFile(filename, ios::in);
+    if (!lFile.is_open())
+        return lShaders;
+
+    string lDirectory = boost::filesystem::path(filename).parent_path().string();
+    for (string lLine; getline(lFile, lLine);)
+    {
+        stringstream lStream(lLine.substr(0, lLine.find("#")));
+        for (string lToken; lStream >> lToken;)
+        {
+            if (lToken.find("shader=") != 0)
+                continue;
+            string lShader = lToken.substr(7);
+            lShader = lDirectory == "" ? lShader : lDirectory + "/" + lShader;
+            if (find(lShaders.begin(), lShaders.end(), lShader) == lShaders.end())
+                lShaders.push_back(lShader);
+        }
+    }
+    return lShaders;
+}
+
+/*************/
+vector<string> RenderGraph::split(const string& str, char sep) const
+{
+    vector<string> lTokens;
+    stringstream lStream(str);
+    for (string lToken; getline(lStream, lToken, sep);)
+        if (lToken != "")
+            lTokens.push_back(lToken);
+    return lTokens;
+}
+
+/*************/
+bool RenderGraph::load(const string& filename)
+{
+    mManifest = filename;
+    if (!boost::filesystem::exists(filename))
+        return false;
+    mManifestChange = boost::filesystem::last_write_time(filename);
+
+    ifstream lFile(filename, ios::in);
+    if (!lFile.is_open())
+        return false;
+
+    vector<RenderPass> lPasses;
+    map<string, History> lHistories;
+    vector<ComputePass> lComputePasses;
+    vector<pair<string, Buffer>> lBuffers;
+    vector<pair<string, Image>> lImages;
+    int lSubsteps = 1;
+    int lLineNumber = 0;
+    for (string lLine; getline(lFile, lLine);)
+    {
+        lLineNumber++;
+        lLine = lLine.substr(0, lLine.find("#"));
+        if (lLine.find_first_not_of(" \t\r") == string::npos)
+            continue;
+
+        stringstream lStream(lLine);
+        string lKeyword;
+        lStream >> lKeyword;
+
+        mParseError.clear();
+        bool lIsValid = true;
+        if (lKeyword == "substeps")
+            lIsValid = (lStream >> lSubsteps) && lSubsteps > 0;
+        else if (lKeyword == "history")
+            lIsValid = parseHistory(lStream, lHistories);
+        else if (lKeyword == "buffer")
+            lIsValid = parseBuffer(lStream, lBuffers) && lBuffers.size() <= MAX_BUFFER_BINDINGS;
+        else if (lKeyword == "image")
+            lIsValid = parseImage(lStream, lImages) && lImages.size() <= MAX_IMAGE_UNITS;
+        else if (lKeyword == "compute")
+        {
+            ComputePass lCompute;
+            lCompute.index = lComputePasses.size();
+            lIsValid = parseCompute(lStream, lCompute);
+            lComputePasses.push_back(std::move(lCompute));
+        }
+        else
+        {
+            RenderPass lPass;
+            lPass.index = lPasses.size();
+            lIsValid = parseLine(lLine, lPass);
+            lPasses.push_back(std::move(lPass));
+        }
+
+        if (!lIsValid)
+        {
+            cerr << "Error in " << filename << " at line " << lLineNumber << ": " << (mParseError.empty() ? lLine : mParseError) << endl;
+            return false;
+        }
+    }
+
+    if (lPasses.size() == 0)
+    {
+        cerr << "No pass declared in " << filename << endl;
+        return false;
+    }
+
+    release();
+    mPasses = std::move(lPasses);
+    mHistories = lHistories;
+    mComputePasses = std::move(lComputePasses);
+    mBuffers = lBuffers;
+    mImages = lImages;
+    mSubsteps = lSubsteps;
+    cout << "Render graph " << filename << " loaded, " << mPasses.size() << " passes declared." << endl;
+    return true;
+}
+
+/*************/
+// Numbers are read whole, so that a typo fails the line rather than throwing
+template<typename T>
+bool RenderGraph::parseNumber(const string& text, T& value)
+{
+    istringstream lStream(text);
+    T lValue;
+    if (!(lStream >> lValue) || !lStream.eof())
+    {
+        mParseError = "invalid value " + text;
+        return false;
+    }
+    value = lValue;
+    return true;
+}
+
+/*************/
+bool RenderGraph::parseLine(const string& line, RenderPass& pass)
+{
+    stringstream lStream(line);
+    string lKeyword;
+    lStream >> lKeyword;
+    if (lKeyword != "pass")
+        return false;
+    if (!(lStream >> pass.name))
+        return false;
+
+    string lDirectory = boost::filesystem::path(mManifest).parent_path().string();
+
+    for (string lToken; lStream >> lToken;)
+    {
+        string::size_type lPos = lToken.find("=");
+        if (lPos == string::npos)
+            return false;
+        string lKey = lToken.substr(0, lPos);
+        string lValue = lToken.substr(lPos + 1);
+
+        if (lKey == "shader")
+            pass.shader = lDirectory == "" ? lValue : lDirectory + "/" + lValue;
+        else if (lKey == "geometry" && (lValue == "object" || lValue == "quad"))
+            pass.geometry = lValue;
+        else if (lKey == "in")
+            pass.inputs = split(lValue, ',');
+        else if (lKey == "out")
+        {
+            // Each output can specify its own format, as name:format
+            pass.outputs.clear();
+            pass.outputFormats.clear();
+            for (auto& output : split(lValue, ','))
+            {
+                string::size_type lColon = output.find(":");
+                TextureFormat lFormat;
+                if (lColon != string::npos && !getFormat(output.substr(lColon + 1), lFormat))
+                    return false;
+                pass.outputs.push_back(output.substr(0, lColon));
+                pass.outputFormats.push_back(lColon == string::npos ? "" : output.substr(lColon + 1));
+            }
+        }
+        else if (lKey == "format")
+        {
+            TextureFormat lFormat;
+            if (!getFormat(lValue, lFormat) || lFormat.format == GL_DEPTH_COMPONENT)
+                return false;
+            pass.format = lValue;
+        }
+        else if (lKey == "scale" && parseNumber(lValue, pass.scale))
+            pass.scale = max(0.01f, pass.scale);
+        else if (lKey == "depth")
+        {
+            TextureFormat lFormat;
+            if (lValue == "1")
+                pass.depth = "default";
+            else if (lValue == "0" || lValue == "none")
+                pass.depth = "none";
+            else if (getFormat(lValue, lFormat) && lFormat.format == GL_DEPTH_COMPONENT)
+                pass.depth = lValue;
+            else
+                return false;
+        }
+        else if (lKey == "samples" && parseNumber(lValue, pass.samples))
+            pass.samples = max(1, pass.samples);
+        else if (lKey == "step")
+            pass.step = (lValue == "1");
+        else
+            return false;
+    }
+
+    return pass.outputs.size() != 0;
+}
+
+/*************/
+bool RenderGraph::parseHistory(stringstream& stream, map<string, History>& histories)
+{
+    string lName;
+    if (!(stream >> lName))
+        return false;
+
+    History lHistory;
+    for (string lToken; stream >> lToken;)
+    {
+        string::size_type lPos = lToken.find("=");
+        if (lPos == string::npos)
+            return false;
+        string lKey = lToken.substr(0, lPos);
+        string lValue = lToken.substr(lPos + 1);
+
+        TextureFormat lFormat;
+        if (lKey == "count" && parseNumber(lValue, lHistory.count))
+            lHistory.count = min(3, max(2, lHistory.count));
+        else if (lKey == "format" && getFormat(lValue, lFormat))
+            lHistory.format = lValue;
+        else if (lKey == "scale" && parseNumber(lValue, lHistory.scale))
+            lHistory.scale = max(0.01f, lHistory.scale);
+        else
+            return false;
+    }
+
+    histories[lName] = lHistory;
+    return true;
+}
+
+/*************/
+bool RenderGraph::parseCompute(stringstream& stream, ComputePass& pass)
+{
+    if (!(stream >> pass.name))
+        return false;
+
+    string lDirectory = boost::filesystem::path(mManifest).parent_path().string();
+    for (string lToken; stream >> lToken;)
+    {
+        string::size_type lPos = lToken.find("=");
+        if (lPos == string::npos)
+            return false;
+        string lKey = lToken.substr(0, lPos);
+        string lValue = lToken.substr(lPos + 1);
+
+        if (lKey == "shader")
+            pass.shader = lDirectory == "" ? lValue : lDirectory + "/" + lValue;
+        else if (lKey == "groups")
+        {
+            vector<string> lGroups = split(lValue, ',');
+            if (lGroups.size() == 0 || lGroups.size() > 3)
+                return false;
+            for (int i = 0; i < 3; ++i)
+            {
+                pass.groups[i] = 1;
+                if (i < lGroups.size() && !parseNumber(lGroups[i], pass.groups[i]))
+                    return false;
+                pass.groups[i] = max(1, pass.groups[i]);
+            }
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+/*************/
+bool RenderGraph::parseBuffer(stringstream& stream, vector<pair<string, Buffer>>& buffers)
+{
+    string lName;
+    if (!(stream >> lName))
+        return false;
+
+    Buffer lBuffer;
+    for (string lToken; stream >> lToken;)
+    {
+        string::size_type lPos = lToken.find("=");
+        if (lPos == string::npos)
+            return false;
+        string lKey = lToken.substr(0, lPos);
+        string lValue = lToken.substr(lPos + 1);
+
+        if (lKey != "size" || !parseNumber(lValue, lBuffer.size))
+            return false;
+    }
+
+    if (lBuffer.size <= 0)
+        return false;
+    buffers.push_back(make_pair(lName, lBuffer));
+    return true;
+}
+
+/*************/
+bool RenderGraph::parseImage(stringstream& stream, vector<pair<string, Image>>& images)
+{
+    string lName;
+    if (!(stream >> lName))
+        return false;
+
+    Image lImage;
+    for (string lToken; stream >> lToken;)
+    {
+        string::size_type lPos = lToken.find("=");
+        if (lPos == string::npos)
+            return false;
+        string lKey = lToken.substr(0, lPos);
+        string lValue = lToken.substr(lPos + 1);
+
+        TextureFormat lFormat;
+        if (lKey == "format" && getFormat(lValue, lFormat) && lFormat.format != GL_DEPTH_COMPONENT)
+            lImage.format = lValue;
+        else if (lKey == "scale" && parseNumber(lValue, lImage.scale))
+            lImage.scale = max(0.01f, lImage.scale);
+        else
+            return false;
+    }
+
+    images.push_back(make_pair(lName, lImage));
+    return true;
+}
+
+/*************/
+RenderGraph::History* RenderGraph::getHistory(const string& name, int& offset)
+{
+    offset = 0;
+    auto lHistoryIt = mHistories.find(name);
+    if (lHistoryIt != mHistories.end())
+        return &lHistoryIt->second;
+
+    if (name.size() > 4 && name.substr(name.size() - 4) == "Prev")
+    {
+        offset = -1;
+        lHistoryIt = mHistories.find(name.substr(0, name.size() - 4));
+        if (lHistoryIt != mHistories.end())
+            return &lHistoryIt->second;
+    }
+
+    return nullptr;
+}
+
+/*************/
+RenderGraph::History* RenderGraph::getWrittenHistory(const RenderPass& pass)
+{
+    for (auto& output : pass.outputs)
+    {
+        auto lHistoryIt = mHistories.find(output);
+        if (lHistoryIt != mHistories.end())
+            return &lHistoryIt->second;
+    }
+    return nullptr;
+}
+
+/*************/
+bool RenderGraph::reads(const RenderPass& pass, const string& input) const
+{
+    if (!pass.introspected)
+        return true;
+    return find(pass.readInputs.begin(), pass.readInputs.end(), input) != pass.readInputs.end();
+}
+
+/*************/
+bool RenderGraph::hasSteps() const
+{
+    for (auto index : mActive)
+        if (mPasses[index].step)
+            return true;
+    return false;
+}
+
+/*************/
+void RenderGraph::setDefault()
+{
+    release();
+    mPasses.clear();
+    mHistories.clear();
+    mComputePasses.clear();
+    mBuffers.clear();
+    mImages.clear();
+    mSubsteps = 1;
+
+    // Dispatched only if the shader has a compute stage
+    ComputePass lCompute;
+    lCompute.name = "compute";
+    mComputePasses.push_back(std::move(lCompute));
+
+    RenderPass lObject;
+    lObject.name = "object";
+    lObject.outputs = {"vFBOMap", "vFBOMap2"};
+    lObject.outputFormats = {"", ""};
+    lObject.depth = "default";
+    lObject.index = 0;
+    mPasses.push_back(std::move(lObject));
+
+    RenderPass lScreen;
+    lScreen.name = "screen";
+    lScreen.geometry = "quad";
+    lScreen.inputs = {"vFBOMap", "vFBOMap2"};
+    lScreen.outputs = {"screen"};
+    lScreen.outputFormats = {""};
+    lScreen.index = 1;
+    mPasses.push_back(std::move(lScreen));
+}
+
+/*************/
+bool RenderGraph::manifestChanged()
+{
+    if (mManifest == "" || !boost::filesystem::exists(mManifest))
+    {
+        bool lResult = mManifestChange != 0;
+        mManifestChange = 0;
+        return lResult;
+    }
+
+    std::time_t lTime = boost::filesystem::last_write_time(mManifest);
+    if (lTime != mManifestChange)
+    {
+        mManifestChange = lTime;
+        return true;
+    }
+    return false;
+}
+
+/*************/
+void RenderGraph::setDefaultFormats(const string& color, const string& depth, int samples)
+{
+    mColorFormat = color;
+    mDepthFormat = depth;
+    mSamples = max(1, samples);
+}
+
+/*************/
+bool RenderGraph::build()
+{
+    // Formats and sample counts not given by the manifest come from the defaults
+    for (auto& pass : mPasses)
+    {
+        string lFormat = pass.format == "" ? mColorFormat : pass.format;
+        pass.outputFormats.resize(pass.outputs.size());
+        for (auto& format : pass.outputFormats)
+            if (format == "")
+                format = lFormat;
+        if (pass.depth == "default")
+            pass.depth = mDepthFormat;
+        if (pass.samples == 0)
+            pass.samples = pass.geometry == "object" ? mSamples : 1;
+    }
+    for (auto& history : mHistories)
+        if (history.second.format == "")
+            history.second.format = mColorFormat;
+    for (auto& image : mImages)
+        if (image.second.format == "")
+            image.second.format = mColorFormat;
+
+    // Every input must have been written by a previous pass, or be a history
+    set<string> lWritten;
+    bool lStepsDone = false;
+    for (auto& pass : mPasses)
+    {
+        if (pass.step && lStepsDone)
+        {
+            cerr << "Render graph: step pass " << pass.name << " must be declared before the other passes." << endl;
+            return false;
+        }
+        lStepsDone |= !pass.step;
+
+        History* lWrittenHistory = getWrittenHistory(pass);
+        for (auto& input : pass.inputs)
+        {
+            int lOffset;
+            History* lHistory = getHistory(input, lOffset);
+            if (lHistory != nullptr)
+            {
+                if (lHistory == lWrittenHistory && lOffset != 0 && lHistory->count < 3)
+                {
+                    cerr << "Render graph: pass " << pass.name << " needs a history count of 3 to read " << input << "." << endl;
+                    return false;
+                }
+                continue;
+            }
+
+            if (lWritten.find(input) == lWritten.end())
+            {
+                cerr << "Render graph: pass " << pass.name << " reads " << input << " before it is written." << endl;
+                return false;
+            }
+        }
+
+        pass.toScreen = false;
+        for (auto& output : pass.outputs)
+        {
+            auto lHistoryIt = mHistories.find(output);
+            if (output == "screen")
+                pass.toScreen = true;
+            else if (lWritten.find(output) != lWritten.end())
+            {
+                cerr << "Render graph: " << output << " is written by more than one pass." << endl;
+                return false;
+            }
+            else if (lHistoryIt != mHistories.end() && lHistoryIt->second.count != lWrittenHistory->count)
+            {
+                cerr << "Render graph: histories written by pass " << pass.name << " must have the same count." << endl;
+                return false;
+            }
+            else
+                lWritten.insert(output);
+        }
+    }
+
+    // Culling, from the screen backward
+    set<string> lNeeded;
+    vector<int> lActive;
+    for (int i = mPasses.size() - 1; i >= 0; --i)
+    {
+        auto& pass = mPasses[i];
+        bool lIsUsed = pass.toScreen;
+        for (auto& output : pass.outputs)
+            lIsUsed |= (lNeeded.find(output) != lNeeded.end());
+        if (!lIsUsed)
+        {
+            cout << "Render graph: culling unused pass " << pass.name << endl;
+            continue;
+        }
+        lActive.insert(lActive.begin(), i);
+        for (auto& input : pass.inputs)
+            if (reads(pass, input))
+                lNeeded.insert(input);
+    }
+
+    if (lActive.size() == 0)
+    {
+        cerr << "Render graph: no pass writes to the screen." << endl;
+        return false;
+    }
+
+    // Lifetimes, expressed as indices in the active pass list
+    mActive = lActive;
+    mResources.clear();
+    for (auto& history : mHistories)
+        history.second.mipmapped = mAlwaysMipmap;
+    for (int i = 0; i < mActive.size(); ++i)
+    {
+        auto& pass = mPasses[mActive[i]];
+        pass.outputUsed.assign(pass.outputs.size(), true);
+        for (int o = 0; o < pass.outputs.size(); ++o)
+        {
+            auto& output = pass.outputs[o];
+            if (output == "screen" || mHistories.find(output) != mHistories.end())
+                continue;
+            // Written by the shader, but read by nobody
+            if (lNeeded.find(output) == lNeeded.end())
+            {
+                pass.outputUsed[o] = false;
+                continue;
+            }
+            Resource lResource;
+            lResource.format = pass.outputFormats[o];
+            lResource.scale = pass.scale;
+            lResource.first = lResource.last = i;
+            mResources[output] = lResource;
+        }
+        // Multisampled passes keep their own depth buffer
+        if (pass.depth != "none" && !pass.toScreen && pass.samples == 1)
+        {
+            Resource lResource;
+            lResource.format = pass.depth;
+            lResource.scale = pass.scale;
+            lResource.first = lResource.last = i;
+            mResources[pass.name + "#depth"] = lResource;
+        }
+        // Implicit levels of detail only go past the base level when reading a larger texture
+        for (auto& input : pass.inputs)
+        {
+            if (!reads(pass, input))
+                continue;
+            bool lLod = mAlwaysMipmap || !pass.introspected || pass.explicitLod;
+            int lOffset;
+            History* lHistory = getHistory(input, lOffset);
+            if (lHistory != nullptr)
+            {
+                lHistory->mipmapped |= lLod || pass.scale < lHistory->scale;
+                continue;
+            }
+            auto& resource = mResources[input];
+            resource.last = i;
+            resource.mipmapped |= lLod || pass.scale < resource.scale;
+        }
+    }
+
+    // Resources which are never alive at the same time share a target
+    vector<pair<string, Resource*>> lOrdered;
+    for (auto& resource : mResources)
+        lOrdered.push_back(make_pair(resource.first, &resource.second));
+    stable_sort(lOrdered.begin(), lOrdered.end(), [](const pair<string, Resource*>& a, const pair<string, Resource*>& b) {
+        return a.second->first < b.second->first;
+    });
+
+    mTargets.clear();
+    for (auto& resource : lOrdered)
+    {
+        Resource* lResource = resource.second;
+        for (int t = 0; t < mTargets.size(); ++t)
+        {
+            auto& target = mTargets[t];
+            if (target.format == lResource->format && target.scale == lResource->scale && target.mipmapped == lResource->mipmapped
+                && target.lastUse < lResource->first)
+            {
+                lResource->target = t;
+                target.lastUse = lResource->last;
+                break;
+            }
+        }
+
+        if (lResource->target == -1)
+        {
+            Target lTarget;
+            lTarget.format = lResource->format;
+            lTarget.scale = lResource->scale;
+            lTarget.lastUse = lResource->last;
+            lTarget.mipmapped = lResource->mipmapped;
+            lResource->target = mTargets.size();
+            mTargets.push_back(lTarget);
+        }
+    }
+
+    cout << "Render graph: " << mActive.size() << " active passes, " << mResources.size() << " textures mapped to " << mTargets.size() << " allocations." << endl;
+    return true;
+}
+
+/*************/
+bool RenderGraph::setUsage(RenderPass* pass, const vector<string>& readInputs, bool explicitLod)
+{
+    if (pass->introspected && pass->readInputs == readInputs && pass->explicitLod == explicitLod)
+        return false;
+
+    pass->introspected = true;
+    pass->readInputs = readInputs;
+    pass->explicitLod = explicitLod;
+    return true;
+}
+
+/*************/
+bool RenderGraph::rebuild()
+{
+    int lWidth = mCapacityWidth;
+    int lHeight = mCapacityHeight;
+    releaseTargets();
+    if (!build())
+        return false;
+    allocateStorage(lWidth, lHeight);
+    return true;
+}
+
+/*************/
+GLuint RenderGraph::createTexture(const string& format, int width, int height, bool mipmapped)
+{
+    TextureFormat lFormat;
+    getFormat(format, lFormat);
+
+    GLuint lTexture;
+    glGenTextures(1, &lTexture);
+    GLRegistry::add(GLRegistry::Texture, lTexture, "render target");
+    GLState::editTexture(GL_TEXTURE_2D, lTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Immutable storage: the texture is never respecified, only replaced
+    if (lFormat.format == GL_DEPTH_COMPONENT)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexStorage2D(GL_TEXTURE_2D, 1, lFormat.internalFormat, width, height);
+        GLRegistry::setSize(GLRegistry::Texture, lTexture, GLRegistry::getTextureBytes(lFormat.internalFormat, width, height));
+        mMemory += (long)width * height * lFormat.bytesPerPixel;
+    }
+    else if (mipmapped)
+    {
+        int lLevels = 1 + (int)floor(log2((float)max(width, height)));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexStorage2D(GL_TEXTURE_2D, lLevels, lFormat.internalFormat, width, height);
+        GLRegistry::setSize(GLRegistry::Texture, lTexture, GLRegistry::getTextureBytes(lFormat.internalFormat, width, height, lLevels));
+        mMemory += (long)width * height * lFormat.bytesPerPixel * 4 / 3;
+    }
+    else
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexStorage2D(GL_TEXTURE_2D, 1, lFormat.internalFormat, width, height);
+        GLRegistry::setSize(GLRegistry::Texture, lTexture, GLRegistry::getTextureBytes(lFormat.internalFormat, width, height));
+        mMemory += (long)width * height * lFormat.bytesPerPixel;
+    }
+
+    return lTexture;
+}
+
+/*************/
+void RenderGraph::resize(int width, int height)
+{
+    mWidth = width;
+    mHeight = height;
+    mResizeTime = boost::chrono::steady_clock::now();
+
+    // Growing is geometric, so that dragging the window edge only reallocates a few times
+    if (width > mCapacityWidth || height > mCapacityHeight)
+    {
+        int lWidth = mCapacityWidth;
+        int lHeight = mCapacityHeight;
+        if (width > mCapacityWidth)
+            lWidth = max(width, (int)(mCapacityWidth * mGrowthFactor));
+        if (height > mCapacityHeight)
+            lHeight = max(height, (int)(mCapacityHeight * mGrowthFactor));
+        allocateStorage(lWidth, lHeight);
+    }
+    else
+    {
+        updateViewports();
+    }
+}
+
+/*************/
+bool RenderGraph::update()
+{
+    // Once the size is stable, the storage is trimmed to fit it exactly
+    if (mCapacityWidth == mWidth && mCapacityHeight == mHeight)
+        return false;
+
+    boost::chrono::duration<float> lStable = boost::chrono::steady_clock::now() - mResizeTime;
+    if (lStable.count() <= mShrinkDelay)
+        return false;
+
+    allocateStorage(mWidth, mHeight);
+    return true;
+}
+
+/*************/
+void RenderGraph::allocate(int width, int height)
+{
+    mWidth = width;
+    mHeight = height;
+    allocateStorage(width, height);
+}
+
+/*************/
+void RenderGraph::allocateStorage(int width, int height)
+{
+    releaseTargets();
+
+    mCapacityWidth = width;
+    mCapacityHeight = height;
+    mMemory = 0;
+
+    for (auto& target : mTargets)
+    {
+        int lWidth = max(1, (int)round(width * target.scale));
+        int lHeight = max(1, (int)round(height * target.scale));
+        target.texture = createTexture(target.format, lWidth, lHeight, target.mipmapped);
+    }
+
+    // History textures start from a blank state, or keep what fits from the previous storage
+    for (auto& history : mHistories)
+    {
+        TextureFormat lFormat;
+        getFormat(history.second.format, lFormat);
+        int lWidth = max(1, (int)round(width * history.second.scale));
+        int lHeight = max(1, (int)round(height * history.second.scale));
+
+        vector<GLuint> lPrevious = history.second.textures;
+        if (lPrevious.size() == 0)
+            history.second.current = 0;
+
+        history.second.textures.resize(history.second.count);
+        for (int i = 0; i < history.second.count; ++i)
+        {
+            GLuint lTexture = createTexture(history.second.format, lWidth, lHeight, history.second.mipmapped);
+            glClearTexImage(lTexture, 0, lFormat.format, lFormat.type, nullptr);
+            if (lPrevious.size() != 0)
+            {
+                glCopyImageSubData(lPrevious[i], GL_TEXTURE_2D, 0, 0, 0, 0, lTexture, GL_TEXTURE_2D, 0, 0, 0, 0,
+                                   min(lWidth, history.second.width), min(lHeight, history.second.height), 1);
+            }
+            history.second.textures[i] = lTexture;
+        }
+        history.second.width = lWidth;
+        history.second.height = lHeight;
+
+        if (lPrevious.size() != 0)
+            deleteTextures(lPrevious);
+    }
+
+    // Images follow the size of the targets keeping what fits, like histories, buffers are kept as long as the manifest does not change
+    for (auto& image : mImages)
+    {
+        TextureFormat lFormat;
+        getFormat(image.second.format, lFormat);
+        int lWidth = max(1, (int)round(width * image.second.scale));
+        int lHeight = max(1, (int)round(height * image.second.scale));
+
+        GLuint lPrevious = image.second.texture;
+        glGenTextures(1, &image.second.texture);
+        GLRegistry::add(GLRegistry::Texture, image.second.texture, image.first.c_str());
+        GLState::editTexture(GL_TEXTURE_2D, image.second.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexStorage2D(GL_TEXTURE_2D, 1, lFormat.internalFormat, lWidth, lHeight);
+        GLRegistry::setSize(GLRegistry::Texture, image.second.texture, GLRegistry::getTextureBytes(lFormat.internalFormat, lWidth, lHeight));
+        glClearTexImage(image.second.texture, 0, lFormat.format, lFormat.type, nullptr);
+        if (lPrevious != 0)
+        {
+            glCopyImageSubData(lPrevious, GL_TEXTURE_2D, 0, 0, 0, 0, image.second.texture, GL_TEXTURE_2D, 0, 0, 0, 0,
+                               min(lWidth, image.second.width), min(lHeight, image.second.height), 1);
+            GLRegistry::remove(GLRegistry::Texture, lPrevious);
+            glDeleteTextures(1, &lPrevious);
+        }
+        image.second.width = lWidth;
+        image.second.height = lHeight;
+        mMemory += (long)lWidth * lHeight * lFormat.bytesPerPixel;
+    }
+
+    for (auto& buffer : mBuffers)
+    {
+        if (buffer.second.buffer == 0)
+        {
+            glGenBuffers(1, &buffer.second.buffer);
+            GLRegistry::add(GLRegistry::Buffer, buffer.second.buffer, buffer.first.c_str());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.second.buffer);
+            glBufferStorage(GL_SHADER_STORAGE_BUFFER, buffer.second.size, nullptr, GL_DYNAMIC_STORAGE_BIT);
+            GLRegistry::setSize(GLRegistry::Buffer, buffer.second.buffer, buffer.second.size);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        }
+        mMemory += buffer.second.size;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    GLint lMaxSamples;
+    glGetIntegerv(GL_MAX_SAMPLES, &lMaxSamples);
+
+    for (auto index : mActive)
+    {
+        auto& pass = mPasses[index];
+
+        // History inputs and outputs are resolved by beginPass
+        int lOffset;
+        pass.inputTextures.clear();
+        for (auto& input : pass.inputs)
+        {
+            if (getHistory(input, lOffset) != nullptr || !reads(pass, input))
+                pass.inputTextures.push_back(0);
+            else
+                pass.inputTextures.push_back(mTargets[mResources[input].target].texture);
+        }
+
+        pass.outputTextures.clear();
+        if (pass.toScreen)
+            continue;
+
+        pass.depthTexture = 0;
+        if (pass.depth != "none" && pass.samples == 1)
+            pass.depthTexture = mTargets[mResources[pass.name + "#depth"].target].texture;
+        else if (pass.samples > 1)
+            allocateMultisample(pass, min(pass.samples, lMaxSamples));
+
+        // One framebuffer per position in the history ring
+        History* lWrittenHistory = getWrittenHistory(pass);
+        int lRingSize = lWrittenHistory ? lWrittenHistory->count : 1;
+        pass.fbos.resize(lRingSize);
+        glGenFramebuffers(lRingSize, pass.fbos.data());
+        for (auto fbo : pass.fbos)
+            GLRegistry::add(GLRegistry::Framebuffer, fbo, pass.name.c_str());
+        for (int r = 0; r < lRingSize; ++r)
+        {
+            pass.outputTextures.clear();
+            for (int o = 0; o < pass.outputs.size(); ++o)
+            {
+                auto lHistoryIt = mHistories.find(pass.outputs[o]);
+                if (lHistoryIt != mHistories.end())
+                    pass.outputTextures.push_back(lHistoryIt->second.textures[r]);
+                else if (pass.outputUsed[o])
+                    pass.outputTextures.push_back(mTargets[mResources[pass.outputs[o]].target].texture);
+                else
+                    pass.outputTextures.push_back(0);
+            }
+
+            // Unused outputs keep their attachment point, but nothing is attached to it
+            GLState::bindFramebuffer(GL_FRAMEBUFFER, pass.fbos[r]);
+            if (pass.depthTexture)
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, pass.depthTexture, 0);
+            for (int i = 0; i < pass.outputTextures.size(); ++i)
+                if (pass.outputTextures[i] != 0)
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, pass.outputTextures[i], 0);
+
+            GLenum lFBOStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if (lFBOStatus != GL_FRAMEBUFFER_COMPLETE)
+                cerr << "Error while preparing the FBO for pass " << pass.name << "." << endl;
+        }
+        pass.fbo = pass.fbos[0];
+    }
+    GLState::bindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    updateViewports();
+    cout << "Render graph: " << getMemory() / (1024 * 1024) << " MB of render targets allocated." << endl;
+}
+
+/*************/
+void RenderGraph::allocateMultisample(RenderPass& pass, int samples)
+{
+    int lWidth = max(1, (int)round(mCapacityWidth * pass.scale));
+    int lHeight = max(1, (int)round(mCapacityHeight * pass.scale));
+
+    vector<string> lFormats = pass.outputFormats;
+    if (pass.depth != "none")
+        lFormats.push_back(pass.depth);
+
+    glGenFramebuffers(1, &pass.msaaFbo);
+    GLRegistry::add(GLRegistry::Framebuffer, pass.msaaFbo, pass.name.c_str());
+    GLState::bindFramebuffer(GL_FRAMEBUFFER, pass.msaaFbo);
+    for (int i = 0; i < lFormats.size(); ++i)
+    {
+        if (i < pass.outputUsed.size() && !pass.outputUsed[i])
+            continue;
+
+        TextureFormat lFormat;
+        getFormat(lFormats[i], lFormat);
+
+        GLuint lTexture;
+        glGenTextures(1, &lTexture);
+        GLRegistry::add(GLRegistry::Texture, lTexture, pass.name.c_str());
+        GLState::editTexture(GL_TEXTURE_2D_MULTISAMPLE, lTexture);
+        glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, lFormat.internalFormat, lWidth, lHeight, GL_TRUE);
+        GLRegistry::setSize(GLRegistry::Texture, lTexture, GLRegistry::getTextureBytes(lFormat.internalFormat, lWidth, lHeight, 1, samples));
+        pass.msaaTextures.push_back(lTexture);
+        mMemory += (long)lWidth * lHeight * lFormat.bytesPerPixel * samples;
+
+        GLenum lAttachment = lFormat.format == GL_DEPTH_COMPONENT ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0 + i;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, lAttachment, GL_TEXTURE_2D_MULTISAMPLE, lTexture, 0);
+    }
+    GLenum lFBOStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (lFBOStatus != GL_FRAMEBUFFER_COMPLETE)
+        cerr << "Error while preparing the multisampled FBO for pass " << pass.name << "." << endl;
+}
+
+/*************/
+void RenderGraph::resolve(RenderPass* pass)
+{
+    if (pass->msaaFbo == 0)
+        return;
+
+    GLState::bindFramebuffer(GL_READ_FRAMEBUFFER, pass->msaaFbo);
+    GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, pass->fbo);
+    for (int i = 0; i < pass->outputTextures.size(); ++i)
+    {
+        if (pass->outputTextures[i] == 0)
+            continue;
+        GLenum lAttachment = GL_COLOR_ATTACHMENT0 + i;
+        glReadBuffer(lAttachment);
+        GLState::drawBuffers(1, &lAttachment);
+        glBlitFramebuffer(0, 0, pass->width, pass->height, 0, 0, pass->width, pass->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+}
+
+/*************/
+void RenderGraph::generateMipmaps(RenderPass* pass)
+{
+    for (int i = 0; i < pass->outputTextures.size(); ++i)
+    {
+        if (pass->outputTextures[i] == 0)
+            continue;
+
+        auto lHistoryIt = mHistories.find(pass->outputs[i]);
+        bool lMipmapped = lHistoryIt != mHistories.end() ? lHistoryIt->second.mipmapped : mResources[pass->outputs[i]].mipmapped;
+        if (!lMipmapped)
+            continue;
+
+        GLState::editTexture(GL_TEXTURE_2D, pass->outputTextures[i]);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+}
+
+/*************/
+void RenderGraph::bindResources()
+{
+    for (int i = 0; i < mBuffers.size(); ++i)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, mBuffers[i].second.buffer);
+
+    for (int i = 0; i < mImages.size(); ++i)
+    {
+        TextureFormat lFormat;
+        getFormat(mImages[i].second.format, lFormat);
+        glBindImageTexture(i, mImages[i].second.texture, 0, GL_FALSE, 0, GL_READ_WRITE, lFormat.internalFormat);
+    }
+}
+
+/*************/
+void RenderGraph::setResourceBindings(GLuint program)
+{
+    for (int i = 0; i < mBuffers.size(); ++i)
+    {
+        GLuint lIndex = glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, mBuffers[i].first.c_str());
+        if (lIndex != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(program, lIndex, i);
+    }
+
+    for (int i = 0; i < mImages.size(); ++i)
+    {
+        GLint lLocation = glGetUniformLocation(program, mImages[i].first.c_str());
+        if (lLocation != -1)
+            glProgramUniform1i(program, lLocation, i);
+    }
+}
+
+/*************/
+void RenderGraph::updateViewports()
+{
+    // Passes render to the lower left part of their targets
+    for (auto index : mActive)
+    {
+        auto& pass = mPasses[index];
+        if (pass.toScreen)
+        {
+            pass.width = mWidth;
+            pass.height = mHeight;
+        }
+        else
+        {
+            pass.width = max(1, (int)round(mWidth * pass.scale));
+            pass.height = max(1, (int)round(mHeight * pass.scale));
+        }
+    }
+}
+
+/*************/
+void RenderGraph::beginPass(RenderPass* pass)
+{
+    for (int i = 0; i < pass->inputs.size(); ++i)
+    {
+        int lOffset;
+        History* lHistory = getHistory(pass->inputs[i], lOffset);
+        if (lHistory != nullptr)
+            pass->inputTextures[i] = lHistory->textures[(lHistory->current + lOffset + lHistory->count) % lHistory->count];
+    }
+
+    History* lWrittenHistory = getWrittenHistory(*pass);
+    if (lWrittenHistory == nullptr)
+        return;
+
+    int lNext = (lWrittenHistory->current + 1) % lWrittenHistory->count;
+    pass->fbo = pass->fbos[lNext];
+    for (int i = 0; i < pass->outputs.size(); ++i)
+    {
+        auto lHistoryIt = mHistories.find(pass->outputs[i]);
+        if (lHistoryIt != mHistories.end())
+            pass->outputTextures[i] = lHistoryIt->second.textures[lNext];
+    }
+}
+
+/*************/
+void RenderGraph::endPass(RenderPass* pass)
+{
+    for (auto& output : pass->outputs)
+    {
+        auto lHistoryIt = mHistories.find(output);
+        if (lHistoryIt != mHistories.end())
+            lHistoryIt->second.current = (lHistoryIt->second.current + 1) % lHistoryIt->second.count;
+    }
+}
+
+/*************/
+void RenderGraph::release()
+{
+    releaseTargets();
+
+    for (auto& history : mHistories)
+    {
+        deleteTextures(history.second.textures);
+    }
+
+    for (auto& image : mImages)
+    {
+        if (image.second.texture)
+        {
+            GLRegistry::remove(GLRegistry::Texture, image.second.texture);
+            glDeleteTextures(1, &image.second.texture);
+        }
+        image.second.texture = 0;
+    }
+
+    for (auto& buffer : mBuffers)
+    {
+        if (buffer.second.buffer)
+        {
+            GLRegistry::remove(GLRegistry::Buffer, buffer.second.buffer);
+            glDeleteBuffers(1, &buffer.second.buffer);
+        }
+        buffer.second.buffer = 0;
+    }
+
+    for (auto& compute : mComputePasses)
+        compute.program = 0;
+
+    mCapacityWidth = 0;
+    mCapacityHeight = 0;
+}
+
+/*************/
+void RenderGraph::releaseTargets()
+{
+    for (auto& pass : mPasses)
+    {
+        for (auto fbo : pass.fbos)
+            GLRegistry::remove(GLRegistry::Framebuffer, fbo);
+        if (pass.fbos.size())
+            glDeleteFramebuffers(pass.fbos.size(), pass.fbos.data());
+        pass.fbos.clear();
+        pass.fbo = 0;
+        if (pass.msaaFbo)
+        {
+            GLRegistry::remove(GLRegistry::Framebuffer, pass.msaaFbo);
+            glDeleteFramebuffers(1, &pass.msaaFbo);
+        }
+        pass.msaaFbo = 0;
+        deleteTextures(pass.msaaTextures);
+        pass.depthTexture = 0;
+        pass.inputTextures.clear();
+        pass.outputTextures.clear();
+    }
+
+    for (auto& target : mTargets)
+    {
+        if (target.texture)
+        {
+            GLRegistry::remove(GLRegistry::Texture, target.texture);
+            glDeleteTextures(1, &target.texture);
+        }
+        target.texture = 0;
+    }
+}
+
+/*************/
+void RenderGraph::deleteTextures(vector<GLuint>& textures)
+{
+    for (auto texture : textures)
+        GLRegistry::remove(GLRegistry::Texture, texture);
+    if (textures.size())
+        glDeleteTextures(textures.size(), textures.data());
+    textures.clear();
+}
+
+/*************/
+vector<RenderPass*> RenderGraph::getPasses()
+{
+    vector<RenderPass*> lPasses;
+    for (auto index : mActive)
+        lPasses.push_back(&mPasses[index]);
+    return lPasses;
+}
+
+/*************/
+vector<ComputePass*> RenderGraph::getComputePasses()
+{
+    vector<ComputePass*> lPasses;
+    for (auto& compute : mComputePasses)
+        lPasses.push_back(&compute);
+    return lPasses;
+}
+
+/*************/
+vector<string> RenderGraph::getShaders() const
+{
+    vector<string> lShaders;
+    for (auto index : mActive)
+    {
+        auto& shader = mPasses[index].shader;
+        if (find(lShaders.begin(), lShaders.end(), shader) == lShaders.end())
+            lShaders.push_back(shader);
+    }
+    for (auto& compute : mComputePasses)
+        if (find(lShaders.begin(), lShaders.end(), compute.shader) == lShaders.end())
+            lShaders.push_back(compute.shader);
+    return lShaders;
+}
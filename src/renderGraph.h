@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @renderGraph.h
+ * A list of render passes, read from a manifest file
+ *
+ * The manifest lives next to the shader files (shader.graph for shader.*),
+ * one pass per line, in execution order:
+ *
+ *   pass <name> [shader=<base>] [geometry=object|quad] [in=<a,b,...>]
+ *        [out=<c[:format],d[:format],...>|screen] [format=<format>]
+ *        [scale=<factor>] [depth=0|1|none|D24|D32F] [samples=<n>] [step=0|1]
+ *   history <name> [count=2|3] [format=...] [scale=<factor>]
+ *   substeps <n>
+ *   buffer <name> size=<bytes>
+ *   image <name> [format=...] [scale=<factor>]
+ *   compute <name> [shader=<base>] [groups=<x,y,z>]
+ *
+ * Each input and output is a named texture, bound to the sampler uniform of
+ * the same name. Passes which do not contribute to the screen are culled, and
+ * intermediate textures whose lifetimes do not overlap share the same storage.
+ * Color formats are RGBA8, RGB10_A2, R11G11B10F, RGBA16F and RGBA32F. Passes
+ * with more than one sample render to multisampled buffers, which are
+ * resolved once the pass is done.
+ *
+ * Once the programs are linked, the inputs they actually read are given back
+ * to the graph: outputs read by nobody are neither allocated nor written,
+ * and mipmaps are only built for textures sampled at other levels than the
+ * base one, or read by passes of a smaller scale.
+ *
+ * History textures persist from one frame to the next, as a ring of buffers
+ * which swap roles after each write. Reading <name> gives the latest state,
+ * <name>Prev the one before. Passes marked as step run substeps times per
+ * frame, before the other passes.
+ *
+ * Buffers and images are bound to the shader storage blocks and image
+ * uniforms of the same name, in every program. Compute passes dispatch the
+ * .comp stage of their shader before any render pass, with as many work
+ * groups as needed to cover the window unless given.
+ */
+
+#ifndef RENDERGRAPH_H
+#define RENDERGRAPH_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <ctime>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "GLFW/glfw3.h"
+#include "boost/chrono/chrono.hpp"
+
+#include "glObject.h"
+#include "gpuTimer.h"
+
+/*************/
+struct TextureFormat
+{
+    std::string name;
+    GLenum internalFormat;
+    GLenum format;
+    GLenum type;
+    int bytesPerPixel;
+};
+
+/*************/
+struct RenderPass
+{
+    // Description, as read from the manifest
+    std::string name;
+    std::string shader {""};
+    std::string geometry {"object"};
+    std::vector<std::string> inputs;
+    std::vector<std::string> outputs;
+    std::vector<std::string> outputFormats;
+    std::string format {""};
+    float scale {1.f};
+    std::string depth {"none"};
+    int samples {0};
+    bool step {false};
+    int index {0};
+
+    // Runtime
+    bool toScreen {false};
+    int width {0};
+    int height {0};
+    GLuint fbo {0};
+    std::vector<GLuint> fbos;
+    GLuint depthTexture {0};
+    GLuint msaaFbo {0};
+    std::vector<GLuint> msaaTextures;
+    std::vector<GLuint> inputTextures;
+    std::vector<GLuint> outputTextures;
+    GLuint program {0};
+    std::vector<GLint> inputLocations;
+    std::vector<GLint> depthInputLocations; // In the depth pre-pass program
+    std::vector<GLint> overdrawInputLocations; // In the overdraw counting program
+    std::vector<bool> outputUsed;
+    GpuTimer timer;
+    GpuTimer depthTimer; // Of the depth pre-pass
+
+    // Usage, from the linked program. Until known, every input is read with its mipmaps
+    bool introspected {false};
+    std::vector<std::string> readInputs;
+    bool explicitLod {false};
+};
+
+/*************/
+struct ComputePass
+{
+    std::string name;
+    std::string shader {""};
+    int groups[3] {0, 0, 0}; // 0 to cover the window
+    int index {0};
+
+    // Runtime
+    GLuint program {0};
+    GpuTimer timer;
+};
+
+/*************/
+class RenderGraph
+{
+public:
+    ~RenderGraph();
+
+    // Reads the manifest. Returns false if it does not exist or is invalid
+    bool load(const std::string& filename);
+    // The historical two passes: the object to vFBOMap/vFBOMap2, then the screen
+    void setDefault();
+
+    // Formats used when the manifest does not specify them
+    void setDefaultFormats(const std::string& color, const std::string& depth, int samples);
+    // Builds the mipmaps of every color target, even those only read at the base level
+    void setMipmapping(bool always) {mAlwaysMipmap = always;}
+    // Culls useless passes and maps resources to physical textures
+    bool build();
+    // Records the inputs read by the program of the pass and whether it samples with explicit levels of detail.
+    // Returns true if this changed, in which case rebuild has to be called
+    bool setUsage(RenderPass* pass, const std::vector<std::string>& readInputs, bool explicitLod);
+    // Builds and allocates again, keeping the current storage size and the content of the histories
+    bool rebuild();
+    // Allocates the textures to the exact size
+    void allocate(int width, int height);
+    // Changes the rendered size, only growing the storage when needed
+    void resize(int width, int height);
+    // Trims the storage once the size has been stable for a while, returns true if it did
+    bool update();
+    void release();
+
+    // Selects the buffers of the history textures for the given pass,
+    // then swaps them once it has been rendered
+    void beginPass(RenderPass* pass);
+    void endPass(RenderPass* pass);
+    // Resolves multisampled outputs into the textures read by the next passes
+    void resolve(RenderPass* pass);
+    // Updates the mipmaps of the outputs which need them
+    void generateMipmaps(RenderPass* pass);
+
+    // Binds the buffers and images to their units, once per frame
+    void bindResources();
+    // Points the blocks and image uniforms of the program to these units
+    void setResourceBindings(GLuint program);
+
+    bool manifestChanged();
+    const std::string& getManifest() const {return mManifest;}
+    std::vector<RenderPass*> getPasses();
+    std::vector<ComputePass*> getComputePasses();
+    std::vector<std::string> getShaders() const;
+    int getTextureCount() const {return mTargets.size();}
+    int getResourceCount() const {return mResources.size();}
+    int getSubsteps() const {return mSubsteps;}
+    int getWidth() const {return mWidth;}
+    int getHeight() const {return mHeight;}
+    long getMemory() const {return mMemory;}
+    // Part of the targets actually rendered to, to be applied to texture coordinates
+    float getScaleX() const {return mCapacityWidth ? (float)mWidth / (float)mCapacityWidth : 1.f;}
+    float getScaleY() const {return mCapacityHeight ? (float)mHeight / (float)mCapacityHeight : 1.f;}
+    bool hasSteps() const;
+
+    static bool getFormat(const std::string& name, TextureFormat& format);
+    // Shader bases named by a manifest, without touching GL, so that they can be read early
+    static std::vector<std::string> listShaders(const std::string& filename);
+
+private:
+    struct Resource
+    {
+        std::string format;
+        float scale;
+        int first {-1};
+        int last {-1};
+        int target {-1};
+        bool mipmapped {false};
+    };
+
+    struct Target
+    {
+        std::string format;
+        float scale;
+        int lastUse;
+        bool mipmapped {false};
+        GLuint texture {0};
+    };
+
+    struct History
+    {
+        std::string format {""};
+        float scale {1.f};
+        int count {2};
+        int current {0};
+        int width {0};
+        int height {0};
+        bool mipmapped {false};
+        std::vector<GLuint> textures;
+    };
+
+    struct Buffer
+    {
+        long size {0};
+        GLuint buffer {0};
+    };
+
+    struct Image
+    {
+        std::string format {""};
+        float scale {1.f};
+        int width {0};
+        int height {0};
+        GLuint texture {0};
+    };
+
+    std::string mManifest {""};
+    std::time_t mManifestChange {0};
+
+    std::vector<RenderPass> mPasses;
+    std::vector<int> mActive;
+    std::map<std::string, Resource> mResources;
+    std::vector<Target> mTargets;
+    std::map<std::string, History> mHistories;
+    int mSubsteps {1};
+
+    std::vector<ComputePass> mComputePasses;
+    std::vector<std::pair<std::string, Buffer>> mBuffers;
+    std::vector<std::pair<std::string, Image>> mImages;
+
+    std::string mColorFormat {"RGBA8"};
+    std::string mDepthFormat {"D32F"};
+    int mSamples {1};
+    bool mAlwaysMipmap {false};
+    long mMemory {0};
+
+    int mWidth {0};
+    int mHeight {0};
+    int mCapacityWidth {0};
+    int mCapacityHeight {0};
+    float mGrowthFactor {1.5f};
+    float mShrinkDelay {1.f};
+    boost::chrono::steady_clock::time_point mResizeTime;
+
+    GLuint createTexture(const std::string& format, int width, int height, bool mipmapped);
+    void deleteTextures(std::vector<GLuint>& textures);
+    void allocateStorage(int width, int height);
+    void allocateMultisample(RenderPass& pass, int samples);
+    void releaseTargets();
+    void updateViewports();
+
+    std::string mParseError; // What was wrong with the last line, if not its syntax
+    template<typename T> bool parseNumber(const std::string& text, T& value);
+    bool parseLine(const std::string& line, RenderPass& pass);
+    bool parseHistory(std::stringstream& stream, std::map<std::string, History>& histories);
+    bool parseCompute(std::stringstream& stream, ComputePass& pass);
+    bool parseBuffer(std::stringstream& stream, std::vector<std::pair<std::string, Buffer>>& buffers);
+    bool parseImage(std::stringstream& stream, std::vector<std::pair<std::string, Image>>& images);
+    History* getHistory(const std::string& name, int& offset);
+    History* getWrittenHistory(const RenderPass& pass);
+    bool reads(const RenderPass& pass, const std::string& input) const;
+    std::vector<std::string> split(const std::string& str, char sep) const;
+};
+
+#endif // RENDERGRAPH_H
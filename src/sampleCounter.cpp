@@ -0,0 +1,58 @@
+#include "sampleCounter.h"
+
+using namespace std;
+
+/*************/
+SampleCounter::~SampleCounter()
+{
+    if (mFree.size() != 0)
+        glDeleteQueries(mFree.size(), mFree.data());
+    if (mPending.size() != 0)
+        glDeleteQueries(mPending.size(), mPending.data());
+}
+
+/*************/
+void SampleCounter::begin()
+{
+    if (mIsRunning)
+        return;
+
+    if (mFree.size() == 0)
+    {
+        GLuint lQuery;
+        glGenQueries(1, &lQuery);
+        mFree.push_back(lQuery);
+    }
+
+    mCurrent = mFree.back();
+    mFree.pop_back();
+    glBeginQuery(GL_SAMPLES_PASSED, mCurrent);
+    mIsRunning = true;
+}
+
+/*************/
+void SampleCounter::end()
+{
+    if (!mIsRunning)
+        return;
+
+    glEndQuery(GL_SAMPLES_PASSED);
+    mPending.push_back(mCurrent);
+    mIsRunning = false;
+}
+
+/*************/
+void SampleCounter::collect()
+{
+    while (mPending.size() != 0)
+    {
+        GLint lAvailable = 0;
+        glGetQueryObjectiv(mPending.front(), GL_QUERY_RESULT_AVAILABLE, &lAvailable);
+        if (!lAvailable)
+            break;
+
+        glGetQueryObjectui64v(mPending.front(), GL_QUERY_RESULT, &mLast);
+        mFree.push_back(mPending.front());
+        mPending.erase(mPending.begin());
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @sampleCounter.h
+ * Counts the samples passing the depth test, read back a few frames later so as not to stall
+ */
+
+#ifndef SAMPLECOUNTER_H
+#define SAMPLECOUNTER_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <vector>
+
+#include "GLFW/glfw3.h"
+
+/*************/
+class SampleCounter
+{
+public:
+    ~SampleCounter();
+
+    void begin();
+    void end();
+
+    // Reads the results available, without waiting
+    void collect();
+
+    // Latest count read back
+    GLuint64 getLast() const {return mLast;}
+
+private:
+    std::vector<GLuint> mFree;
+    std::vector<GLuint> mPending;
+    GLuint mCurrent {0};
+    bool mIsRunning {false};
+    GLuint64 mLast {0};
+};
+
+#endif // SAMPLECOUNTER_H
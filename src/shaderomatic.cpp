@@ -1,12 +1,23 @@
 #include "shaderomatic.h"
 
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <thread>
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
 #include "boost/filesystem.hpp"
 #include "boost/lexical_cast.hpp"
 
+#include "benchmark.h"
+#include "glState.h"
+#include "gpuTimer.h"
 #include "meshLoader.h"
+#include "parallel.h"
+#include "profiler.h"
 
 using namespace std;
 using namespace boost::chrono;
@@ -16,6 +27,7 @@ char gDefaultVertShader[] =
     "\n"
     "in vec4 vVertex;\n"
     "in vec2 vTexCoord;\n"
+    "in mat4 vInstanceMatrix;\n"
     "\n"
     "uniform mat4 vMVP;\n"
     "uniform vec2 vMouse;\n"
@@ -24,7 +36,7 @@ char gDefaultVertShader[] =
     "\n"
     "void main(void)\n"
     "{\n"
-    "    gl_Position.xyz = (vMVP*vVertex).xyz;\n"
+    "    gl_Position.xyz = (vMVP*vInstanceMatrix*vVertex).xyz;\n"
     "\n"
     "    finalTexCoord = vTexCoord;\n"
     "}\n";
@@ -52,10 +64,54 @@ char gDefaultFragShader[] =
     "    fragColor += texture(vHUDMap, vec2(finalTexCoord.s, finalTexCoord.t*lHUDScale));\n"
     "}\n";
 
+// Depth only, for the pre-pass
+char gDepthFragShader[] =
+    "#version 150 core\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "}\n";
+
+/*************/
+// Separately linked programs only compute the same depth if gl_Position is invariant,
+// which the depth pre-pass relies on. Only added while it is enabled, as it can limit the optimizations
+// of the compiler. Stages redeclaring gl_PerVertex are left as they are
+string addInvariantPosition(const string& source)
+{
+    size_t lVersion = source.find("#version");
+    if (lVersion == string::npos || source.find("gl_Position") == string::npos
+        || source.find("gl_PerVertex") != string::npos || source.find("invariant gl_Position") != string::npos)
+        return source;
+    // After the extension directives, which come before anything else
+    size_t lExtension = source.rfind("#extension");
+    size_t lInsert = source.find('\n', lExtension != string::npos && lExtension > lVersion ? lExtension : lVersion);
+    if (lInsert == string::npos)
+        return source;
+    lInsert++;
+
+    // Errors keep pointing to the lines of the file
+    int lLine = count(source.begin(), source.begin() + lInsert, '\n') + 1;
+    return source.substr(0, lInsert) + "invariant gl_Position;\n#line " + to_string(lLine) + "\n" + source.substr(lInsert);
+}
+
+/*************/
+// For the programs built next to the main one, whose failure only disables what they draw
+bool isLinked(GLuint program, const string& name)
+{
+    GLint lStatus;
+    glGetProgramiv(program, GL_LINK_STATUS, &lStatus);
+    if (lStatus)
+        return true;
+
+    GLchar lLog[1024];
+    glGetProgramInfoLog(program, sizeof(lLog), nullptr, lLog);
+    cerr << "Failed to link the " << name << " program." << endl << lLog << endl;
+    return false;
+}
+
 /*************/
 shaderomatic::shaderomatic()
     :mIsRunning(false),
-      mShaderValid(false),
       mTimePerFrame(0.f),
       mSwapInterval(1),
       mWindowWidth(640),
@@ -63,53 +119,143 @@ shaderomatic::shaderomatic()
 {
     // Nom de fichiers par défaut
     mImageFile = "texture.png";
-    mVertexFile = "shader.vert";
-    mGeometryFile = "shader.geom";
-    mFragmentFile = "shader.frag";
+    mShaderFile = "shader";
 
     // On initialise la texture pour le HUD
     mHUD = cv::Mat::zeros(32, 640, CV_8UC3);
 }
 
 /*************/
-void shaderomatic::glMsgCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void*)
+// Callbacks run on the event thread, and only update mControls
+void shaderomatic::scrollCallback(GLFWwindow* win, double x, double y)
+{
+    shaderomatic* lApp = (shaderomatic*)glfwGetWindowUserPointer(win);
+    lApp->mControls.scroll += y;
+}
+
+/*************/
+void shaderomatic::cursorCallback(GLFWwindow* win, double x, double y)
+{
+    shaderomatic* lApp = (shaderomatic*)glfwGetWindowUserPointer(win);
+    lApp->mControls.cursor[0] = x;
+    lApp->mControls.cursor[1] = y;
+}
+
+/*************/
+void shaderomatic::keyCallback(GLFWwindow* win, int key, int scancode, int action, int mods)
 {
-    string typeString {""};
-    switch (type)
+    if (action != GLFW_PRESS)
+        return;
+
+    InputState& lControls = ((shaderomatic*)glfwGetWindowUserPointer(win))->mControls;
+    switch (key)
     {
-    case GL_DEBUG_TYPE_ERROR:
-        typeString = "Error";
+    case GLFW_KEY_ESCAPE:
+        lControls.quit = true;
+        break;
+    case GLFW_KEY_W:
+        lControls.wireframe = !lControls.wireframe;
+        break;
+    // Instance count, doubled or halved to find where the shader stops scaling
+    case GLFW_KEY_UP:
+        lControls.instances = min(1 << 24, lControls.instances * 2);
+        cout << "Instances: " << lControls.instances << endl;
+        break;
+    case GLFW_KEY_DOWN:
+        lControls.instances = max(1, lControls.instances / 2);
+        cout << "Instances: " << lControls.instances << endl;
         break;
-    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:
-        typeString = "Deprecated behavior";
+    case GLFW_KEY_C:
+        lControls.chunkCulling = !lControls.chunkCulling;
+        cout << "Chunk culling " << (lControls.chunkCulling ? "enabled" : "disabled") << endl;
         break;
-    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:
-        typeString = "Undefined behavior";
+    case GLFW_KEY_G:
+        lControls.gpuCullingMode = (lControls.gpuCullingMode + 1) % 3;
+        cout << "GPU culling: " << (lControls.gpuCullingMode == 0 ? "disabled" : lControls.gpuCullingMode == 1 ? "view" : "view and occlusion") << endl;
         break;
-    case GL_DEBUG_TYPE_PORTABILITY:
-        typeString = "Portability";
+    case GLFW_KEY_F:
+        lControls.feedbackCaching = !lControls.feedbackCaching;
+        cout << "Transform feedback cache " << (lControls.feedbackCaching ? "enabled" : "disabled") << endl;
         break;
-    case GL_DEBUG_TYPE_PERFORMANCE:
-        typeString = "Performance";
+    case GLFW_KEY_P:
+        lControls.depthPrepass = !lControls.depthPrepass;
+        cout << "Depth pre-pass " << (lControls.depthPrepass ? "enabled" : "disabled") << endl;
         break;
-    case GL_DEBUG_TYPE_OTHER:
-        typeString = "Other";
+    case GLFW_KEY_O:
+        lControls.overdrawMode = (lControls.overdrawMode + 1) % 3;
+        cout << "Overdraw view: " << (lControls.overdrawMode == 0 ? "disabled" : lControls.overdrawMode == 1 ? "fragments" : "quad invocations") << endl;
         break;
+    case GLFW_KEY_T:
+        lControls.traceRequests++;
+        break;
+    // Sections of the HUD, as they do not all fit on its line
+    case GLFW_KEY_H:
+    {
+        static const char* lPages[] {"frame", "passes", "GPU memory", "GL calls"};
+        lControls.hudPage = (lControls.hudPage + 1) % 4;
+        cout << "HUD: " << lPages[lControls.hudPage] << endl;
+        break;
+    }
     }
+}
 
-    cout << "GL::debug - [" << typeString << "] - " << message << endl; 
+/*************/
+void shaderomatic::windowSizeCallback(GLFWwindow* win, int width, int height)
+{
+    shaderomatic* lApp = (shaderomatic*)glfwGetWindowUserPointer(win);
+    // A record holds a single resolution, the rendering keeps it if the window is resized anyway
+    if (lApp->mRecordFile != "")
+        return;
+    lApp->mControls.width = width;
+    lApp->mControls.height = height;
 }
 
 /*************/
-std::atomic<double> shaderomatic::mScrollValue {0.0};
-void shaderomatic::scrollCallback(GLFWwindow* win, double x, double y)
+void shaderomatic::windowRefreshCallback(GLFWwindow* win)
+{
+    shaderomatic* lApp = (shaderomatic*)glfwGetWindowUserPointer(win);
+    lApp->mControls.refreshes++;
+}
+
+/*************/
+std::atomic<bool> shaderomatic::mTraceRequested {false};
+void shaderomatic::traceSignalHandler(int)
 {
-    mScrollValue = mScrollValue + y;
+    mTraceRequested = true;
 }
 
 /*************/
 void shaderomatic::init()
 {
+    mStartup.start();
+
+    // Tracing, dumped with T, SIGUSR1, or at exit
+    if (mTraceFile != "")
+    {
+        Profiler::setEnabled(true);
+        Profiler::setThreadName(mBenchmarkFrames > 0 || mReplayFile != "" ? "render" : "events");
+    }
+
+    // Files are parsed and decoded on their own threads while the window and the context are created
+    MeshData lMesh;
+    ImageLoader::Upload lImage;
+    future<bool> lMeshReady = async(launch::async, [&]() {
+        StartupTimeline::Step lStep(mStartup, "read mesh");
+        return readObjectFile(lMesh);
+    });
+    future<bool> lImageReady;
+    if (!mVirtualTexturing)
+        lImageReady = async(launch::async, [&]() {
+            StartupTimeline::Step lStep(mStartup, "read image");
+            return readImage(mImageFile.c_str(), lImage);
+        });
+    future<map<string, string>> lSourcesReady = async(launch::async, [&]() {
+        StartupTimeline::Step lStep(mStartup, "read shaders");
+        return preloadShaders();
+    });
+
+    std::chrono::steady_clock::time_point lContextStart = std::chrono::steady_clock::now();
+
     // On prépare OpenGL
     if(!glfwInit())
     {
@@ -118,6 +264,17 @@ void shaderomatic::init()
         exit(EXIT_FAILURE);
     }
 
+    // Replays run at the recorded resolution
+    if (mReplayFile != "")
+    {
+        if (!mReplay.load(mReplayFile))
+        {
+            glfwTerminate();
+            exit(EXIT_FAILURE);
+        }
+        setResolution(mReplay.getWidth(), mReplay.getHeight());
+    }
+
     settings();
     mGlfwWindow = glfwCreateWindow(mWindowWidth, mWindowHeight, "shader-0-matic", nullptr, nullptr);
     if(mGlfwWindow == nullptr)
@@ -129,640 +286,1929 @@ void shaderomatic::init()
 
     glfwMakeContextCurrent(mGlfwWindow);
     glfwSwapInterval(mSwapInterval);
+    GLState::invalidate();
 
-    glDebugMessageCallback(shaderomatic::glMsgCallback, nullptr);
+    // Messages are printed by a thread of their own, the driver only queues them
+    mDebugLog.start();
+    glDebugMessageCallback(DebugLog::callback, &mDebugLog);
     glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_MEDIUM, 0, nullptr, GL_TRUE);
     glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_HIGH, 0, nullptr, GL_TRUE);
 
-    // Scroll callback
+    // Variants of the programs with their stable uniforms frozen are compiled on a context of their own
+    if (mSpecializeDraws > 0)
+        mSpecializer.start(mGlfwWindow, mSpecializeDraws);
+
+    // Input callbacks, which fill mControls
+    glfwSetWindowUserPointer(mGlfwWindow, this);
     glfwSetScrollCallback(mGlfwWindow, shaderomatic::scrollCallback);
+    glfwSetCursorPosCallback(mGlfwWindow, shaderomatic::cursorCallback);
+    glfwSetKeyCallback(mGlfwWindow, shaderomatic::keyCallback);
+    glfwSetWindowSizeCallback(mGlfwWindow, shaderomatic::windowSizeCallback);
+    glfwSetWindowRefreshCallback(mGlfwWindow, shaderomatic::windowRefreshCallback);
 
-    glClearColor(0.f, 0.f, 0.f, 1.f);
+    if (mTraceFile != "")
+    {
+        Profiler::calibrate();
+        signal(SIGUSR1, shaderomatic::traceSignalHandler);
+    }
 
-    // Init shaders
-    shaderChanged();
+    glClearColor(0.f, 0.f, 0.f, 1.f);
 
     // Setup geometry (a plane!)
     if (!prepareScreenGeometry())
         return;
-    if (!prepareObjectGeometry())
-        return;
     prepareTexture();
 
     glfwGetWindowSize(mGlfwWindow, &mWindowWidth, &mWindowHeight);
-    glViewport(0, 0, mWindowWidth, mWindowHeight);
-
-    // Setup FBO
-    prepareFBO();
-
-    // Shader compilation
-    mShaderValid = compileShader();
-
-    mClockStart = steady_clock::now();
-    steady_clock::time_point lTimerFPS;
+    GLState::viewport(0, 0, mWindowWidth, mWindowHeight);
+    mStartup.add("create context", lContextStart, std::chrono::steady_clock::now());
 
-    // Main loop
-    mIsRunning = true;
-    while(mIsRunning)
+    // Shaders reading it need the virtual texture to be there when they are compiled
+    if (mVirtualTexturing)
     {
-        glfwPollEvents();
-        lTimerFPS = steady_clock::now();
-
-        int lWidth, lHeight;
-        glfwGetWindowSize(mGlfwWindow, &lWidth, &lHeight);
-        if(lWidth != mWindowWidth || lHeight != mWindowHeight)
+        StartupTimeline::Step lStep(mStartup, "load virtual texture");
+        if (loadVirtualTexture(mTexture[0]))
+            cout << "Virtual texture ready, read with vtTexture" << endl;
+        else
         {
-            mWindowWidth = lWidth;
-            mWindowHeight = lHeight;
-            glViewport(0, 0, lWidth, lHeight);
-
-            mHUD = cv::Mat::zeros(32, lWidth, CV_8UC3);
-            prepareHUDTexture();
-
-            glBindTexture(GL_TEXTURE_2D, mFBOTexture[0]);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, lWidth, lHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-            glBindTexture(GL_TEXTURE_2D, mFBOTexture[1]);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, lWidth, lHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-            glBindTexture(GL_TEXTURE_2D, mFBODepthTexture);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, lWidth, lHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+            ImageLoader::Upload lFallback;
+            readImage(mImageFile.c_str(), lFallback);
+            uploadImage(lFallback, mTexture[0]);
         }
+    }
 
-        draw();
-        static bool isWPressed = false;
-        if(glfwGetKey(mGlfwWindow, GLFW_KEY_ESCAPE))
-        {
-            mIsRunning = false;
-        }
-        else if (int state = glfwGetKey(mGlfwWindow, GLFW_KEY_W))
+    // Uploads and compilations are issued as soon as their input is ready, whatever the order
+    bool lMeshDone = false;
+    bool lImageDone = !lImageReady.valid();
+    bool lShadersDone = false;
+    while (!lMeshDone || !lImageDone || !lShadersDone)
+    {
+        bool lProgress = false;
+        if (!lMeshDone && lMeshReady.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
         {
-            if (state == GLFW_PRESS && !isWPressed)
+            if (!lMeshReady.get())
             {
-                mWireframe = !mWireframe;
-                isWPressed = true;
+                cout << "Unable to load object file " << mObjectFile << endl;
+                return;
             }
+            StartupTimeline::Step lStep(mStartup, "upload mesh");
+            prepareObjectGeometry(lMesh);
+            prepareInstances();
+            lMeshDone = lProgress = true;
         }
-        else
+        if (!lImageDone && lImageReady.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            if (lImageReady.get())
+                mImageChange = boost::filesystem::last_write_time(mImageFile.c_str());
+            StartupTimeline::Step lStep(mStartup, "upload image");
+            uploadImage(lImage, mTexture[0]);
+            lImageDone = lProgress = true;
+        }
+        if (!lShadersDone && lSourcesReady.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
         {
-            isWPressed = false;
+            // Setup the render passes, and compile the shaders they use
+            mPreloadedSources = lSourcesReady.get();
+            StartupTimeline::Step lStep(mStartup, "compile shaders");
+            prepareRenderGraph();
+            mPreloadedSources.clear();
+            lShadersDone = lProgress = true;
         }
+        if (!lProgress)
+            this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
 
-        mTimePerFrame = duration<float>((steady_clock::now() - lTimerFPS)).count();
+    if (mBenchmarkFrames > 0 || mReplayFile != "")
+    {
+        bool lSuccess = true;
+        if (mBenchmarkFrames > 0)
+            lSuccess = runBenchmark();
+        else
+            runReplay();
+        if (mTraceFile != "")
+            Profiler::dump(mTraceFile);
+        release();
+        glfwMakeContextCurrent(nullptr);
+        glfwTerminate();
+        exit(lSuccess ? EXIT_SUCCESS : EXIT_FAILURE);
     }
 
+    // Events and file checks stay on this thread, rendering gets its own
+    mControls.width = mWindowWidth;
+    mControls.height = mWindowHeight;
+    mControls.wireframe = mWireframe;
+    mControls.instances = mInstances;
+    mControls.chunkCulling = mChunkCulling;
+    mControls.gpuCullingMode = mGpuCullingMode;
+    mControls.feedbackCaching = mFeedbackCaching;
+    mControls.depthPrepass = mDepthPrepass;
+    mControls.overdrawMode = mOverdrawMode;
+    glfwGetCursorPos(mGlfwWindow, &mControls.cursor[0], &mControls.cursor[1]);
+    mInput = mControls;
+    mFileWatcher.setFiles(getWatchedFiles());
+    mRecord.setResolution(mWindowWidth, mWindowHeight);
+
+    mControlName.reserve(sizeof(ControlMessage::name));
+    if (mControlAddress != "")
+        mControlChannel.start(mControlAddress, [&]() {wakeRenderer();});
+
     glfwMakeContextCurrent(nullptr);
+    mIsRunning = true;
+    thread lRenderThread(&shaderomatic::renderLoop, this);
+    eventLoop();
+    lRenderThread.join();
+    mControlChannel.stop();
+
+    if (mRecordFile != "")
+        mRecord.save(mRecordFile);
+    if (mTraceFile != "")
+        Profiler::dump(mTraceFile);
+
+    glfwMakeContextCurrent(mGlfwWindow);
+    release();
     glfwTerminate();
     exit(EXIT_SUCCESS);
 }
 
 /*************/
-void shaderomatic::settings()
+void shaderomatic::release()
 {
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, true);
+    glDebugMessageCallback(nullptr, nullptr);
+    mDebugLog.stop();
+    mSpecializer.stop();
+
+    // Everything owned is deleted while the context is still there, what remains has leaked
+    mShaders.clear();
+    mFeedbackCaches.clear();
+    mGpuCulling.release();
+    mOverdrawView.release();
+    mVirtualTexture.release();
+    mRenderGraph.release();
+
+    mScreenVertexArray.reset();
+    mObjectVertexArray.reset();
+    mDepthVertexArray.reset();
+    for (int i = 0; i < 2; ++i)
+    {
+        mScreenVertexBuffer[i].reset();
+        mObjectVertexBuffer[i].reset();
+        mTexture[i].reset();
+    }
+    mInstanceBuffer.reset();
+    mDepthFragmentShader.reset();
+
+    GLRegistry::reportLeaks();
 }
 
 /*************/
-void shaderomatic::setShaderFile(string file)
+void shaderomatic::eventLoop()
 {
-    mVertexFile = file;
-    mVertexFile += ".vert";
-
-    mTessControlFile = file;
-    mTessControlFile += ".tcs";
-    
-    mTessEvalFile = file;
-    mTessEvalFile += ".tes";
+    steady_clock::time_point lLastCheck = steady_clock::now();
+    while (mIsRunning)
+    {
+        // Wakes up as soon as an event arrives, or to check the files
+        {
+            ProfileScope lScope("wait events");
+            glfwWaitEventsTimeout(0.25);
+        }
 
-    mGeometryFile = file;
-    mGeometryFile += ".geom";
+        // Files are only watched here, the render thread reloads them when told to
+        if (duration<float>(steady_clock::now() - lLastCheck).count() >= 0.25f)
+        {
+            ProfileScope lScope("check files");
+            if (mFileWatcher.changed())
+                mControls.fileChanges++;
+            lLastCheck = steady_clock::now();
+        }
 
-    mFragmentFile = file;
-    mFragmentFile += ".frag";
+        mControls.quit |= (glfwWindowShouldClose(mGlfwWindow) != 0);
+        publishInput();
+        if (mControls.quit)
+            mIsRunning = false;
+    }
 }
 
 /*************/
-void shaderomatic::setResolution(const int pWidth, const int pHeight)
+void shaderomatic::publishInput()
 {
-    mWindowWidth = max(64, pWidth);
-    mWindowHeight = max(48, pHeight);
+    mInputSnapshot.write(mControls);
+    wakeRenderer();
 }
 
 /*************/
-void shaderomatic::setSwapInterval(int pSwap)
+void shaderomatic::wakeRenderer()
 {
-    mSwapInterval = std::max(0, pSwap);
+    lock_guard<mutex> lLock(mWakeMutex);
+    mInputPublished = true;
+    mWakeCondition.notify_one();
 }
 
-/********************************/
-bool shaderomatic::prepareScreenGeometry()
+/*************/
+void shaderomatic::renderLoop()
 {
-    GLfloat lPoints[] = {-1.f, -1.f, 0.f, 1.f,
-                         -1.f, 1.f, 0.f, 1.f,
-                         1.f, 1.f, 0.f, 1.f,
-                         1.f, 1.f, 0.f, 1.f,
-                         1.f, -1.f, 0.f, 1.f,
-                         -1.f, -1.f, 0.f, 1.f};
+    glfwMakeContextCurrent(mGlfwWindow);
+    if (mTraceFile != "")
+        Profiler::setThreadName("render");
 
-    GLfloat lTex[] = {0.f, 0.f,
-                      0.f, 1.f,
-                      1.f, 1.f,
-                      1.f, 1.f,
-                      1.f, 0.f,
-                      0.f, 0.f};
+    mClockStart = steady_clock::now();
+    steady_clock::time_point lTimerFPS;
+    steady_clock::time_point lTimerSteps = mClockStart;
+    unsigned long lStepCount = 0;
 
-    glGenVertexArrays(1, &mScreenVertexArray);
-    glBindVertexArray(mScreenVertexArray);
+    InputState lPrevious = mInput;
+    bool lRedraw = true;
+    while (mIsRunning)
+    {
+        ProfileScope lFrameScope("frame");
 
-    glGenBuffers(2, mScreenVertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, mScreenVertexBuffer[0]);
-    glBufferData(GL_ARRAY_BUFFER, 6*4*sizeof(float), lPoints, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(0);
+        // Latest input state, read once per frame
+        mInputSnapshot.read(mInput);
+        if (mInput.quit)
+            break;
 
-    glBindBuffer(GL_ARRAY_BUFFER, mScreenVertexBuffer[1]);
-    glBufferData(GL_ARRAY_BUFFER, 6*2*sizeof(float), lTex, GL_STATIC_DRAW);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(1);
+        if (mInput.fileChanges != lPrevious.fileChanges && checkFiles())
+        {
+            mFileWatcher.setFiles(getWatchedFiles());
+            lRedraw = true;
+        }
+        lRedraw |= applyControls(lPrevious);
+        lRedraw |= applyControlValues();
 
-    return true;
+        if ((mInput.traceRequests != lPrevious.traceRequests || mTraceRequested) && mTraceFile != "")
+        {
+            Profiler::calibrate();
+            Profiler::dump(mTraceFile);
+        }
+        mTraceRequested = false;
+
+        // When rendering on demand, only inputs used by the shaders need a redraw
+        bool lAnimated, lUsesMouse, lUsesScroll;
+        getUsedInputs(lAnimated, lUsesMouse, lUsesScroll);
+        lRedraw |= !mOnDemand || lAnimated;
+        lRedraw |= lUsesMouse && (mInput.cursor[0] != lPrevious.cursor[0] || mInput.cursor[1] != lPrevious.cursor[1]);
+        lRedraw |= lUsesScroll && mInput.scroll != lPrevious.scroll;
+        lRedraw |= mInput.width != lPrevious.width || mInput.height != lPrevious.height || mInput.refreshes != lPrevious.refreshes;
+        lRedraw |= mInput.hudPage != lPrevious.hudPage;
+        lRedraw |= mRenderGraph.update();
+        lRedraw |= mVirtualTexture.isStreaming();
+        lPrevious = mInput;
+
+        if (!lRedraw)
+        {
+            ProfileScope lScope("wait input");
+            unique_lock<mutex> lLock(mWakeMutex);
+            mWakeCondition.wait_for(lLock, std::chrono::milliseconds(250), [&]() {return mInputPublished;});
+            mInputPublished = false;
+            continue;
+        }
+        lRedraw = false;
+        lTimerFPS = steady_clock::now();
+
+        if((mInput.width != mWindowWidth || mInput.height != mWindowHeight) && mInput.width > 0 && mInput.height > 0)
+        {
+            ProfileScope lScope("resize");
+            mWindowWidth = mInput.width;
+            mWindowHeight = mInput.height;
+            GLState::viewport(0, 0, mWindowWidth, mWindowHeight);
+
+            mHUD = cv::Mat::zeros(32, mWindowWidth, CV_8UC3);
+            prepareHUDTexture();
+
+            mRenderGraph.resize(mWindowWidth, mWindowHeight);
+        }
+
+        draw();
+
+        mTimePerFrame = duration<float>((steady_clock::now() - lTimerFPS)).count();
+
+        // Simulation throughput, averaged over a second
+        float lStepsDuration = duration<float>(steady_clock::now() - lTimerSteps).count();
+        if (lStepsDuration >= 1.f)
+        {
+            mStepsPerSecond = (float)(mStepCount - lStepCount) / lStepsDuration;
+            lStepCount = mStepCount;
+            lTimerSteps = steady_clock::now();
+        }
+    }
+
+    mIsRunning = false;
+    glfwPostEmptyEvent();
+    glfwMakeContextCurrent(nullptr);
 }
 
-/********************************/
-bool shaderomatic::prepareObjectGeometry()
+/*************/
+bool shaderomatic::applyControlValues()
 {
-    if (mObjectFile != "")
+    if (!mControlChannel.isStarted())
+        return false;
+
+    // Only the latest value of each uniform is kept
+    ControlMessage lMessage;
     {
-        Loader::Obj loader;
-        if (!loader.load(mObjectFile))
+        ProfileScope lScope("read controls");
+        while (mControlChannel.pop(lMessage))
         {
-            cout << "Unable to load object file " << mObjectFile << endl;
-            return false;
+            mControlName.assign(lMessage.name, strnlen(lMessage.name, sizeof(lMessage.name)));
+            ControlValue& lValue = mControlValues[mControlName];
+            copy(lMessage.values, lMessage.values + 4, lValue.values);
+            lValue.count = lMessage.count;
+            lValue.serial = ++mControlSerial;
         }
+    }
 
-        vector<glm::vec4> vertices = loader.getVertices();
-        vector<glm::vec2> texCoords = loader.getUVs();
-
-        vector<float> verticesBuffer;
-        vector<float> texCoordsBuffer;
-
-        for (auto& v : vertices)
+    // Values are set once per frame, and again on the programs linked since
+    bool lApplied = false;
+    for (auto& shader : mRenderGraph.getShaders())
+    {
+        ShaderSet& lShader = getShader(shader);
+        if (!lShader.valid)
+            continue;
+        for (auto& uniform : lShader.userUniforms)
         {
-            verticesBuffer.push_back(v[0]);
-            verticesBuffer.push_back(v[1]);
-            verticesBuffer.push_back(v[2]);
-            verticesBuffer.push_back(v[3]);
+            auto lValueIt = mControlValues.find(uniform.name);
+            if (lValueIt == mControlValues.end() || lValueIt->second.serial == uniform.applied)
+                continue;
+
+            const ControlValue& lValue = lValueIt->second;
+            GLint lInts[4];
+            for (int i = 0; i < 4; ++i)
+                lInts[i] = (GLint)lValue.values[i];
+            switch (uniform.type)
+            {
+            case GL_FLOAT:
+                glProgramUniform1fv(uniform.program, uniform.location, 1, lValue.values);
+                break;
+            case GL_FLOAT_VEC2:
+                glProgramUniform2fv(uniform.program, uniform.location, 1, lValue.values);
+                break;
+            case GL_FLOAT_VEC3:
+                glProgramUniform3fv(uniform.program, uniform.location, 1, lValue.values);
+                break;
+            case GL_FLOAT_VEC4:
+                glProgramUniform4fv(uniform.program, uniform.location, 1, lValue.values);
+                break;
+            case GL_INT:
+            case GL_BOOL:
+                glProgramUniform1iv(uniform.program, uniform.location, 1, lInts);
+                break;
+            case GL_INT_VEC2:
+                glProgramUniform2iv(uniform.program, uniform.location, 1, lInts);
+                break;
+            case GL_INT_VEC3:
+                glProgramUniform3iv(uniform.program, uniform.location, 1, lInts);
+                break;
+            case GL_INT_VEC4:
+                glProgramUniform4iv(uniform.program, uniform.location, 1, lInts);
+                break;
+            }
+            uniform.applied = lValue.serial;
+            lApplied = true;
         }
+    }
+
+    return lApplied;
+}
 
-        for (auto& t : texCoords)
+/*************/
+bool shaderomatic::applyControls(const InputState& previous)
+{
+    bool lChanged = false;
+    if (mInput.wireframe != previous.wireframe)
+    {
+        mWireframe = mInput.wireframe;
+        lChanged = true;
+    }
+    if (mInput.instances != previous.instances)
+    {
+        mInstances = mInput.instances;
+        prepareInstances();
+        lChanged = true;
+    }
+    if (mInput.chunkCulling != previous.chunkCulling)
+    {
+        mChunkCulling = mInput.chunkCulling;
+        lChanged = true;
+    }
+    if (mInput.gpuCullingMode != previous.gpuCullingMode)
+    {
+        mGpuCullingMode = mInput.gpuCullingMode;
+        lChanged = true;
+    }
+    if (mInput.feedbackCaching != previous.feedbackCaching)
+    {
+        mFeedbackCaching = mInput.feedbackCaching;
+        for (auto& shader : mRenderGraph.getShaders())
+            if (getShader(shader).valid)
+                prepareFeedbackPrograms(getShader(shader));
+        if (!mFeedbackCaching)
+            mFeedbackCaches.clear();
+        lChanged = true;
+    }
+    if (mInput.depthPrepass != previous.depthPrepass)
+    {
+        mDepthPrepass = mInput.depthPrepass;
+        // Compiled again to add or remove the invariance of gl_Position, which also builds the depth programs
+        for (auto& shader : mRenderGraph.getShaders())
         {
-            texCoordsBuffer.push_back(t[0]);
-            texCoordsBuffer.push_back(t[1]);
+            ShaderSet& lShader = getShader(shader);
+            lShader.valid = compileShader(lShader);
         }
+        updateTargetUsage();
+        lChanged = true;
+    }
+    if (mInput.overdrawMode != previous.overdrawMode)
+    {
+        mOverdrawMode = mInput.overdrawMode;
+        for (auto& shader : mRenderGraph.getShaders())
+            if (getShader(shader).valid)
+                prepareOverdrawProgram(getShader(shader));
+        for (auto pass : mRenderGraph.getPasses())
+            pass->program = 0;
+        lChanged = true;
+    }
+    return lChanged;
+}
 
-        mObjectVertexNumber = verticesBuffer.size() / 4;
+/*************/
+void shaderomatic::settings()
+{
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, true);
 
-        glGenVertexArrays(1, &mObjectVertexArray);
-        glBindVertexArray(mObjectVertexArray);
+    // Benchmarks, replays and records run at a fixed resolution
+    if (mBenchmarkFrames > 0 || mReplayFile != "" || mRecordFile != "")
+        glfwWindowHint(GLFW_RESIZABLE, false);
+    if (mHeadless)
+        glfwWindowHint(GLFW_VISIBLE, false);
+}
 
-        glGenBuffers(2, mObjectVertexBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, mObjectVertexBuffer[0]);
-        glBufferData(GL_ARRAY_BUFFER, verticesBuffer.size() * sizeof(float), verticesBuffer.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(0);
+/*************/
+void shaderomatic::setBenchmark(int frames, int warmup, string output)
+{
+    mBenchmarkFrames = max(0, frames);
+    mBenchmarkWarmup = max(0, warmup);
+    mBenchmarkOutput = output;
+}
 
-        glBindBuffer(GL_ARRAY_BUFFER, mObjectVertexBuffer[1]);
-        glBufferData(GL_ARRAY_BUFFER, texCoordsBuffer.size() * sizeof(float), texCoordsBuffer.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(1);
+/*************/
+bool shaderomatic::runBenchmark()
+{
+    // No vsync, we want the actual cost of the frames
+    glfwSwapInterval(0);
 
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+    vector<Benchmark> lResults;
+    lResults.push_back(benchmarkShader());
+    if (mCompareShaderFile != "")
+    {
+        mShaderFile = mCompareShaderFile;
+        prepareRenderGraph();
+        lResults.push_back(benchmarkShader());
+    }
 
-        cout << "Object file " << mObjectFile << " successfully loader." << endl;
+    // A shader which failed to compile, or a run interrupted before the end of the warmup, has nothing to compare
+    bool lComplete = true;
+    for (auto& result : lResults)
+    {
+        result.print(cout);
+        if (result.getCpuStats().count == 0)
+        {
+            cerr << "No frame measured for " << result.getName() << endl;
+            lComplete = false;
+        }
     }
-    else
+
+    double lCpuDiff, lCpuInterval, lGpuDiff, lGpuInterval;
+    if (lResults.size() == 2 && lComplete)
     {
-        cout << "Loading default model: a plane." << endl;
+        Benchmark::compare(lResults[0].getCpuStats(), lResults[1].getCpuStats(), lCpuDiff, lCpuInterval);
+        Benchmark::compare(lResults[0].getGpuStats(), lResults[1].getGpuStats(), lGpuDiff, lGpuInterval);
+        cout << lResults[1].getName() << " compared to " << lResults[0].getName() << ":" << endl;
+        cout << "  CPU: " << lCpuDiff * 100.0 << "% (+/- " << lCpuInterval * 100.0 << "%, 95% confidence)" << endl;
+        cout << "  GPU: " << lGpuDiff * 100.0 << "% (+/- " << lGpuInterval * 100.0 << "%, 95% confidence)" << endl;
+    }
 
-        GLfloat lPoints[] = {-1.f, -1.f, 0.f, 1.f,
-                             -1.f, 1.f, 0.f, 1.f,
-                             1.f, 1.f, 0.f, 1.f,
-                             1.f, 1.f, 0.f, 1.f,
-                             1.f, -1.f, 0.f, 1.f,
-                             -1.f, -1.f, 0.f, 1.f};
+    ofstream lFile(mBenchmarkOutput, ios::out);
+    if (!lFile.is_open())
+    {
+        cerr << "Unable to write benchmark results to " << mBenchmarkOutput << endl;
+        return false;
+    }
 
-        GLfloat lTex[] = {0.f, 0.f,
-                          0.f, 1.f,
-                          1.f, 1.f,
-                          1.f, 1.f,
-                          1.f, 0.f,
-                          0.f, 0.f};
+    lFile << "{" << endl;
+    lFile << "    \"resolution\": [" << mWindowWidth << ", " << mWindowHeight << "]," << endl;
+    lFile << "    \"warmup\": " << mBenchmarkWarmup << "," << endl;
+    lFile << "    \"runs\": [" << endl;
+    for (int i = 0; i < lResults.size(); ++i)
+    {
+        lResults[i].writeJson(lFile, "        ");
+        lFile << (i < lResults.size() - 1 ? "," : "") << endl;
+    }
+    lFile << "    ]";
+    if (lResults.size() == 2 && lComplete)
+    {
+        lFile << "," << endl;
+        lFile << "    \"comparison\": {"
+              << "\"cpu_relative\": " << lCpuDiff << ", \"cpu_interval95\": " << lCpuInterval << ", "
+              << "\"gpu_relative\": " << lGpuDiff << ", \"gpu_interval95\": " << lGpuInterval << "}";
+    }
+    lFile << endl << "}" << endl;
+    cout << "Benchmark results written to " << mBenchmarkOutput << endl;
+    return lComplete;
+}
 
-        mObjectVertexNumber = 6;
+/*************/
+Benchmark shaderomatic::benchmarkShader()
+{
+    Benchmark lBenchmark(mShaderFile);
+    for (auto& shader : mRenderGraph.getShaders())
+    {
+        if (!getShader(shader).valid)
+        {
+            cerr << "Shader " << mShaderFile << " is not valid, skipping its benchmark." << endl;
+            return lBenchmark;
+        }
+    }
 
-        glGenVertexArrays(1, &mObjectVertexArray);
-        glBindVertexArray(mObjectVertexArray);
+    cout << "Benchmarking " << mShaderFile << ": " << mBenchmarkWarmup << " warmup frames, then " << mBenchmarkFrames << " frames" << endl;
 
-        glGenBuffers(2, mObjectVertexBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, mObjectVertexBuffer[0]);
-        glBufferData(GL_ARRAY_BUFFER, 6*4*sizeof(float), lPoints, GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(0);
+    GpuTimer lTimer;
+    vector<GpuSpan> lSpans;
+    auto addGpuSpans = [&]() {
+        for (auto& span : lSpans)
+            if (span.frame >= mBenchmarkWarmup)
+                lBenchmark.addGpuTime(span.duration());
+    };
+
+    // With a replay, every shader gets the same inputs, looping over the recorded frames
+    auto& lReplayFrames = mReplay.getFrames();
+    mClockStart = steady_clock::now();
+    for (int frame = 0; frame < mBenchmarkWarmup + mBenchmarkFrames; ++frame)
+    {
+        glfwPollEvents();
+        if (glfwGetKey(mGlfwWindow, GLFW_KEY_ESCAPE))
+            break;
+
+        if (lReplayFrames.size() > 0)
+        {
+            mReplayIndex = frame % lReplayFrames.size();
+            mReplayFrame = &lReplayFrames[mReplayIndex];
+        }
+
+        steady_clock::time_point lStart = steady_clock::now();
+        lTimer.begin(frame);
+        draw();
+        lTimer.end();
+        mTimePerFrame = duration<float>(steady_clock::now() - lStart).count();
+
+        if (frame >= mBenchmarkWarmup)
+        {
+            lBenchmark.addCpuTime(mTimePerFrame * 1000.0);
+            for (int c = 0; c < GLState::CategoryCount; ++c)
+                lBenchmark.addGlCalls(GLState::getName((GLState::Category)c), GLState::getCalls((GLState::Category)c));
+            lBenchmark.addGlCalls("skipped", GLState::getTotalElided());
+        }
+        lTimer.collect(lSpans);
+        addGpuSpans();
+    }
+    lTimer.flush(lSpans);
+    addGpuSpans();
+    mReplayFrame = nullptr;
+
+    return lBenchmark;
+}
 
-        glBindBuffer(GL_ARRAY_BUFFER, mObjectVertexBuffer[1]);
-        glBufferData(GL_ARRAY_BUFFER, 6*2*sizeof(float), lTex, GL_STATIC_DRAW);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(1);
+/*************/
+void shaderomatic::runReplay()
+{
+    if (mUnthrottled)
+        glfwSwapInterval(0);
+
+    auto& lFrames = mReplay.getFrames();
+    cout << "Replaying " << lFrames.size() << " frames from " << mReplayFile << (mUnthrottled ? ", unthrottled" : "") << endl;
+
+    float lTotal = 0.f;
+    mClockStart = steady_clock::now();
+    for (mReplayIndex = 0; mReplayIndex < lFrames.size(); ++mReplayIndex)
+    {
+        glfwPollEvents();
+        if (glfwGetKey(mGlfwWindow, GLFW_KEY_ESCAPE) || glfwWindowShouldClose(mGlfwWindow))
+            break;
+
+        // Frames are shown when they were recorded, unless running as fast as possible
+        mReplayFrame = &lFrames[mReplayIndex];
+        if (!mUnthrottled)
+        {
+            float lDelay = mReplayFrame->timer - lFrames[0].timer - duration<float>(steady_clock::now() - mClockStart).count();
+            if (lDelay > 0.f)
+                std::this_thread::sleep_for(std::chrono::microseconds((long)(lDelay * 1e6f)));
+        }
+
+        steady_clock::time_point lStart = steady_clock::now();
+        draw();
+        mTimePerFrame = duration<float>(steady_clock::now() - lStart).count();
+        lTotal += mTimePerFrame;
+    }
+    mReplayFrame = nullptr;
+
+    if (mReplayIndex > 0)
+        cout << "Replayed " << mReplayIndex << " frames, " << lTotal * 1000.f / mReplayIndex << " msec per frame on average" << endl;
+}
+
+/*************/
+void shaderomatic::saveFrameImage()
+{
+    cv::Mat lImage(mWindowHeight, mWindowWidth, CV_8UC3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadBuffer(GL_BACK);
+    glReadPixels(0, 0, mWindowWidth, mWindowHeight, GL_BGR, GL_UNSIGNED_BYTE, lImage.data);
+
+    cv::Mat lFlipped;
+    cv::flip(lImage, lFlipped, 0);
+    char lIndex[16];
+    snprintf(lIndex, sizeof(lIndex), "%05i", mReplayIndex);
+    if (!cv::imwrite(mReplayImages + "_" + lIndex + ".png", lFlipped))
+        cerr << "Unable to write " << mReplayImages << "_" << lIndex << ".png" << endl;
+}
+
+/*************/
+void shaderomatic::setShaderFile(string file)
+{
+    mShaderFile = file;
+}
+
+/*************/
+ShaderSet& shaderomatic::getShader(const string& pBase)
+{
+    string lBase = pBase == "" ? mShaderFile : pBase;
+    auto lShaderIt = mShaders.find(lBase);
+    if (lShaderIt != mShaders.end())
+        return lShaderIt->second;
+
+    ShaderSet& lShader = mShaders[lBase];
+    lShader.vertexFile = lBase + ".vert";
+    lShader.tessControlFile = lBase + ".tcs";
+    lShader.tessEvalFile = lBase + ".tes";
+    lShader.geometryFile = lBase + ".geom";
+    lShader.fragmentFile = lBase + ".frag";
+    lShader.computeFile = lBase + ".comp";
+
+    shaderChanged(lShader);
+    lShader.valid = compileShader(lShader);
+    return lShader;
+}
+
+/*************/
+void shaderomatic::setResolution(const int pWidth, const int pHeight)
+{
+    mWindowWidth = max(64, pWidth);
+    mWindowHeight = max(48, pHeight);
+}
+
+/*************/
+void shaderomatic::setFBOFormat(string format)
+{
+    TextureFormat lFormat;
+    if (!RenderGraph::getFormat(format, lFormat) || lFormat.format == GL_DEPTH_COMPONENT)
+        cerr << "Unknown color format " << format << ", using " << mFBOFormat << " instead." << endl;
+    else
+        mFBOFormat = format;
+}
+
+/*************/
+void shaderomatic::setTextureFormat(string format)
+{
+    if (!ImageLoader::isFormat(format))
+        cerr << "Unknown texture format " << format << ", using " << mTextureFormat << " instead." << endl;
+    else
+        mTextureFormat = format;
+}
+
+/*************/
+void shaderomatic::setDepthFormat(string format)
+{
+    TextureFormat lFormat;
+    if (format == "none")
+        mDepthFormat = format;
+    else if (!RenderGraph::getFormat(format, lFormat) || lFormat.format != GL_DEPTH_COMPONENT)
+        cerr << "Unknown depth format " << format << ", using " << mDepthFormat << " instead." << endl;
+    else
+        mDepthFormat = format;
+}
+
+/*************/
+void shaderomatic::setSwapInterval(int pSwap)
+{
+    mSwapInterval = std::max(0, pSwap);
+}
+
+/********************************/
+bool shaderomatic::prepareScreenGeometry()
+{
+    GLfloat lPoints[] = {-1.f, -1.f, 0.f, 1.f,
+                         -1.f, 1.f, 0.f, 1.f,
+                         1.f, 1.f, 0.f, 1.f,
+                         1.f, 1.f, 0.f, 1.f,
+                         1.f, -1.f, 0.f, 1.f,
+                         -1.f, -1.f, 0.f, 1.f};
+
+    GLfloat lTex[] = {0.f, 0.f,
+                      0.f, 1.f,
+                      1.f, 1.f,
+                      1.f, 1.f,
+                      1.f, 0.f,
+                      0.f, 0.f};
+
+    mScreenVertexArray.create("screen quad");
+    GLState::bindVertexArray(mScreenVertexArray);
+
+    mScreenVertexBuffer[0].create("screen quad vertices");
+    mScreenVertexBuffer[1].create("screen quad texture coordinates");
+    glBindBuffer(GL_ARRAY_BUFFER, mScreenVertexBuffer[0]);
+    glBufferData(GL_ARRAY_BUFFER, 6*4*sizeof(float), lPoints, GL_STATIC_DRAW);
+    mScreenVertexBuffer[0].setSize(6*4*sizeof(float));
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mScreenVertexBuffer[1]);
+    glBufferData(GL_ARRAY_BUFFER, 6*2*sizeof(float), lTex, GL_STATIC_DRAW);
+    mScreenVertexBuffer[1].setSize(6*2*sizeof(float));
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(1);
+
+    return true;
+}
+
+/********************************/
+bool shaderomatic::readObjectFile(MeshData& mesh)
+{
+    vector<glm::vec4> vertices;
+    vector<glm::vec2> texCoords;
+
+    if (mObjectFile != "")
+    {
+        Loader::Obj loader;
+        if (!loader.load(mObjectFile))
+            return false;
+
+        vertices = loader.getVertices();
+        texCoords = loader.getUVs();
+
+        // Large meshes are split into chunks, drawn only when in view
+        if (mChunkSize > 0)
+        {
+            steady_clock::time_point lStart = steady_clock::now();
+            mObjectBVH.build(vertices, texCoords, mChunkSize);
+            cout << "Split " << mObjectBVH.getTriangleCount() << " triangles into " << mObjectBVH.getChunkCount() << " chunks in "
+                 << duration<float>(steady_clock::now() - lStart).count() * 1000.f << " msec" << endl;
+        }
+    }
+    else
+    {
+        vertices = {glm::vec4(-1.f, -1.f, 0.f, 1.f), glm::vec4(-1.f, 1.f, 0.f, 1.f), glm::vec4(1.f, 1.f, 0.f, 1.f),
+                    glm::vec4(1.f, 1.f, 0.f, 1.f), glm::vec4(1.f, -1.f, 0.f, 1.f), glm::vec4(-1.f, -1.f, 0.f, 1.f)};
+        texCoords = {glm::vec2(0.f, 0.f), glm::vec2(0.f, 1.f), glm::vec2(1.f, 1.f),
+                     glm::vec2(1.f, 1.f), glm::vec2(1.f, 0.f), glm::vec2(0.f, 0.f)};
+    }
+
+    mesh.vertices.resize(vertices.size() * 4);
+    for (size_t i = 0; i < vertices.size(); ++i)
+        for (int c = 0; c < 4; ++c)
+            mesh.vertices[i * 4 + c] = vertices[i][c];
+
+    mesh.texCoords.resize(texCoords.size() * 2);
+    for (size_t i = 0; i < texCoords.size(); ++i)
+        for (int c = 0; c < 2; ++c)
+            mesh.texCoords[i * 2 + c] = texCoords[i][c];
+
+    return true;
+}
+
+/********************************/
+bool shaderomatic::prepareObjectGeometry(const MeshData& mesh)
+{
+    if (mObjectBVH.getChunkCount() > 0)
+        mGpuCulling.init(mObjectBVH.getChunks());
+
+    mObjectVertexNumber = mesh.vertices.size() / 4;
+
+    mObjectVertexArray.create("object");
+    GLState::bindVertexArray(mObjectVertexArray);
+
+    mObjectVertexBuffer[0].create("object vertices");
+    mObjectVertexBuffer[1].create("object texture coordinates");
+    glBindBuffer(GL_ARRAY_BUFFER, mObjectVertexBuffer[0]);
+    glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(float), mesh.vertices.data(), GL_STATIC_DRAW);
+    mObjectVertexBuffer[0].setSize(mesh.vertices.size() * sizeof(float));
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mObjectVertexBuffer[1]);
+    glBufferData(GL_ARRAY_BUFFER, mesh.texCoords.size() * sizeof(float), mesh.texCoords.data(), GL_STATIC_DRAW);
+    mObjectVertexBuffer[1].setSize(mesh.texCoords.size() * sizeof(float));
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (mObjectFile != "")
+        cout << "Object file " << mObjectFile << " successfully loader." << endl;
+    else
+        cout << "Loading default model: a plane." << endl;
+
+    return true;
+}
+
+/********************************/
+void shaderomatic::prepareInstances()
+{
+    ProfileScope lScope("prepare instances");
+
+    // Instances are laid out on a grid covering the view, each one scaled to its cell.
+    // A single instance gets the identity
+    int lSide = (int)ceil(sqrt((float)mInstances));
+    vector<glm::mat4> lTransforms(mInstances);
+    Parallel::forRange(mInstances, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            float lX = -1.f + (2.f * (float)(i % lSide) + 1.f) / (float)lSide;
+            float lY = -1.f + (2.f * (float)(i / lSide) + 1.f) / (float)lSide;
+            glm::mat4 lTransform = glm::translate(glm::mat4(1.f), glm::vec3(lX, lY, 0.f));
+            lTransforms[i] = glm::scale(lTransform, glm::vec3(1.f / (float)lSide));
+        }
+    });
+
+    if (mInstanceBuffer == 0)
+    {
+        // The depth pre-pass reads the positions only, along with the transforms
+        mDepthVertexArray.create("depth pre-pass");
+        GLState::bindVertexArray(mDepthVertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, mObjectVertexBuffer[0]);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(0);
+
+        mInstanceBuffer.create("instance transforms");
+        glBindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+        for (GLuint vertexArray : {mObjectVertexArray.get(), mDepthVertexArray.get()})
+        {
+            GLState::bindVertexArray(vertexArray);
+            // One matrix per instance, as four columns at locations 2 to 5
+            for (int i = 0; i < 4; ++i)
+            {
+                glVertexAttribPointer(2 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
+                glVertexAttribDivisor(2 + i, 1);
+                glEnableVertexAttribArray(2 + i);
+            }
+        }
+
+        // The screen quad has no instance buffer, and reads the identity instead
+        glVertexAttrib4f(2, 1.f, 0.f, 0.f, 0.f);
+        glVertexAttrib4f(3, 0.f, 1.f, 0.f, 0.f);
+        glVertexAttrib4f(4, 0.f, 0.f, 1.f, 0.f);
+        glVertexAttrib4f(5, 0.f, 0.f, 0.f, 1.f);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, lTransforms.size() * sizeof(glm::mat4), lTransforms.data(), GL_STATIC_DRAW);
+    mInstanceBuffer.setSize(lTransforms.size() * sizeof(glm::mat4));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/********************************/
+void shaderomatic::prepareTexture()
+{
+    // Préparation des textures du fond et du HUD, le fond étant chargé une fois l'image lue
+    mTexture[0].create("vTexMap");
+    mTexture[1].create("HUD");
+    prepareHUDTexture();
+}
+
+/********************************/
+void shaderomatic::prepareRenderGraph()
+{
+    // A manifest next to the shader files describes the passes,
+    // otherwise we fall back to the object pass followed by the screen pass
+    mRenderGraph.setDefaultFormats(mFBOFormat, mDepthFormat, mSamples);
+    mRenderGraph.setMipmapping(mFBOMipmaps);
+    if (!mRenderGraph.load(mShaderFile + ".graph") || !mRenderGraph.build())
+    {
+        mRenderGraph.setDefault();
+        mRenderGraph.build();
+    }
+    mRenderGraph.allocate(mWindowWidth, mWindowHeight);
+
+    for (auto& shader : mRenderGraph.getShaders())
+        getShader(shader);
+    updateTargetUsage();
+}
+
+/********************************/
+void shaderomatic::updateTargetUsage()
+{
+    // Passes activated by a rebuild have their shaders compiled, and are introspected in turn
+    bool lChanged = true;
+    while (lChanged)
+    {
+        lChanged = false;
+        for (auto pass : mRenderGraph.getPasses())
+        {
+            ShaderSet& lShader = getShader(pass->shader);
+            if (!lShader.valid)
+                continue;
+
+            // Samplers not read by the program have no location once it is linked
+            vector<string> lReadInputs;
+            for (auto& input : pass->inputs)
+                if (glGetUniformLocation(lShader.program, input.c_str()) != -1)
+                    lReadInputs.push_back(input);
+            lChanged |= mRenderGraph.setUsage(pass, lReadInputs, usesExplicitLod(lShader));
+        }
+
+        if (lChanged)
+            mRenderGraph.rebuild();
+    }
+}
+
+/********************************/
+bool shaderomatic::usesExplicitLod(ShaderSet& pShader)
+{
+    // Texture functions which read at another level than the base one, whatever the screen derivatives
+    static const vector<string> lFunctions {"textureLod", "textureGrad", "textureProjLod", "textureProjGrad", "textureQueryLod", "textureQueryLevels"};
+
+    for (GLuint shader : {pShader.vertexShader.get(), pShader.tessellationControlShader.get(), pShader.tessellationEvaluationShader.get(),
+                          pShader.geometryShader.get(), pShader.fragmentShader.get()})
+    {
+        GLint lLength = 0;
+        glGetShaderiv(shader, GL_SHADER_SOURCE_LENGTH, &lLength);
+        if (lLength == 0)
+            continue;
+
+        string lSource(lLength, '\0');
+        glGetShaderSource(shader, lLength, nullptr, &lSource[0]);
+        for (auto& function : lFunctions)
+            if (lSource.find(function) != string::npos)
+                return true;
+    }
+    return false;
+}
+
+/********************************/
+bool shaderomatic::compileShader(ShaderSet& pShader)
+{
+    GLchar* lSrc;
+    bool lResult;
+
+    // Vertex shader
+    pShader.vertexShader.create(pShader.vertexFile.c_str(), GL_VERTEX_SHADER);
+    lSrc = readFile(pShader.vertexFile.c_str());
+    bool isVertPresent = true;
+    if(lSrc == nullptr)
+    {
+        lSrc = gDefaultVertShader;
+        isVertPresent = false;
+    }
+
+    string lVertSource = mDepthPrepass ? addInvariantPosition(lSrc) : string(lSrc);
+    const GLchar* lVertSrc = lVertSource.c_str();
+    glShaderSource(pShader.vertexShader, 1, &lVertSrc, 0);
+    glCompileShader(pShader.vertexShader);
+    lResult = verifyShader(pShader.vertexShader);
+    if(!lResult)
+    {
+        return false;
+    }
+
+    if(isVertPresent)
+        free(lSrc);
+
+    // Tessellation control shader
+    pShader.tessellationControlShader.create(pShader.tessControlFile.c_str(), GL_TESS_CONTROL_SHADER);
+    lSrc = readFile(pShader.tessControlFile.c_str());
+    bool isTessControlPresent = true;
+    if (lSrc == nullptr)
+    {
+        isTessControlPresent = false;
+    }
+    else
+    {
+        glShaderSource(pShader.tessellationControlShader, 1, (const GLchar**)&lSrc, 0);
+        glCompileShader(pShader.tessellationControlShader);
+        lResult = verifyShader(pShader.tessellationControlShader);
+        if (!lResult)
+            return false;
+    }
+
+    if (isTessControlPresent)
+        free(lSrc);
+
+    // Tessellation evaluation shader
+    pShader.tessellationEvaluationShader.create(pShader.tessEvalFile.c_str(), GL_TESS_EVALUATION_SHADER);
+    lSrc = readFile(pShader.tessEvalFile.c_str());
+    bool isTessEvalPresent = true;
+    if (lSrc == nullptr)
+    {
+        isTessEvalPresent = false;
+    }
+    else
+    {
+        string lTessEvalSource = mDepthPrepass ? addInvariantPosition(lSrc) : string(lSrc);
+        const GLchar* lTessEvalSrc = lTessEvalSource.c_str();
+        glShaderSource(pShader.tessellationEvaluationShader, 1, &lTessEvalSrc, 0);
+        glCompileShader(pShader.tessellationEvaluationShader);
+        lResult = verifyShader(pShader.tessellationEvaluationShader);
+        if (!lResult)
+            return false;
+    }
+
+    if (isTessEvalPresent)
+        free(lSrc);
+
+    // Geometry shader
+    pShader.geometryShader.create(pShader.geometryFile.c_str(), GL_GEOMETRY_SHADER);
+    lSrc = readFile(pShader.geometryFile.c_str());
+    bool isGeomPresent = true;
+    if(lSrc == nullptr)
+        isGeomPresent = false;
+    else
+    {
+        string lGeomSource = mDepthPrepass ? addInvariantPosition(lSrc) : string(lSrc);
+        const GLchar* lGeomSrc = lGeomSource.c_str();
+        glShaderSource(pShader.geometryShader, 1, &lGeomSrc, 0);
+        glCompileShader(pShader.geometryShader);
+        lResult = verifyShader(pShader.geometryShader);
+        if(!lResult)
+            return false;
+    }
+
+    if(isGeomPresent)
+        free(lSrc);
+
+    // Fragment shader
+    pShader.fragmentShader.create(pShader.fragmentFile.c_str(), GL_FRAGMENT_SHADER);
+    lSrc = readFile(pShader.fragmentFile.c_str());
+    bool isFragPresent = true;
+    if(lSrc == nullptr)
+    {
+        lSrc = gDefaultFragShader;
+        isFragPresent = false;
+    }
+
+    // Shaders reading the virtual texture get its lookup function
+    string lFragSource = mVirtualTexture.isLoaded() ? VirtualTexture::addShaderHelper(lSrc) : string(lSrc);
+    const GLchar* lFragSrc = lFragSource.c_str();
+    glShaderSource(pShader.fragmentShader, 1, &lFragSrc, 0);
+    glCompileShader(pShader.fragmentShader);
+    lResult = verifyShader(pShader.fragmentShader);
+    if(!lResult)
+    {
+        return false;
+    }
+
+    if(isFragPresent)
+        free(lSrc);
+
+    // Création du programme, le précédent restant utilisé si l'édition des liens échoue
+    GLProgram lProgram;
+    lProgram.create(pShader.fragmentFile.c_str());
+    glAttachShader(lProgram, pShader.vertexShader);
+    if(isTessControlPresent && isTessEvalPresent)
+    {
+        glAttachShader(lProgram, pShader.tessellationControlShader);
+        glAttachShader(lProgram, pShader.tessellationEvaluationShader);
+    }
+    if(isGeomPresent)
+        glAttachShader(lProgram, pShader.geometryShader);
+
+    glAttachShader(lProgram, pShader.fragmentShader);
+    glBindAttribLocation(lProgram, 0, "vVertex");
+    glBindAttribLocation(lProgram, 1, "vTexCoord");
+    glBindAttribLocation(lProgram, 2, "vInstanceMatrix");
+    glLinkProgram(lProgram);
+    lResult = verifyProgram(lProgram);
+    if(!lResult)
+    {
+        return false;
+    }
+    pShader.program = move(lProgram);
+    pShader.tessellate = isTessControlPresent && isTessEvalPresent;
+
+    GLState::useProgram(pShader.program);
+
+    // Préparation de la texture de fond et du HUD, liées à chaque image
+    getUniformLocations(pShader.program, pShader.locations);
+    glUniform1i(pShader.locations.texMap, 0);
+    glUniform1i(pShader.locations.hud, 1);
+
+    // Les textures liées aux FBO sont attachées à chaque passe, à partir de l'unité 2
+    pShader.userUniforms.clear();
+    listUserUniforms(pShader, pShader.program);
+
+    // Compute shader, in a program of its own. If it fails, only the compute passes are disabled
+    pShader.computeShader.reset();
+    pShader.computeProgram.reset();
+    lSrc = readFile(pShader.computeFile.c_str());
+    if (lSrc != nullptr)
+    {
+        pShader.computeShader.create(pShader.computeFile.c_str(), GL_COMPUTE_SHADER);
+        glShaderSource(pShader.computeShader, 1, (const GLchar**)&lSrc, 0);
+        glCompileShader(pShader.computeShader);
+        free(lSrc);
+        if (verifyShader(pShader.computeShader))
+        {
+            pShader.computeProgram.create(pShader.computeFile.c_str());
+            glAttachShader(pShader.computeProgram, pShader.computeShader);
+            glLinkProgram(pShader.computeProgram);
+            if (!isLinked(pShader.computeProgram, pShader.computeFile))
+                pShader.computeProgram.reset();
+        }
+        if (pShader.computeProgram == 0)
+            cerr << "Compute shader " << pShader.computeFile << " is not valid, its passes are not dispatched." << endl;
+    }
+    if (pShader.computeProgram != 0)
+    {
+        glGetProgramiv(pShader.computeProgram, GL_COMPUTE_WORK_GROUP_SIZE, pShader.workGroupSize);
+        pShader.computeMouseLocation = glGetUniformLocation(pShader.computeProgram, "vMouse");
+        pShader.computeTimerLocation = glGetUniformLocation(pShader.computeProgram, "vTimer");
+        pShader.computeResolutionLocation = glGetUniformLocation(pShader.computeProgram, "vResolution");
+        pShader.computeStepLocation = glGetUniformLocation(pShader.computeProgram, "vStep");
+        pShader.computeFBOScaleLocation = glGetUniformLocation(pShader.computeProgram, "vFBOScale");
+        listUserUniforms(pShader, pShader.computeProgram);
+    }
+
+    // Programs drawing the tessellation or geometry output again from a capture, writing depth only, and counting fragments
+    prepareFeedbackPrograms(pShader);
+    prepareDepthProgram(pShader);
+    prepareOverdrawProgram(pShader);
+
+    // Sampler locations cached by the passes are now outdated, and deleted programs see their names reused
+    for (auto pass : mRenderGraph.getPasses())
+    {
+        pass->program = 0;
+        if (&getShader(pass->shader) == &pShader)
+            mSpecializer.forget(pass->name);
+    }
+    for (auto& cache : mFeedbackCaches)
+        cache.second.invalidate();
+    for (auto compute : mRenderGraph.getComputePasses())
+        compute->program = 0;
+
+    return true;
+}
+
+/********************************/
+bool shaderomatic::checkFiles()
+{
+    ProfileScope lScope("check files");
+    bool lChanged = false;
+
+    if (mRenderGraph.manifestChanged())
+    {
+        prepareRenderGraph();
+        lChanged = true;
+    }
+
+    bool lShadersChanged = false;
+    for (auto& shader : mRenderGraph.getShaders())
+    {
+        ShaderSet& lShader = getShader(shader);
+        if(shaderChanged(lShader))
+        {
+            ProfileScope lScope("compile shaders");
+            lShader.valid = compileShader(lShader);
+            lShadersChanged = true;
+        }
+    }
+    if (lShadersChanged)
+    {
+        updateTargetUsage();
+        lChanged = true;
+    }
+
+    if(textureChanged())
+    {
+        ProfileScope lScope("reload texture");
+        if (mVirtualTexturing)
+            loadVirtualTexture(mTexture[0]);
+        else
+            updateTexture(mImageFile.c_str(), mTexture[0]);
+        lChanged = true;
+    }
+
+    return lChanged;
+}
+
+/********************************/
+vector<string> shaderomatic::getWatchedFiles()
+{
+    vector<string> lFiles;
+    if (mRenderGraph.getManifest() != "")
+        lFiles.push_back(mRenderGraph.getManifest());
+    lFiles.push_back(mImageFile);
+    for (auto& shader : mRenderGraph.getShaders())
+    {
+        ShaderSet& lShader = getShader(shader);
+        for (auto& file : {lShader.vertexFile, lShader.tessControlFile, lShader.tessEvalFile, lShader.geometryFile, lShader.fragmentFile, lShader.computeFile})
+            lFiles.push_back(file);
+    }
+    return lFiles;
+}
+
+/********************************/
+void shaderomatic::getUsedInputs(bool& animated, bool& mouse, bool& scroll)
+{
+    // Uniforms not used by a program have no location once it is linked.
+    // Simulations and compute passes update some state at every frame
+    animated = mRenderGraph.hasSteps();
+    mouse = false;
+    scroll = false;
+    for (auto& shader : mRenderGraph.getShaders())
+    {
+        ShaderSet& lShader = getShader(shader);
+        if (!lShader.valid)
+            continue;
+        animated |= lShader.locations.timer != -1 || lShader.computeProgram != 0;
+        mouse |= lShader.locations.mouse != -1;
+        scroll |= lShader.locations.mouseScroll != -1;
+    }
+}
+
+/********************************/
+void shaderomatic::draw()
+{
+    mFrameIndex++;
+
+    // Shaders and passes, reloaded by the render loop when their files change
+    bool lShadersValid = true;
+    for (auto& shader : mRenderGraph.getShaders())
+        lShadersValid &= getShader(shader).valid;
+
+    if(lShadersValid)
+    {
+        ProfileScope lHUDScope("hud");
+
+        // HUD rendering, without timings when replaying so that images can be compared
+        string lHUDText;
+        if (mReplayFrame != nullptr)
+            lHUDText = string("Replay: frame ") + boost::lexical_cast<string>(mReplayIndex + 1) + string("/")
+                       + boost::lexical_cast<string>(mReplay.getFrames().size());
+        else
+        {
+            lHUDText = string("Fps: ") + boost::lexical_cast<string>((int)(1.f/mTimePerFrame));
+            lHUDText += string(" (") + boost::lexical_cast<string>(mTimePerFrame*1000) + string(" msec per frame)");
+            // A single line fits in the HUD, the sections beyond the frame rate are shown one at a time
+            if (mInput.hudPage == 0)
+            {
+                if (mRenderGraph.hasSteps())
+                    lHUDText += string(" - Steps: ") + boost::lexical_cast<string>((int)mStepsPerSecond) + string("/s");
+                if (mComputeTime > 0.f)
+                    lHUDText += string(" - Compute: ") + boost::lexical_cast<string>(mComputeTime) + string(" msec");
+                if (mInstances > 1)
+                    lHUDText += string(" - Instances: ") + boost::lexical_cast<string>(mInstances);
+                if (mObjectBVH.getChunkCount() > 0)
+                    lHUDText += string(" - Triangles: ") + boost::lexical_cast<string>(mTrianglesSubmitted) + string("/")
+                                + boost::lexical_cast<string>(mObjectBVH.getTriangleCount() * mInstances);
+                if (mOverdrawMode > 0 && mOverdrawCounted)
+                {
+                    char lOverdrawText[128];
+                    snprintf(lOverdrawText, sizeof(lOverdrawText), " - Overdraw: avg %.2f, max %.0f", mOverdrawView.getAverage(), mOverdrawView.getMax());
+                    lHUDText += lOverdrawText;
+                    if (mOverdrawView.countsInvocations())
+                    {
+                        snprintf(lOverdrawText, sizeof(lOverdrawText), " (invocations avg %.2f, max %.0f)", mOverdrawView.getAverageInvocations(), mOverdrawView.getMaxInvocations());
+                        lHUDText += lOverdrawText;
+                    }
+                }
+                if (mVirtualTexture.isLoaded())
+                    lHUDText += string(" - Tiles: ") + boost::lexical_cast<string>(mVirtualTexture.getResidentTiles()) + string("/")
+                                + boost::lexical_cast<string>(mVirtualTexture.getCacheTiles()) + string(" (")
+                                + boost::lexical_cast<string>(mVirtualTexture.getPendingTiles()) + string(" pending)");
+                if (mFeedbackCaching && mCachedBytes > 0)
+                    lHUDText += string(" - Cached: ") + boost::lexical_cast<string>(mCachedPrimitives) + string(" primitives, ")
+                                + boost::lexical_cast<string>(mCachedBytes >> 20) + string(" MB");
+                if (mControlChannel.isStarted())
+                    lHUDText += string(" - Controls: ") + boost::lexical_cast<string>(mControlChannel.getReceived())
+                                + string(" (") + boost::lexical_cast<string>(mControlChannel.getDropped()) + string(" dropped)");
+                if (mGpuCullingMode > 0 && mGpuCulling.isReady())
+                {
+                    lHUDText += string(" - Chunks: ") + boost::lexical_cast<string>(mGpuCulling.getVisibleChunks()) + string("/")
+                                + boost::lexical_cast<string>(mGpuCulling.getChunkCount());
+                    if (mGpuCullingMode == 2)
+                        lHUDText += string(" (") + boost::lexical_cast<string>(mGpuCulling.getOccludedChunks()) + string(" occluded)");
+                }
+            }
+            else if (mInput.hudPage == 1)
+            {
+                // GPU time of each pass, and for object passes the samples shaded per sample of their target
+                for (auto pass : mRenderGraph.getPasses())
+                {
+                    char lPassText[128];
+                    snprintf(lPassText, sizeof(lPassText), " - %s: %.2f msec", pass->name.c_str(), pass->timer.getLast());
+                    lHUDText += lPassText;
+                    auto lCounterIt = mOverdrawCounters.find(pass->name);
+                    if (lCounterIt != mOverdrawCounters.end() && pass->width * pass->height > 0)
+                    {
+                        double lOverdraw = (double)lCounterIt->second.getLast() / (pass->width * pass->height * max(1, pass->samples));
+                        snprintf(lPassText, sizeof(lPassText), " (overdraw %.2f)", lOverdraw);
+                        lHUDText += lPassText;
+                    }
+                    // Uniforms frozen, and what the variants gained over the generic program
+                    int lFrozen = mSpecializer.getFrozenCount(pass->name);
+                    if (lFrozen > 0)
+                    {
+                        float lGeneric = mSpecializer.getGenericTime(pass->name);
+                        float lSpecialized = mSpecializer.getSpecializedTime(pass->name);
+                        if (lGeneric > 0.f && lSpecialized > 0.f)
+                            snprintf(lPassText, sizeof(lPassText), " (%i frozen, %+.2f msec)", lFrozen, lSpecialized - lGeneric);
+                        else
+                            snprintf(lPassText, sizeof(lPassText), " (%i frozen)", lFrozen);
+                        lHUDText += lPassText;
+                    }
+                }
+            }
+            else if (mInput.hudPage == 2)
+            {
+                // Memory held by GL objects, current and peak
+                string lMemoryText;
+                for (int c = 0; c < GLRegistry::CategoryCount; ++c)
+                {
+                    GLRegistry::Category lCategory = (GLRegistry::Category)c;
+                    if (GLRegistry::getPeakBytes(lCategory) == 0)
+                        continue;
+                    char lCategoryText[128];
+                    snprintf(lCategoryText, sizeof(lCategoryText), "%s%s %.1f/%.1f MB", lMemoryText.size() ? ", " : "", GLRegistry::getName(lCategory),
+                             (double)GLRegistry::getBytes(lCategory) / (1024.0 * 1024.0), (double)GLRegistry::getPeakBytes(lCategory) / (1024.0 * 1024.0));
+                    lMemoryText += lCategoryText;
+                }
+                if (lMemoryText.size())
+                    lHUDText += string(" - GPU memory: ") + lMemoryText;
+            }
+            else
+            {
+                // GL calls of the previous frame, and those skipped as they changed nothing
+                string lCallsText;
+                for (int c = 0; c < GLState::CategoryCount; ++c)
+                {
+                    GLState::Category lCategory = (GLState::Category)c;
+                    if (GLState::getCalls(lCategory) > 0)
+                        lCallsText += string(", ") + GLState::getName(lCategory) + string(" ") + boost::lexical_cast<string>(GLState::getCalls(lCategory));
+                }
+                lHUDText += string(" - GL calls: ") + boost::lexical_cast<string>(GLState::getTotalCalls()) + string(" (")
+                            + boost::lexical_cast<string>(GLState::getTotalElided()) + string(" skipped") + lCallsText + string(")");
+                if (mDebugLog.getPerformanceCount() > 0)
+                    lHUDText += string(" - Performance warnings: ") + boost::lexical_cast<string>(mDebugLog.getPerformanceCount())
+                                + string(" (last: ") + mDebugLog.getLastPerformance().substr(0, 80) + string(")");
+            }
+        }
+
+        mCachedPrimitives = 0;
+        mCachedBytes = 0;
+
+        mHUD = cv::Mat::zeros(mHUD.size(), mHUD.type());
+        cv::putText(mHUD, lHUDText, cv::Point(0,28), cv::FONT_HERSHEY_PLAIN, 1.0, cv::Scalar(0, 255, 0));
+        cv::Mat lMatBuffer;
+        cv::flip(mHUD, lMatBuffer,0);
+
+        glGetError();
+        GLState::editTexture(GL_TEXTURE_2D, mTexture[1], 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, lMatBuffer.cols, lMatBuffer.rows, GL_BGR, GL_UNSIGNED_BYTE, lMatBuffer.data);
+
+        GLenum lError = glGetError();
+        if(lError)
+        {
+            cerr << "Error while updating HUD." << endl;
+        }
+        lHUDScope.stop();
+
+        if (mReplayFrame != nullptr)
+        {
+            mMouse[0] = mReplayFrame->mouse[0];
+            mMouse[1] = mReplayFrame->mouse[1];
+            mScroll = mReplayFrame->scroll;
+            mTimer = mReplayFrame->timer;
+        }
+        else
+        {
+            // Mouse position
+            mMouse[0] = max(0.f, min((float)mWindowWidth-1.f, (float)mInput.cursor[0]));
+            mMouse[1] = (float)mWindowHeight-1.f - max(0.f, min((float)mWindowHeight-1.f, (float)mInput.cursor[1]));
+
+            // Mouse scroll
+            mScroll = (float)mInput.scroll;
+
+            // Timer
+            duration<float> lTimer = steady_clock::now() - mClockStart;
+            mTimer = lTimer.count();
+
+            if (mRecordFile != "")
+            {
+                RecordedFrame lFrame;
+                lFrame.timer = mTimer;
+                lFrame.mouse[0] = mMouse[0];
+                lFrame.mouse[1] = mMouse[1];
+                lFrame.scroll = mScroll;
+                mRecord.add(lFrame);
+            }
+        }
+
+        // Compute passes, then simulation steps, then the passes drawing the frame
+        GLState::bindTexture(0, GL_TEXTURE_2D, mTexture[0]);
+        GLState::bindTexture(1, GL_TEXTURE_2D, mTexture[1]);
+        mRenderGraph.bindResources();
+        {
+            ProfileScope lTilesScope("stream tiles");
+            mVirtualTexture.update();
+        }
+        mComputeTime = 0.f;
+        mOverdrawCounted = false;
+        for (auto compute : mRenderGraph.getComputePasses())
+            dispatchCompute(compute);
+
+        auto lPasses = mRenderGraph.getPasses();
+        if (mRenderGraph.hasSteps())
+        {
+            int lSubsteps = mSubsteps > 0 ? mSubsteps : mRenderGraph.getSubsteps();
+            for (int step = 0; step < lSubsteps; ++step)
+            {
+                for (auto pass : lPasses)
+                    if (pass->step)
+                        drawPass(pass);
+                mStepCount++;
+            }
+        }
+
+        for (auto pass : lPasses)
+            if (!pass->step)
+                drawPass(pass);
+
+        GLState::bindFramebuffer(GL_FRAMEBUFFER, 0);
+        GLState::viewport(0, 0, mWindowWidth, mWindowHeight);
+        if (mReplayFrame != nullptr && mBenchmarkFrames == 0 && mReplayImages != "")
+            saveFrameImage();
+        ProfileScope lScope("swap buffers");
+        glfwSwapBuffers(mGlfwWindow);
+        mStartup.firstFrame();
+    }
+    else
+    {
+        glClear(GL_COLOR_BUFFER_BIT);
+        ProfileScope lScope("swap buffers");
+        glfwSwapBuffers(mGlfwWindow);
+    }
+
+    // Culling statistics, from previous frames
+    mGpuCulling.collect();
+
+    for (auto& counter : mOverdrawCounters)
+        counter.second.collect();
+    mOverdrawView.collect();
+
+    GLState::endFrame();
+
+    // GPU times of the passes, from previous frames
+    for (auto compute : mRenderGraph.getComputePasses())
+    {
+        compute->timer.collect(mGpuSpans);
+        for (auto& span : mGpuSpans)
+            Profiler::addGpuSpan(compute->name.c_str(), span.start, span.end);
+    }
+    for (auto pass : mRenderGraph.getPasses())
+    {
+        pass->timer.collect(mGpuSpans);
+        for (auto& span : mGpuSpans)
+            Profiler::addGpuSpan(pass->name.c_str(), span.start, span.end);
+        pass->depthTimer.collect(mGpuSpans);
+        for (auto& span : mGpuSpans)
+            Profiler::addGpuSpan("depth prepass", span.start, span.end);
+    }
+}
+
+/********************************/
+void shaderomatic::dispatchCompute(ComputePass* compute)
+{
+    ShaderSet& lShader = getShader(compute->shader);
+    if (lShader.computeProgram == 0)
+        return;
+
+    ProfileScope lScope(compute->name.c_str());
+    GpuTimer& lTimer = compute->timer;
+    mComputeTime += lTimer.getLast();
+    lTimer.begin(mFrameIndex);
+
+    GLState::useProgram(lShader.computeProgram);
+    if (compute->program != lShader.computeProgram)
+    {
+        compute->program = lShader.computeProgram;
+        mRenderGraph.setResourceBindings(lShader.computeProgram);
+    }
+
+    glUniform2fv(lShader.computeMouseLocation, 1, (GLfloat*)mMouse);
+    glUniform1f(lShader.computeTimerLocation, mTimer);
+    glUniform1i(lShader.computeStepLocation, (GLint)mStepCount);
+    float lRes[2] {(float)mWindowWidth, (float)mWindowHeight};
+    glUniform2fv(lShader.computeResolutionLocation, 1, (GLfloat*)lRes);
+    lRes[0] = mRenderGraph.getScaleX();
+    lRes[1] = mRenderGraph.getScaleY();
+    glUniform2fv(lShader.computeFBOScaleLocation, 1, (GLfloat*)lRes);
+
+    // Without explicit counts, enough groups to cover the window
+    int lSize[3] {mWindowWidth, mWindowHeight, 1};
+    GLuint lGroups[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        if (compute->groups[i] > 0)
+            lGroups[i] = compute->groups[i];
+        else
+            lGroups[i] = (lSize[i] + lShader.workGroupSize[i] - 1) / max(1, lShader.workGroupSize[i]);
+    }
+    GLState::dispatchCompute(lGroups[0], lGroups[1], lGroups[2]);
+
+    // Results are read as buffers, images or textures by the next passes
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    lTimer.end();
+}
+
+/********************************/
+void shaderomatic::setPassUniforms(GLuint program, const UniformLocations& locations, RenderPass* pass, const glm::mat4& mvp)
+{
+    glProgramUniform2fv(program, locations.mouse, 1, (GLfloat*)mMouse);
+    glProgramUniform1f(program, locations.mouseScroll, mScroll);
+    glProgramUniform1f(program, locations.timer, mTimer);
+    glProgramUniform1i(program, locations.step, (GLint)mStepCount);
+
+    glProgramUniformMatrix4fv(program, locations.mvpMat, 1, GL_FALSE, glm::value_ptr(mvp));
+    glProgramUniform1i(program, locations.pass, (GLint)pass->index);
+    glProgramUniform1i(program, locations.instances, pass->geometry == "object" ? (GLint)mInstances : 1);
+
+    // Resolution, of the pass target
+    float lRes[2];
+    lRes[0] = (float)pass->width;
+    lRes[1] = (float)pass->height;
+    glProgramUniform2fv(program, locations.resolution, 1, (GLfloat*)lRes);
+
+    lRes[0] = (float)mTextureWidth;
+    lRes[1] = (float)mTextureHeight;
+    glProgramUniform2fv(program, locations.textureRes, 1, (GLfloat*)lRes);
+
+    // Targets may be larger than what is rendered, after the window grew
+    lRes[0] = mRenderGraph.getScaleX();
+    lRes[1] = mRenderGraph.getScaleY();
+    glProgramUniform2fv(program, locations.fboScale, 1, (GLfloat*)lRes);
+
+    glProgramUniform4f(program, locations.vtInfo, (float)mVirtualTexture.getWidth(), (float)mVirtualTexture.getHeight(),
+                       (float)mVirtualTexture.getLevels(), (float)mVirtualTexture.getCacheSize());
+    glProgramUniform1i(program, locations.vtFrame, mVirtualTexture.getFrame());
+}
+
+/********************************/
+map<string, vector<double>> shaderomatic::getSpecializationValues(ShaderSet& pShader, RenderPass* pass, const glm::mat4& mvp)
+{
+    // Built-ins describing the targets and the textures, inputs and time change too often
+    const UniformLocations& lLocations = pShader.locations;
+    map<string, vector<double>> lValues;
+    auto addIfUsed = [&](GLint location, const char* name, std::initializer_list<double> values) {
+        if (location != -1)
+            lValues[name] = values;
+    };
+    addIfUsed(lLocations.resolution, "vResolution", {(double)pass->width, (double)pass->height});
+    addIfUsed(lLocations.textureRes, "vTexResolution", {(double)mTextureWidth, (double)mTextureHeight});
+    addIfUsed(lLocations.fboScale, "vFBOScale", {mRenderGraph.getScaleX(), mRenderGraph.getScaleY()});
+    addIfUsed(lLocations.pass, "vPass", {(double)pass->index});
+    addIfUsed(lLocations.instances, "vInstances", {pass->geometry == "object" ? (double)mInstances : 1.0});
+    addIfUsed(lLocations.vtInfo, "vtInfo", {(double)mVirtualTexture.getWidth(), (double)mVirtualTexture.getHeight(),
+                                            (double)mVirtualTexture.getLevels(), (double)mVirtualTexture.getCacheSize()});
+    if (lLocations.mvpMat != -1)
+        lValues["vMVP"] = vector<double>(glm::value_ptr(mvp), glm::value_ptr(mvp) + 16);
+
+    // User uniforms keep the value of the program until one is received
+    for (auto& uniform : pShader.userUniforms)
+    {
+        if (uniform.program != pShader.program)
+            continue;
+        auto lValueIt = mControlValues.find(uniform.name);
+        if (lValueIt != mControlValues.end())
+            lValues[uniform.name] = vector<double>(lValueIt->second.values, lValueIt->second.values + 4);
+        else
+            lValues[uniform.name] = vector<double>();
     }
-
-    return true;
+    return lValues;
 }
 
 /********************************/
-void shaderomatic::prepareTexture()
+vector<double> shaderomatic::getFeedbackKey(ShaderSet& pShader, RenderPass* pass)
 {
-    // Préparation des textures du fond et du HUD
-    glGenTextures(2, mTexture);
-    if(!loadTexture(mImageFile.c_str(), mTexture[0]))
-        exit(EXIT_FAILURE);
-
-    prepareHUDTexture();
+    // Everything the stages before rasterization depend on
+    const UniformLocations& lLocations = pShader.captureLocations;
+    vector<double> lKey {(double)(pass->geometry == "object"), (double)mInstances, (double)mObjectVertexNumber};
+    auto addIfUsed = [&](GLint location, std::initializer_list<double> values) {
+        if (location != -1)
+            lKey.insert(lKey.end(), values);
+    };
+    addIfUsed(lLocations.mouse, {mMouse[0], mMouse[1]});
+    addIfUsed(lLocations.mouseScroll, {mScroll});
+    addIfUsed(lLocations.timer, {mTimer});
+    addIfUsed(lLocations.step, {(double)mStepCount});
+    addIfUsed(lLocations.pass, {(double)pass->index});
+    addIfUsed(lLocations.resolution, {(double)pass->width, (double)pass->height});
+    addIfUsed(lLocations.textureRes, {(double)mTextureWidth, (double)mTextureHeight});
+    addIfUsed(lLocations.fboScale, {mRenderGraph.getScaleX(), mRenderGraph.getScaleY()});
+    addIfUsed(lLocations.texMap, {(double)mImageChange});
+
+    // Values set from the control channel
+    for (auto& uniform : pShader.userUniforms)
+        if (uniform.program == pShader.feedback.capture)
+            lKey.push_back((double)uniform.applied);
+    return lKey;
 }
 
 /********************************/
-void shaderomatic::prepareFBO()
+void shaderomatic::drawPass(RenderPass* pass)
 {
-    glGenFramebuffers(1, &mFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
-
-    // Depth buffer
-    glGenTextures(1, &mFBODepthTexture);
-    glBindTexture(GL_TEXTURE_2D, mFBODepthTexture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, mWindowWidth, mWindowHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, mFBODepthTexture, 0);
-
-    // Texture as a color buffer
-    glGenTextures(2, mFBOTexture);
-    for (int i = 0; i < 2; ++i)
-    {
-        glBindTexture(GL_TEXTURE_2D, mFBOTexture[i]);
+    ProfileScope lScope(pass->name.c_str());
+    GpuTimer& lTimer = pass->timer;
+    lTimer.begin(mFrameIndex);
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    mRenderGraph.beginPass(pass);
 
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, mWindowWidth, mWindowHeight, 0, GL_RGBA, GL_FLOAT, NULL);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    ShaderSet& lShader = getShader(pass->shader);
+    glm::mat4 lProjMatrix = glm::ortho(-1.f, 1.f, -1.f, 1.f);
 
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, mFBOTexture[i], 0);
+    // Tessellation or geometry output, drawn from its last capture if nothing it depends on changed
+    FeedbackCache* lCache = nullptr;
+    vector<double> lCacheKey;
+    if (mFeedbackCaching && lShader.feedback.draw != 0)
+    {
+        lCache = &mFeedbackCaches[pass->name];
+        lCacheKey = getFeedbackKey(lShader, pass);
     }
 
-    GLenum lFBOStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if(lFBOStatus != GL_FRAMEBUFFER_COMPLETE)
+    GLuint lProgram = lCache != nullptr ? lShader.feedback.draw : lShader.program;
+    const UniformLocations* lLocations = lCache != nullptr ? &lShader.feedbackLocations : &lShader.locations;
+
+    // Uniforms which kept their value for a while, frozen into a variant compiled in the background.
+    // With the depth pre-pass, only the fragment stage is specialized so that depth stays the same
+    if (mSpecializer.isStarted() && lCache == nullptr)
     {
-        cerr << "Error while preparing the FBO." << endl;
+        GLuint lPrevious = mSpecializer.getProgram(pass->name);
+        vector<GLuint> lStages = getPreRasterShaders(lShader);
+        lStages.push_back(lShader.fragmentShader);
+        bool lFragmentOnly = mDepthPrepass && pass->geometry == "object" && pass->depth != "none" && !pass->toScreen;
+        if (mSpecializer.update(pass->name, lShader.program, lStages, getSpecializationValues(lShader, pass, lProjMatrix), lFragmentOnly))
+            prepareSpecializedProgram(lShader, pass, lPrevious);
+        mSpecializer.addTime(pass->name, lTimer.getLast());
+
+        if (mSpecializer.getProgram(pass->name) != 0)
+        {
+            lProgram = mSpecializer.getProgram(pass->name);
+            lLocations = &mSpecializedLocations[pass->name];
+        }
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-/********************************/
-bool shaderomatic::compileShader()
-{
-    GLchar* lSrc;
-    bool lResult;
+    GLState::useProgram(lProgram);
+    setPassUniforms(lProgram, *lLocations, pass, lProjMatrix);
 
-    // Vertex shader
-    mVertexShader = glCreateShader(GL_VERTEX_SHADER);
-    lSrc = readFile(mVertexFile.c_str());
-    bool isVertPresent = true;
-    if(lSrc == nullptr)
+    // Inputs of the pass, bound from texture unit 2
+    if (pass->program != lProgram)
     {
-        lSrc = gDefaultVertShader;
-        isVertPresent = false;
+        pass->program = lProgram;
+        mRenderGraph.setResourceBindings(lProgram);
+        mVirtualTexture.setBindings(lProgram);
+        pass->depthInputLocations.clear();
+        if (lShader.depthProgram != 0)
+        {
+            mRenderGraph.setResourceBindings(lShader.depthProgram);
+            for (auto& input : pass->inputs)
+                pass->depthInputLocations.push_back(glGetUniformLocation(lShader.depthProgram, input.c_str()));
+        }
+        pass->overdrawInputLocations.clear();
+        if (lShader.overdrawProgram != 0)
+        {
+            mRenderGraph.setResourceBindings(lShader.overdrawProgram);
+            for (auto& input : pass->inputs)
+                pass->overdrawInputLocations.push_back(glGetUniformLocation(lShader.overdrawProgram, input.c_str()));
+        }
+        pass->inputLocations.clear();
+        for (auto& input : pass->inputs)
+            pass->inputLocations.push_back(glGetUniformLocation(lProgram, input.c_str()));
     }
-
-    glShaderSource(mVertexShader, 1, (const GLchar**)&lSrc, 0);
-    glCompileShader(mVertexShader);
-    lResult = verifyShader(mVertexShader);
-    if(!lResult)
+    for (int i = 0; i < pass->inputTextures.size(); ++i)
     {
-        return false;
+        GLState::bindTexture(2 + i, GL_TEXTURE_2D, pass->inputTextures[i]);
+        glUniform1i(pass->inputLocations[i], 2 + i);
     }
 
-    if(isVertPresent)
-        free(lSrc);
-
-    // Tessellation control shader
-    mTessellationControlShader = glCreateShader(GL_TESS_CONTROL_SHADER);
-    lSrc = readFile(mTessControlFile.c_str());
-    bool isTessControlPresent = true;
-    if (lSrc == nullptr)
+    // Outputs
+    GLState::viewport(0, 0, pass->width, pass->height);
+    if (pass->toScreen)
     {
-        isTessControlPresent = false;
+        GLState::bindFramebuffer(GL_FRAMEBUFFER, 0);
+        GLenum lBackbuffer[] = {GL_BACK};
+        GLState::drawBuffers(1, lBackbuffer);
     }
     else
     {
-        glShaderSource(mTessellationControlShader, 1, (const GLchar**)&lSrc, 0);
-        glCompileShader(mTessellationControlShader);
-        lResult = verifyShader(mTessellationControlShader);
-        if (!lResult)
-            return false;
+        GLState::bindFramebuffer(GL_FRAMEBUFFER, pass->msaaFbo ? pass->msaaFbo : pass->fbo);
+        // Outputs read by nobody are not attached
+        vector<GLenum> lFBOBuf;
+        for (int i = 0; i < pass->outputTextures.size(); ++i)
+            lFBOBuf.push_back(pass->outputTextures[i] != 0 ? GL_COLOR_ATTACHMENT0 + i : GL_NONE);
+        GLState::drawBuffers(lFBOBuf.size(), lFBOBuf.data());
     }
 
-    if (isTessControlPresent)
-        free(lSrc);
-
-    // Tessellation evaluation shader
-    mTessellationEvaluationShader = glCreateShader(GL_TESS_EVALUATION_SHADER);
-    lSrc = readFile(mTessEvalFile.c_str());
-    bool isTessEvalPresent = true;
-    if (lSrc == nullptr)
+    if (pass->depth != "none" && !pass->toScreen)
     {
-        isTessEvalPresent = false;
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        GLState::enable(GL_DEPTH_TEST);
     }
     else
     {
-        glShaderSource(mTessellationEvaluationShader, 1, (const GLchar**)&lSrc, 0);
-        glCompileShader(mTessellationEvaluationShader);
-        lResult = verifyShader(mTessellationEvaluationShader);
-        if (!lResult)
-            return false;
+        glClear(GL_COLOR_BUFFER_BIT);
+        GLState::disable(GL_DEPTH_TEST);
     }
 
-    if (isTessEvalPresent)
-        free(lSrc);
-
-    // Geometry shader
-    mGeometryShader = glCreateShader(GL_GEOMETRY_SHADER);
-    lSrc = readFile(mGeometryFile.c_str());
-    bool isGeomPresent = true;
-    if(lSrc == nullptr)
-        isGeomPresent = false;
-    else
+    // Raster state is set for every pass, the calls changing nothing being skipped
+    if (pass->geometry == "object" && mWireframe)
     {
-        glShaderSource(mGeometryShader, 1, (const GLchar**)&lSrc, 0);
-        glCompileShader(mGeometryShader);
-        lResult = verifyShader(mGeometryShader);
-        if(!lResult)
-            return false;
+        GLState::polygonMode(GL_LINE);
+        GLState::enable(GL_LINE_SMOOTH);
     }
+    else
+        GLState::polygonMode(GL_FILL);
 
-    if(isGeomPresent)
-        free(lSrc);
-
-    // Fragment shader
-    mFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    lSrc = readFile(mFragmentFile.c_str());
-    bool isFragPresent = true;
-    if(lSrc == nullptr)
+    if (pass->geometry != "object" || mCullFace == 0)
+        GLState::disable(GL_CULL_FACE);
+    else
     {
-        lSrc = gDefaultFragShader;
-        isFragPresent = false;
+        GLState::enable(GL_CULL_FACE);
+        GLState::cullFace(mCullFace == 1 ? GL_FRONT : GL_BACK);
     }
 
-    glShaderSource(mFragmentShader, 1, (const GLchar**)&lSrc, 0);
-    glCompileShader(mFragmentShader);
-    lResult = verifyShader(mFragmentShader);
-    if(!lResult)
+    // The counts of the overdraw view replace the image of the screen pass
+    if (pass->toScreen && mOverdrawMode > 0 && mOverdrawCounted)
     {
-        return false;
+        mOverdrawView.draw(mScreenVertexArray, mOverdrawMode == 2, mWindowHeight);
+        mRenderGraph.endPass(pass);
+        lTimer.end();
+        return;
     }
 
-    if(isFragPresent)
-        free(lSrc);
-
-    // Création du programme
-    mShaderProgram = glCreateProgram();
-    glAttachShader(mShaderProgram, mVertexShader);
-    if(isTessControlPresent && isTessEvalPresent)
+    // Rendering
+    GLenum lPrimitive = lShader.tessellate ? GL_PATCHES : GL_TRIANGLES;
+    if (lCache != nullptr && !lCache->isValid(lShader.feedback, lCacheKey))
     {
-        glAttachShader(mShaderProgram, mTessellationControlShader);
-        glAttachShader(mShaderProgram, mTessellationEvaluationShader);
-        mTessellate = true;
+        ProfileScope lCaptureScope("capture");
+        GLState::useProgram(lShader.feedback.capture);
+        mRenderGraph.setResourceBindings(lShader.feedback.capture);
+        setPassUniforms(lShader.feedback.capture, lShader.captureLocations, pass, lProjMatrix);
+        lCache->capture(lShader.feedback, lCacheKey, [&]() {
+            if (pass->geometry == "object")
+            {
+                GLState::bindVertexArray(mObjectVertexArray);
+                GLState::drawArraysInstanced(lPrimitive, 0, mObjectVertexNumber, mInstances);
+            }
+            else
+            {
+                GLState::bindVertexArray(mScreenVertexArray);
+                GLState::drawArrays(lPrimitive, 0, 6);
+            }
+        });
+        GLState::useProgram(lProgram);
     }
-    else
-        mTessellate = false;
-    if(isGeomPresent)
-        glAttachShader(mShaderProgram, mGeometryShader);
-
-    glAttachShader(mShaderProgram, mFragmentShader);
-    glBindAttribLocation(mShaderProgram, 0, "vVertex");
-    glBindAttribLocation(mShaderProgram, 1, "vTexCoord");
-    glLinkProgram(mShaderProgram);
-    lResult = verifyProgram(mShaderProgram);
-    if(!lResult)
+    if (lCache != nullptr)
     {
-        return false;
+        mCachedPrimitives += lCache->getPrimitives();
+        mCachedBytes += lCache->getSize();
     }
 
-    glUseProgram(mShaderProgram);
-
-    // Préparation de la texture de fond et du HUD
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, mTexture[0]);
-    GLint lTextureUniform = glGetUniformLocation(mShaderProgram, "vTexMap");
-    glUniform1i(lTextureUniform, 0);
-
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, mTexture[1]);
-    mHUDLocation = glGetUniformLocation(mShaderProgram, "vHUDMap");
-    glUniform1i(mHUDLocation, 1);
-
-    // Ainsi que des texture liée au FBO
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, mFBOTexture[0]);
-    lTextureUniform = glGetUniformLocation(mShaderProgram, "vFBOMap");
-    glUniform1i(lTextureUniform, 2);
-
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, mFBOTexture[1]);
-    lTextureUniform = glGetUniformLocation(mShaderProgram, "vFBOMap2");
-    glUniform1i(lTextureUniform, 3);
-
-    // Position de la souris, matrice de transformation, timer, résolution, et passe ...
-    mMouseLocation = glGetUniformLocation(mShaderProgram, "vMouse");
-    mMouseScrollLocation = glGetUniformLocation(mShaderProgram, "vMouseScroll");
-    mMVPMatLocation = glGetUniformLocation(mShaderProgram, "vMVP");
-    mTimerLocation = glGetUniformLocation(mShaderProgram, "vTimer");
-    mResolutionLocation = glGetUniformLocation(mShaderProgram, "vResolution");
-    mTextureResLocation = glGetUniformLocation(mShaderProgram, "vTexResolution");
-    mPassLocation = glGetUniformLocation(mShaderProgram, "vPass");
-
-    return true;
-}
-
-/********************************/
-void shaderomatic::draw()
-{
-    // Check shaders
-    if(shaderChanged())
-        mShaderValid = compileShader();
-
-    if(textureChanged())
-        updateTexture(mImageFile.c_str(), mTexture[0]);
-
-    if(mShaderValid)
+    if (pass->geometry == "object")
     {
-        // HUD rendering
-        string lHUDText = string("Fps: ") + boost::lexical_cast<string>((int)(1.f/mTimePerFrame));
-        lHUDText += string(" (") + boost::lexical_cast<string>(mTimePerFrame*1000) + string(" msec per frame)");
-
-        mHUD = cv::Mat::zeros(mHUD.size(), mHUD.type());
-        cv::putText(mHUD, lHUDText, cv::Point(0,28), cv::FONT_HERSHEY_PLAIN, 1.0, cv::Scalar(0, 255, 0));
-        cv::Mat lMatBuffer;
-        cv::flip(mHUD, lMatBuffer,0);
-
-        glGetError();
-        glBindTexture(GL_TEXTURE_2D, mTexture[1]);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, lMatBuffer.cols, lMatBuffer.rows, GL_BGR, GL_UNSIGNED_BYTE, lMatBuffer.data);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        GLenum lError = glGetError();
-        if(lError)
+        // Culling is done for the view as a whole, which is not the view of each instance
+        function<void()> lSubmit;
+        if (lCache != nullptr)
         {
-            cerr << "Error while updating HUD." << endl;
+            mTrianglesSubmitted = lCache->getPrimitives();
+            lSubmit = [&]() {lCache->draw(lShader.feedback);};
         }
-
-        // Mouse position
-        double lMouseX, lMouseY;
-        glfwGetCursorPos(mGlfwWindow, &lMouseX, &lMouseY);
-        float lMouse[2];
-        lMouse[0] = max(0.f, min((float)mWindowWidth-1.f, (float)lMouseX));
-        lMouse[1] = (float)mWindowHeight-1.f - max(0.f, min((float)mWindowHeight-1.f, (float)lMouseY));
-        glUniform2fv(mMouseLocation, 1, (GLfloat*)lMouse);
-
-        // Mouse scroll
-        float scroll = mScrollValue;
-        glUniform1f(mMouseScrollLocation, scroll);
-
-        // Timer
-        duration<float> lTimer = steady_clock::now() - mClockStart;
-        glUniform1f(mTimerLocation, (float)lTimer.count());
-
-        // Resolution
-        float lRes[2];
-        lRes[0] = (float)mWindowWidth;
-        lRes[1] = (float)mWindowHeight;
-        glUniform2fv(mResolutionLocation, 1, (GLfloat*)lRes);
-
-        lRes[0] = (float)mTextureWidth;
-        lRes[1] = (float)mTextureHeight;
-        glUniform2fv(mTextureResLocation, 1, (GLfloat*)lRes);
-
-        // Rendering
-        glm::mat4 lProjMatrix = glm::ortho(-1.f, 1.f, -1.f, 1.f);
-        glUniformMatrix4fv(mMVPMatLocation, 1, GL_FALSE, glm::value_ptr(lProjMatrix));
-
-        // First pass to FBO
-        if (mWireframe)
+        else if (mGpuCullingMode > 0 && mGpuCulling.isReady() && mInstances == 1)
         {
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-            glLineWidth(1);
-            glEnable(GL_LINE_SMOOTH);
+            float lFBOScale[2] {mRenderGraph.getScaleX(), mRenderGraph.getScaleY()};
+            mGpuCulling.cull(lProjMatrix, lFBOScale, mGpuCullingMode == 2);
+            GLState::useProgram(lProgram);
+            lSubmit = [&]() {mGpuCulling.draw(lPrimitive);};
+            mTrianglesSubmitted = mGpuCulling.getVisibleTriangles();
         }
-        glUniform1i(mPassLocation, (GLint)0);
-        GLenum lFBOBuf[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
-        glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
-        glDrawBuffers(2, lFBOBuf);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glEnable(GL_DEPTH_TEST);
-        if (mCullFace == 0)
-            glDisable(GL_CULL_FACE);
-        else if (mCullFace == 1)
+        else if (mChunkCulling && mObjectBVH.getChunkCount() > 0 && mInstances == 1)
         {
-            glEnable(GL_CULL_FACE);
-            glCullFace(GL_FRONT);
+            ProfileScope lCullScope("cull chunks");
+            mTrianglesSubmitted = mObjectBVH.cull(lProjMatrix, mChunkFirsts, mChunkCounts) / 3;
+            lCullScope.stop();
+            lSubmit = [&]() {
+                if (mChunkFirsts.size() != 0)
+                    GLState::multiDrawArrays(lPrimitive, mChunkFirsts.data(), mChunkCounts.data(), mChunkFirsts.size());
+            };
         }
         else
         {
-            glEnable(GL_CULL_FACE);
-            glCullFace(GL_BACK);
+            mTrianglesSubmitted = mObjectVertexNumber / 3 * mInstances;
+            lSubmit = [&]() {GLState::drawArraysInstanced(lPrimitive, 0, mObjectVertexNumber, mInstances);};
         }
 
-        glBindVertexArray(mObjectVertexArray);
-        if (mTessellate)
+        // Depth only first, so that the shading pass runs the fragment shader once per visible sample
+        bool lDepthPrepass = mDepthPrepass && lCache == nullptr && lShader.depthProgram != 0 && pass->depth != "none" && !pass->toScreen;
+        if (lDepthPrepass)
         {
-            glDrawArrays(GL_PATCHES, 0, mObjectVertexNumber);
+            ProfileScope lDepthScope("depth prepass");
+            GpuTimer& lDepthTimer = pass->depthTimer;
+            lDepthTimer.begin(mFrameIndex);
+
+            GLState::useProgram(lShader.depthProgram);
+            setPassUniforms(lShader.depthProgram, lShader.depthLocations, pass, lProjMatrix);
+            for (int i = 0; i < pass->depthInputLocations.size(); ++i)
+                glUniform1i(pass->depthInputLocations[i], 2 + i);
+
+            GLState::bindVertexArray(lShader.depthUsesTexCoord ? mObjectVertexArray : mDepthVertexArray);
+            GLState::colorMask(GL_FALSE);
+            lSubmit();
+            GLState::colorMask(GL_TRUE);
+            GLState::depthMask(GL_FALSE);
+            GLState::depthFunc(GL_EQUAL);
+            GLState::useProgram(lProgram);
+            lDepthTimer.end();
         }
-        else
-            glDrawArrays(GL_TRIANGLES, 0, mObjectVertexNumber);
-        glBindVertexArray(0);
-
-        glBindTexture(GL_TEXTURE_2D, mFBOTexture[0]);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, mFBOTexture[1]);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        glDisable(GL_DEPTH_TEST);
-        if (mWireframe)
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-        // Second pass to back buffer
-        glUniform1i(mPassLocation, (GLint)1);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        GLenum lBackbuffer[] = {GL_BACK};
-
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, mFBOTexture[0]);
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, mFBOTexture[1]);
 
-        glDrawBuffers(1, lBackbuffer);
-        glClear(GL_COLOR_BUFFER_BIT);
+        // Samples shaded, to measure the overdraw
+        SampleCounter& lCounter = mOverdrawCounters[pass->name];
+        GLState::bindVertexArray(mObjectVertexArray);
+        lCounter.begin();
+        lSubmit();
+        lCounter.end();
 
-        glBindVertexArray(mScreenVertexArray);
-        if (mTessellate)
-            glDrawArrays(GL_PATCHES, 0, 6);
-        else
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
+        if (lDepthPrepass)
+        {
+            GLState::depthMask(GL_TRUE);
+            GLState::depthFunc(GL_LESS);
+        }
 
-        glfwSwapBuffers(mGlfwWindow);
+        // Every fragment of the first object pass counted again, without depth test
+        if (mOverdrawMode > 0 && !mOverdrawCounted && lCache == nullptr && lShader.overdrawProgram != 0)
+        {
+            ProfileScope lOverdrawScope("overdraw");
+            GLState::useProgram(lShader.overdrawProgram);
+            setPassUniforms(lShader.overdrawProgram, lShader.overdrawLocations, pass, lProjMatrix);
+            for (int i = 0; i < pass->overdrawInputLocations.size(); ++i)
+                glUniform1i(pass->overdrawInputLocations[i], 2 + i);
+
+            mOverdrawView.begin(pass->width, pass->height);
+            GLState::bindVertexArray(mObjectVertexArray);
+            lSubmit();
+            mOverdrawView.end();
+            mOverdrawCounted = true;
+        }
     }
+    else if (lCache != nullptr)
+        lCache->draw(lShader.feedback);
     else
     {
-        glClear(GL_COLOR_BUFFER_BIT);
-        glfwSwapBuffers(mGlfwWindow);
+        GLState::bindVertexArray(mScreenVertexArray);
+        GLState::drawArrays(lPrimitive, 0, 6);
     }
+
+    mRenderGraph.resolve(pass);
+
+    // Depth of this frame, tested by the culling of the next one
+    if (mGpuCullingMode == 2 && pass->geometry == "object" && mInstances == 1)
+        mGpuCulling.buildHiZ(pass->depthTexture);
+    mRenderGraph.generateMipmaps(pass);
+
+    mRenderGraph.endPass(pass);
+    lTimer.end();
 }
 
 /********************************/
-bool shaderomatic::loadTexture(const char *pFilename, GLuint pTexture)
+bool shaderomatic::readImage(const char* pFilename, ImageLoader::Upload& pUpload)
 {
     cout << "Loading texture " << pFilename << endl;
 
-    cv::Mat lMatTexture, lBufferTexture;
-    lMatTexture = cv::imread(pFilename);
+    cv::Mat lMatTexture = ImageLoader::read(pFilename);
+    bool lIsRead = lMatTexture.rows != 0 && lMatTexture.cols != 0;
 
-    if(lMatTexture.rows == 0 || lMatTexture.cols == 0)
-    {
-        cerr << "Failed to load texture." << endl;
-        cerr << "Using a black texture instead." << endl;
-        lMatTexture = cv::Mat::zeros(512, 512, CV_8UC3);
-    }
-    else
     {
-        mImageChange = boost::filesystem::last_write_time(mImageFile.c_str());
+        ProfileScope lScope("convert image");
+        if (lIsRead && ImageLoader::prepare(lMatTexture, mTextureFormat, pUpload))
+            return true;
     }
 
-    cv::flip(lMatTexture, lBufferTexture, 0);
+    cerr << "Failed to load texture." << endl;
+    cerr << "Using a black texture instead." << endl;
+    ImageLoader::prepare(cv::Mat::zeros(512, 512, CV_8UC3), mTextureFormat, pUpload);
+    return false;
+}
 
+/***************************/
+bool shaderomatic::uploadImage(const ImageLoader::Upload& pUpload, GLuint pTexture)
+{
     glGetError();
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, pTexture);
+    GLState::editTexture(GL_TEXTURE_2D, pTexture);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -770,8 +2216,14 @@ bool shaderomatic::loadTexture(const char *pFilename, GLuint pTexture)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+    // Single channel images are read as gray
+    bool lGray = pUpload.format == GL_RED;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, lGray ? GL_RED : GL_GREEN);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, lGray ? GL_RED : GL_BLUE);
+
+    // Size and format can change from one reload to the next
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, lBufferTexture.cols, lBufferTexture.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, lBufferTexture.data);
+    glTexImage2D(GL_TEXTURE_2D, 0, pUpload.internalFormat, pUpload.pixels.cols, pUpload.pixels.rows, 0, pUpload.format, pUpload.type, pUpload.pixels.data);
 
     glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -781,55 +2233,70 @@ bool shaderomatic::loadTexture(const char *pFilename, GLuint pTexture)
         cerr << "Error while loading texture." << endl;
     }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    mTextureWidth = pUpload.pixels.cols;
+    mTextureHeight = pUpload.pixels.rows;
+
+    int lLevels = 1 + (int)floor(log2((float)max(mTextureWidth, mTextureHeight)));
+    GLRegistry::setSize(GLRegistry::Texture, pTexture, GLRegistry::getTextureBytes(pUpload.internalFormat, mTextureWidth, mTextureHeight, lLevels));
 
-    mTextureWidth = lMatTexture.cols;
-    mTextureHeight = lMatTexture.rows;
+    long lKilobytes = (long)mTextureWidth * mTextureHeight * pUpload.bytesPerPixel * 4 / 3 / 1024;
+    cout << "Texture is " << mTextureWidth << "x" << mTextureHeight << ", uploaded as " << pUpload.name
+         << " (" << lKilobytes / 1024 << "." << lKilobytes % 1024 * 10 / 1024 << " MB with mipmaps)" << endl;
 
     return true;
 }
 
 /***************************/
-bool shaderomatic::updateTexture(const char* pFilename, GLuint pTexture)
+bool shaderomatic::loadVirtualTexture(GLuint pTexture)
 {
-    cout << "Reloading texture " << pFilename << endl;
-
-    cv::Mat lMatTexture, lBufferTexture;
-    lMatTexture = cv::imread(pFilename);
-
-    if(lMatTexture.rows == 0 || lMatTexture.cols == 0)
-    {
-        cerr << "Failed to load texture." << endl;
-        cerr << "Using a black texture instead." << endl;
-        lMatTexture = cv::Mat::zeros(512, 512, CV_8UC3);
-    }
+    if (!mVirtualTexture.load(mImageFile))
+        return false;
+    mImageChange = boost::filesystem::last_write_time(mImageFile.c_str());
 
-    cv::flip(lMatTexture, lBufferTexture, 0);
+    // vTexMap gets a level of the pyramid small enough for a single texture
+    cv::Mat lLevel;
+    if (!mVirtualTexture.readLevel(4096, lLevel))
+        lLevel = cv::Mat::zeros(512, 512, CV_8UC4);
 
     glGetError();
-    glActiveTexture(GL_TEXTURE8);
-    glBindTexture(GL_TEXTURE_2D, pTexture);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, lBufferTexture.cols, lBufferTexture.rows, GL_BGR, GL_UNSIGNED_BYTE, lBufferTexture.data);
+    GLState::editTexture(GL_TEXTURE_2D, pTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, lLevel.cols, lLevel.rows, 0, GL_RGBA, GL_UNSIGNED_BYTE, lLevel.data);
     glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
+    int lLevels = 1 + (int)floor(log2((float)max(lLevel.cols, lLevel.rows)));
+    GLRegistry::setSize(GLRegistry::Texture, pTexture, GLRegistry::getTextureBytes(GL_RGBA8, lLevel.cols, lLevel.rows, lLevels));
 
     GLenum lError = glGetError();
     if(lError)
     {
-        cerr << "Error while updating texture" << endl;
+        cerr << "Error while loading the virtual texture." << endl;
     }
 
+    // vTexResolution is the size of the whole image
+    mTextureWidth = mVirtualTexture.getWidth();
+    mTextureHeight = mVirtualTexture.getHeight();
     return true;
 }
 
+/***************************/
+bool shaderomatic::updateTexture(const char* pFilename, GLuint pTexture)
+{
+    ImageLoader::Upload lUpload;
+    readImage(pFilename, lUpload);
+    return uploadImage(lUpload, pTexture);
+}
+
 /***************************/
 void shaderomatic::prepareHUDTexture()
 {
     mHUD = cv::Mat::zeros(32, mWindowWidth, CV_8UC3);
 
     glGetError();
-    glBindTexture(GL_TEXTURE_2D, mTexture[1]);
+    GLState::editTexture(GL_TEXTURE_2D, mTexture[1], 1);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
@@ -838,14 +2305,33 @@ void shaderomatic::prepareHUDTexture()
 
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, mHUD.cols, mHUD.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, NULL);
+    mTexture[1].setSize(GLRegistry::getTextureBytes(GL_RGB8, mHUD.cols, mHUD.rows));
 
     GLenum lError = glGetError();
     if(lError)
     {
         cerr << "Error while updating HUD texture." << endl;
     }
+}
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+/***************************/
+map<string, string> shaderomatic::preloadShaders()
+{
+    // Every stage of the shaders used by default or by the manifest, those missing being skipped
+    vector<string> lBases = RenderGraph::listShaders(mShaderFile + ".graph");
+    lBases.push_back(mShaderFile);
+
+    map<string, string> lSources;
+    for (auto& base : lBases)
+    {
+        for (auto extension : {".vert", ".tcs", ".tes", ".geom", ".frag", ".comp"})
+        {
+            ifstream lFile(base + extension, ios::in | ios::binary);
+            if (lFile.is_open())
+                lSources[base + extension] = string(istreambuf_iterator<char>(lFile), istreambuf_iterator<char>());
+        }
+    }
+    return lSources;
 }
 
 /***************************/
@@ -856,6 +2342,16 @@ char* shaderomatic::readFile(const char* pFile)
 
     cout << pFile << endl;
 
+    // Read beforehand at startup
+    auto lSourceIt = mPreloadedSources.find(pFile);
+    if (lSourceIt != mPreloadedSources.end())
+    {
+        lBuffer = (char*)malloc(lSourceIt->second.size() + 1);
+        memcpy(lBuffer, lSourceIt->second.c_str(), lSourceIt->second.size() + 1);
+        mPreloadedSources.erase(lSourceIt);
+        return lBuffer;
+    }
+
     FILE *lFile = fopen(pFile, "rb");
     if(!lFile)
     {
@@ -876,6 +2372,212 @@ char* shaderomatic::readFile(const char* pFile)
     return lBuffer;
 }
 
+/***************************/
+void shaderomatic::getUniformLocations(GLuint pProgram, UniformLocations& pLocations)
+{
+    // Position de la souris, matrice de transformation, timer, résolution, et passe ...
+    pLocations.mouse = glGetUniformLocation(pProgram, "vMouse");
+    pLocations.mouseScroll = glGetUniformLocation(pProgram, "vMouseScroll");
+    pLocations.mvpMat = glGetUniformLocation(pProgram, "vMVP");
+    pLocations.timer = glGetUniformLocation(pProgram, "vTimer");
+    pLocations.resolution = glGetUniformLocation(pProgram, "vResolution");
+    pLocations.textureRes = glGetUniformLocation(pProgram, "vTexResolution");
+    pLocations.texMap = glGetUniformLocation(pProgram, "vTexMap");
+    pLocations.hud = glGetUniformLocation(pProgram, "vHUDMap");
+    pLocations.pass = glGetUniformLocation(pProgram, "vPass");
+    pLocations.step = glGetUniformLocation(pProgram, "vStep");
+    pLocations.fboScale = glGetUniformLocation(pProgram, "vFBOScale");
+    pLocations.instances = glGetUniformLocation(pProgram, "vInstances");
+    pLocations.vtInfo = glGetUniformLocation(pProgram, "vtInfo");
+    pLocations.vtFrame = glGetUniformLocation(pProgram, "vtFrame");
+}
+
+/***************************/
+vector<GLuint> shaderomatic::getPreRasterShaders(ShaderSet& pShader)
+{
+    vector<GLuint> lShaders {pShader.vertexShader};
+    if (pShader.tessellate)
+    {
+        lShaders.push_back(pShader.tessellationControlShader);
+        lShaders.push_back(pShader.tessellationEvaluationShader);
+    }
+    GLint lGeometryLength = 0;
+    glGetShaderiv(pShader.geometryShader, GL_SHADER_SOURCE_LENGTH, &lGeometryLength);
+    if (lGeometryLength > 0)
+        lShaders.push_back(pShader.geometryShader);
+    return lShaders;
+}
+
+/***************************/
+void shaderomatic::prepareDepthProgram(ShaderSet& pShader)
+{
+    forgetUserUniforms(pShader, pShader.depthProgram);
+    pShader.depthProgram.reset();
+    if (!mDepthPrepass)
+        return;
+
+    if (mDepthFragmentShader == 0)
+    {
+        GLchar* lSrc = gDepthFragShader;
+        mDepthFragmentShader.create("depth pre-pass", GL_FRAGMENT_SHADER);
+        glShaderSource(mDepthFragmentShader, 1, (const GLchar**)&lSrc, 0);
+        glCompileShader(mDepthFragmentShader);
+    }
+
+    // Same shader objects as the pass program, so that depth matches when tested for equality
+    GLProgram lProgram;
+    lProgram.create("depth pre-pass");
+    for (auto shader : getPreRasterShaders(pShader))
+        glAttachShader(lProgram, shader);
+    glAttachShader(lProgram, mDepthFragmentShader);
+    glBindAttribLocation(lProgram, 0, "vVertex");
+    glBindAttribLocation(lProgram, 1, "vTexCoord");
+    glBindAttribLocation(lProgram, 2, "vInstanceMatrix");
+    glLinkProgram(lProgram);
+    if (!isLinked(lProgram, "depth pre-pass"))
+        return;
+
+    pShader.depthProgram = move(lProgram);
+    getUniformLocations(pShader.depthProgram, pShader.depthLocations);
+    glProgramUniform1i(pShader.depthProgram, pShader.depthLocations.texMap, 0);
+    // Vertices placed from their texture coordinates need the whole vertex stream
+    pShader.depthUsesTexCoord = glGetAttribLocation(pShader.depthProgram, "vTexCoord") != -1;
+    listUserUniforms(pShader, pShader.depthProgram);
+}
+
+/***************************/
+void shaderomatic::prepareOverdrawProgram(ShaderSet& pShader)
+{
+    forgetUserUniforms(pShader, pShader.overdrawProgram);
+    pShader.overdrawProgram.reset();
+    if (mOverdrawMode == 0)
+        return;
+
+    if (!mOverdrawView.isReady() && !mOverdrawView.init())
+        return;
+
+    // Same pre-raster stages as the pass, so that the same fragments are counted
+    GLProgram lProgram;
+    lProgram.create("overdraw count");
+    for (auto shader : getPreRasterShaders(pShader))
+        glAttachShader(lProgram, shader);
+    glAttachShader(lProgram, mOverdrawView.getCountShader());
+    glBindAttribLocation(lProgram, 0, "vVertex");
+    glBindAttribLocation(lProgram, 1, "vTexCoord");
+    glBindAttribLocation(lProgram, 2, "vInstanceMatrix");
+    glLinkProgram(lProgram);
+    if (!isLinked(lProgram, "overdraw count"))
+        return;
+
+    pShader.overdrawProgram = move(lProgram);
+    getUniformLocations(pShader.overdrawProgram, pShader.overdrawLocations);
+    glProgramUniform1i(pShader.overdrawProgram, pShader.overdrawLocations.texMap, 0);
+    listUserUniforms(pShader, pShader.overdrawProgram);
+}
+
+/***************************/
+void shaderomatic::prepareSpecializedProgram(ShaderSet& pShader, RenderPass* pass, GLuint pPrevious)
+{
+    // Control values go to the variant drawing the pass, and no more to the one it replaced
+    forgetUserUniforms(pShader, pPrevious);
+
+    GLuint lProgram = mSpecializer.getProgram(pass->name);
+    if (lProgram == 0)
+        return;
+    getUniformLocations(lProgram, mSpecializedLocations[pass->name]);
+    listUserUniforms(pShader, lProgram);
+}
+
+/***************************/
+void shaderomatic::prepareFeedbackPrograms(ShaderSet& pShader)
+{
+    forgetUserUniforms(pShader, pShader.feedback.capture);
+    forgetUserUniforms(pShader, pShader.feedback.draw);
+    pShader.feedback = FeedbackPrograms();
+    if (!mFeedbackCaching)
+        return;
+
+    if (!FeedbackCache::link(getPreRasterShaders(pShader), pShader.fragmentShader, pShader.feedback))
+        return;
+
+    // Render targets change at every frame, only the texture loaded from a file can be read while capturing
+    GLint lCount = 0;
+    glGetProgramiv(pShader.feedback.capture, GL_ACTIVE_UNIFORMS, &lCount);
+    for (GLint i = 0; i < lCount; ++i)
+    {
+        GLchar lName[256];
+        GLint lSize;
+        GLenum lType;
+        glGetActiveUniform(pShader.feedback.capture, i, sizeof(lName), nullptr, &lSize, &lType, lName);
+        bool lSampler = lType == GL_SAMPLER_1D || lType == GL_SAMPLER_2D || lType == GL_SAMPLER_3D || lType == GL_SAMPLER_CUBE
+                        || lType == GL_SAMPLER_2D_ARRAY || lType == GL_SAMPLER_2D_MULTISAMPLE || lType == GL_SAMPLER_BUFFER;
+        if (lSampler && string(lName) != "vTexMap")
+        {
+            cout << "Transform feedback cache: " << lName << " is read before rasterization, the output is not cached" << endl;
+            pShader.feedback = FeedbackPrograms();
+            return;
+        }
+    }
+
+    getUniformLocations(pShader.feedback.capture, pShader.captureLocations);
+    getUniformLocations(pShader.feedback.draw, pShader.feedbackLocations);
+    glProgramUniform1i(pShader.feedback.capture, pShader.captureLocations.texMap, 0);
+    glProgramUniform1i(pShader.feedback.draw, pShader.feedbackLocations.texMap, 0);
+    glProgramUniform1i(pShader.feedback.draw, pShader.feedbackLocations.hud, 1);
+    listUserUniforms(pShader, pShader.feedback.capture);
+    listUserUniforms(pShader, pShader.feedback.draw);
+}
+
+/***************************/
+void shaderomatic::listUserUniforms(ShaderSet& pShader, GLuint pProgram)
+{
+    static const vector<string> lBuiltins {"vMouse", "vMouseScroll", "vMVP", "vTimer", "vResolution", "vTexResolution",
+                                           "vPass", "vStep", "vFBOScale", "vInstances", "vtInfo", "vtFrame"};
+
+    GLint lCount = 0;
+    glGetProgramiv(pProgram, GL_ACTIVE_UNIFORMS, &lCount);
+    for (GLint i = 0; i < lCount; ++i)
+    {
+        GLchar lName[256];
+        GLint lSize;
+        UserUniform lUniform;
+        glGetActiveUniform(pProgram, i, sizeof(lName), nullptr, &lSize, &lUniform.type, lName);
+
+        // Scalars and vectors only, arrays are set through their first element
+        switch (lUniform.type)
+        {
+        case GL_FLOAT: case GL_FLOAT_VEC2: case GL_FLOAT_VEC3: case GL_FLOAT_VEC4:
+        case GL_INT: case GL_INT_VEC2: case GL_INT_VEC3: case GL_INT_VEC4:
+        case GL_BOOL:
+            break;
+        default:
+            continue;
+        }
+
+        lUniform.name = lName;
+        if (lUniform.name.size() > 3 && lUniform.name.substr(lUniform.name.size() - 3) == "[0]")
+            lUniform.name.resize(lUniform.name.size() - 3);
+        if (find(lBuiltins.begin(), lBuiltins.end(), lUniform.name) != lBuiltins.end())
+            continue;
+
+        lUniform.program = pProgram;
+        lUniform.location = glGetUniformLocation(pProgram, lName);
+        if (lUniform.location >= 0)
+            pShader.userUniforms.push_back(lUniform);
+    }
+}
+
+/***************************/
+// Names of deleted programs are reused, their uniforms must not be set any more
+void shaderomatic::forgetUserUniforms(ShaderSet& pShader, GLuint pProgram)
+{
+    if (pProgram == 0)
+        return;
+    pShader.userUniforms.erase(remove_if(pShader.userUniforms.begin(), pShader.userUniforms.end(),
+                                         [&](const UserUniform& uniform) {return uniform.program == pProgram;}),
+                               pShader.userUniforms.end());
+}
+
 /***************************/
 bool shaderomatic::verifyShader(GLuint pShader)
 {
@@ -935,88 +2637,97 @@ bool shaderomatic::verifyProgram(GLuint pProgram)
     cout << lLogInfoStr << endl;
     cout << "-------" << endl;
 
-    if(lIsLinked == false)
-    {
-        glfwTerminate();
-        return false;
-    }
-    return true;
+    return lIsLinked == GL_TRUE;
 }
 
 /***************************/
-bool shaderomatic::shaderChanged()
+bool shaderomatic::shaderChanged(ShaderSet& pShader)
 {
     bool lResult = false;
     std::time_t lTime;
 
-    if(boost::filesystem::exists(mVertexFile.c_str()))
+    if(boost::filesystem::exists(pShader.vertexFile.c_str()))
     {
-        lTime = boost::filesystem::last_write_time(mVertexFile.c_str());
-        if(lTime != mVertexChange)
+        lTime = boost::filesystem::last_write_time(pShader.vertexFile.c_str());
+        if(lTime != pShader.vertexChange)
         {
-            mVertexChange = lTime;
+            pShader.vertexChange = lTime;
             lResult |= true;
         }
     }
     else
     {
-        mVertexChange = 0;
+        pShader.vertexChange = 0;
     }
 
-    if(boost::filesystem::exists(mTessControlFile.c_str()))
+    if(boost::filesystem::exists(pShader.tessControlFile.c_str()))
     {
-        lTime = boost::filesystem::last_write_time(mTessControlFile.c_str());
-        if(lTime != mTessControlChange)
+        lTime = boost::filesystem::last_write_time(pShader.tessControlFile.c_str());
+        if(lTime != pShader.tessControlChange)
         {
-            mTessControlChange = lTime;
+            pShader.tessControlChange = lTime;
             lResult |= true;
         }
     }
     else
     {
-        mTessControlChange = 0;
+        pShader.tessControlChange = 0;
     }
 
-    if(boost::filesystem::exists(mTessEvalFile.c_str()))
+    if(boost::filesystem::exists(pShader.tessEvalFile.c_str()))
     {
-        lTime = boost::filesystem::last_write_time(mTessEvalFile.c_str());
-        if(lTime != mTessEvalChange)
+        lTime = boost::filesystem::last_write_time(pShader.tessEvalFile.c_str());
+        if(lTime != pShader.tessEvalChange)
         {
-            mTessEvalChange = lTime;
+            pShader.tessEvalChange = lTime;
             lResult |= true;
         }
     }
     else
     {
-        mTessEvalChange = 0;
+        pShader.tessEvalChange = 0;
     }
 
-    if(boost::filesystem::exists(mGeometryFile.c_str()))
+    if(boost::filesystem::exists(pShader.geometryFile.c_str()))
     {
-        lTime = boost::filesystem::last_write_time(mGeometryFile.c_str());
-        if(lTime != mGeometryChange)
+        lTime = boost::filesystem::last_write_time(pShader.geometryFile.c_str());
+        if(lTime != pShader.geometryChange)
         {
-            mGeometryChange = lTime;
+            pShader.geometryChange = lTime;
             lResult |= true;
         }
     }
     else
     {
-        mGeometryChange = 0;
+        pShader.geometryChange = 0;
     }
     
-    if(boost::filesystem::exists(mFragmentFile.c_str()))
+    if(boost::filesystem::exists(pShader.fragmentFile.c_str()))
+    {
+        lTime = boost::filesystem::last_write_time(pShader.fragmentFile.c_str());
+        if(lTime != pShader.fragmentChange)
+        {
+            pShader.fragmentChange = lTime;
+            lResult |= true;
+        }
+    }
+    else
+    {
+        pShader.fragmentChange = 0;
+    }
+
+    if(boost::filesystem::exists(pShader.computeFile.c_str()))
     {
-        lTime = boost::filesystem::last_write_time(mFragmentFile.c_str());
-        if(lTime != mFragmentChange)
+        lTime = boost::filesystem::last_write_time(pShader.computeFile.c_str());
+        if(lTime != pShader.computeChange)
         {
-            mFragmentChange = lTime;
+            pShader.computeChange = lTime;
             lResult |= true;
         }
     }
     else
     {
-        mFragmentChange = 0;
+        pShader.computeChange = 0;
     }
 
     return lResult;
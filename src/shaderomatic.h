@@ -24,13 +24,148 @@
 #define GLX_GLXEXT_PROTOTYPES
 
 #include <atomic>
+#include <condition_variable>
 #include <ctime>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include "GLFW/glfw3.h"
 #include "glm/glm.hpp"
 #include "opencv2/opencv.hpp"
 #include "boost/chrono/chrono.hpp"
 
+#include "benchmark.h"
+#include "controlChannel.h"
+#include "debugLog.h"
+#include "feedbackCache.h"
+#include "fileWatcher.h"
+#include "gpuCulling.h"
+#include "glObject.h"
+#include "gpuTimer.h"
+#include "imageLoader.h"
+#include "inputRecord.h"
+#include "meshBVH.h"
+#include "overdrawView.h"
+#include "renderGraph.h"
+#include "sampleCounter.h"
+#include "startupTimeline.h"
+#include "tripleBuffer.h"
+#include "uniformSpecializer.h"
+#include "virtualTexture.h"
+
+/*************/
+// Uniform declared by the shaders themselves, which can be set from the control channel
+struct UserUniform
+{
+    std::string name;
+    GLuint program {0};
+    GLint location {-1};
+    GLenum type {GL_FLOAT};
+    unsigned long applied {0}; // Serial of the last value set
+};
+
+/*************/
+// Locations of the built-in uniforms in a program
+struct UniformLocations
+{
+    GLint mvpMat {-1};
+    GLint mouse {-1};
+    GLint mouseScroll {-1};
+    GLint timer {-1};
+    GLint resolution {-1};
+    GLint textureRes {-1};
+    GLint texMap {-1};
+    GLint hud {-1};
+    GLint pass {-1};
+    GLint step {-1};
+    GLint fboScale {-1};
+    GLint instances {-1};
+    GLint vtInfo {-1};
+    GLint vtFrame {-1};
+};
+
+/*************/
+struct ShaderSet
+{
+    std::string vertexFile, tessControlFile, tessEvalFile, geometryFile, fragmentFile, computeFile;
+    std::time_t vertexChange {0};
+    std::time_t tessControlChange {0};
+    std::time_t tessEvalChange {0};
+    std::time_t geometryChange {0};
+    std::time_t fragmentChange {0};
+    std::time_t computeChange {0};
+
+    bool valid {false};
+    bool tessellate {false};
+
+    GLShader vertexShader;
+    GLShader tessellationControlShader;
+    GLShader tessellationEvaluationShader;
+    GLShader geometryShader;
+    GLShader fragmentShader;
+    GLProgram program;
+
+    // Compute stage, linked separately
+    GLShader computeShader;
+    GLProgram computeProgram;
+    GLint workGroupSize[3] {1, 1, 1};
+
+    UniformLocations locations;
+
+    // Capture of the tessellation or geometry output, and the program drawing it
+    FeedbackPrograms feedback;
+    UniformLocations captureLocations;
+    UniformLocations feedbackLocations;
+
+    // Pre-raster stages only, for the depth pre-pass
+    GLProgram depthProgram;
+    UniformLocations depthLocations;
+    bool depthUsesTexCoord {false};
+
+    // Pre-raster stages with the fragment counting shader, for the overdraw view
+    GLProgram overdrawProgram;
+    UniformLocations overdrawLocations;
+
+    GLint computeMouseLocation {-1};
+    GLint computeTimerLocation {-1};
+    GLint computeResolutionLocation {-1};
+    GLint computeStepLocation {-1};
+    GLint computeFBOScaleLocation {-1};
+
+    std::vector<UserUniform> userUniforms;
+};
+
+/*************/
+// Latest value received for a uniform
+struct ControlValue
+{
+    float values[4] {0.f, 0.f, 0.f, 0.f};
+    int count {0};
+    unsigned long serial {0};
+};
+
+/*************/
+// Inputs and controls, as last seen by the event thread
+struct InputState
+{
+    double cursor[2] {0.0, 0.0};
+    double scroll {0.0};
+    int width {0};
+    int height {0};
+    bool quit {false};
+    bool wireframe {false};
+    int instances {1};
+    bool chunkCulling {true};
+    int gpuCullingMode {0};
+    bool feedbackCaching {false};
+    bool depthPrepass {false};
+    int overdrawMode {0};
+    int hudPage {0};
+    unsigned long traceRequests {0};
+    unsigned long fileChanges {0};
+    unsigned long refreshes {0};
+};
+
 /*************/
 class shaderomatic
 {
@@ -43,6 +178,30 @@ public:
     void setSwapInterval(int pSwap);
     void setWireframe(bool wire) {mWireframe = wire;}
     void setCulling(int value) {mCullFace = value;}
+    void setSubsteps(int value) {mSubsteps = value;}
+    void setFBOFormat(std::string format);
+    void setDepthFormat(std::string format);
+    void setTextureFormat(std::string format);
+    void setFBOMipmaps(bool value) {mFBOMipmaps = value;}
+    void setSamples(int value) {mSamples = std::max(1, value);}
+    void setInstances(int value) {mInstances = std::max(1, value);}
+    void setChunkSize(int value) {mChunkSize = std::max(0, value);}
+    void setGpuCulling(int mode) {mGpuCullingMode = std::max(0, std::min(2, mode));}
+    void setBenchmark(int frames, int warmup, std::string output);
+    void setCompareShaderFile(std::string file) {mCompareShaderFile = file;}
+    void setTraceFile(std::string file) {mTraceFile = file;}
+    void setOnDemand(bool value) {mOnDemand = value;}
+    void setControlAddress(std::string address) {mControlAddress = address;}
+    void setRecordFile(std::string file) {mRecordFile = file;}
+    void setReplayFile(std::string file) {mReplayFile = file;}
+    void setReplayImages(std::string prefix) {mReplayImages = prefix;}
+    void setHeadless(bool value) {mHeadless = value;}
+    void setUnthrottled(bool value) {mUnthrottled = value;}
+    void setFeedbackCaching(bool value) {mFeedbackCaching = value;}
+    void setDepthPrepass(bool value) {mDepthPrepass = value;}
+    void setOverdraw(int mode) {mOverdrawMode = std::max(0, std::min(2, mode));}
+    void setSpecialization(int draws) {mSpecializeDraws = std::max(0, draws);}
+    void setVirtualTexturing(bool value) {mVirtualTexturing = value;}
     void init();
 
 private:
@@ -52,83 +211,203 @@ private:
     int mCullFace {0};
     std::string mImageFile {""};
     std::string mObjectFile {""};
-    std::string mVertexFile, mTessControlFile, mTessEvalFile, mGeometryFile, mFragmentFile;
+    std::string mShaderFile {"shader"};
 
-    bool mIsRunning;
+    std::atomic<bool> mIsRunning;
+    bool mOnDemand {false};
 
     boost::chrono::steady_clock::time_point mClockStart;
     float mTimePerFrame;
     cv::Mat mHUD;
 
+    float mMouse[2] {0.f, 0.f};
+    float mScroll {0.f};
+    float mTimer {0.f};
+
+    int mSubsteps {0};
+    std::string mFBOFormat {"RGBA8"};
+    std::string mDepthFormat {"D32F"};
+    std::string mTextureFormat {"auto"};
+    bool mFBOMipmaps {false};
+    int mSamples {1};
+
+    // Benchmark
+    int mBenchmarkFrames {0};
+    int mBenchmarkWarmup {0};
+    std::string mBenchmarkOutput {""};
+    std::string mCompareShaderFile {""};
+
+    // Inputs recorded, or replayed instead of the live ones
+    std::string mRecordFile {""};
+    std::string mReplayFile {""};
+    std::string mReplayImages {""};
+    bool mHeadless {false};
+    bool mUnthrottled {false};
+    InputRecord mRecord;
+    InputRecord mReplay;
+    const RecordedFrame* mReplayFrame {nullptr};
+    int mReplayIndex {0};
+
+    // Profiling
+    std::string mTraceFile {""};
+    static std::atomic<bool> mTraceRequested;
+    unsigned long mFrameIndex {0};
+    std::vector<GpuSpan> mGpuSpans;
+    float mComputeTime {0.f};
+    unsigned long mStepCount {0};
+    float mStepsPerSecond {0.f};
+
     int mTextureWidth, mTextureHeight;
     int mWindowWidth, mWindowHeight;
 
     // GLFW
     GLFWwindow* mGlfwWindow {nullptr};
-    static std::atomic<double> mScrollValue;
+
+    // Events are handled on the main thread, which publishes them to the render thread
+    InputState mControls;
+    InputState mInput;
+    TripleBuffer<InputState> mInputSnapshot;
+    FileWatcher mFileWatcher;
+    std::mutex mWakeMutex;
+    std::condition_variable mWakeCondition;
+    bool mInputPublished {false};
+
+    // Uniform values sent by other programs, coalesced once per frame
+    std::string mControlAddress {""};
+    ControlChannel mControlChannel;
+    std::map<std::string, ControlValue> mControlValues;
+    std::string mControlName; // Reused for the lookups, so that messages do not allocate
+    unsigned long mControlSerial {0};
 
     // OpengL
-    bool mShaderValid;
     bool mWireframe {false};
-    bool mTessellate {false};
+    DebugLog mDebugLog;
 
-    GLuint mScreenVertexArray;
-    GLuint mScreenVertexBuffer[2];
-    GLuint mObjectVertexArray;
-    GLuint mObjectVertexBuffer[2];
-    GLuint mTexture[2];
+    GLVertexArray mScreenVertexArray;
+    GLBuffer mScreenVertexBuffer[2];
+    GLVertexArray mObjectVertexArray;
+    GLBuffer mObjectVertexBuffer[2];
+    GLTexture mTexture[2];
 
     int mObjectVertexNumber {6};
 
-    GLuint mVertexShader;
-    GLuint mTessellationControlShader;
-    GLuint mTessellationEvaluationShader;
-    GLuint mGeometryShader;
-    GLuint mFragmentShader;
-    GLuint mShaderProgram;
-
-    GLint mMVPMatLocation;
-    GLint mMouseLocation;
-    GLint mMouseScrollLocation;
-    GLint mTimerLocation;
-    GLint mResolutionLocation;
-    GLint mTextureResLocation;
-    GLint mHUDLocation;
-    GLint mPassLocation;
-
-    std::time_t mVertexChange;
-    std::time_t mTessControlChange;
-    std::time_t mTessEvalChange;
-    std::time_t mGeometryChange;
-    std::time_t mFragmentChange;
+    // Instances of the object, each with its own transform
+    int mInstances {1};
+    GLBuffer mInstanceBuffer;
+
+    // Chunks of the object, culled against the view
+    int mChunkSize {4096};
+    bool mChunkCulling {true};
+    MeshBVH mObjectBVH;
+    std::vector<GLint> mChunkFirsts;
+    std::vector<GLsizei> mChunkCounts;
+    int mTrianglesSubmitted {0};
+    int mGpuCullingMode {0}; // 0 for none, 1 for the view, 2 adds occlusion
+    GpuCulling mGpuCulling;
+
+    // Tessellation and geometry output captured per pass, drawn again while its inputs do not change
+    bool mFeedbackCaching {false};
+    std::map<std::string, FeedbackCache> mFeedbackCaches;
+    int mCachedPrimitives {0};
+    size_t mCachedBytes {0};
+
+    // Depth of the object passes drawn first, then shaded where it is equal
+    bool mDepthPrepass {false};
+    GLVertexArray mDepthVertexArray;
+    GLShader mDepthFragmentShader;
+    std::map<std::string, SampleCounter> mOverdrawCounters;
+
+    // Fragments of the first object pass shown as a heatmap by the screen pass
+    int mOverdrawMode {0}; // 0 for none, 1 for fragments, 2 for quad invocations
+    OverdrawView mOverdrawView;
+    bool mOverdrawCounted {false};
+
+    // Uniforms unchanged for this many draws of a pass are frozen into a variant of its program
+    int mSpecializeDraws {0};
+    UniformSpecializer mSpecializer;
+    std::map<std::string, UniformLocations> mSpecializedLocations;
+
+    // Image streamed as tiles, read with vtTexture
+    bool mVirtualTexturing {false};
+    VirtualTexture mVirtualTexture;
+
+    // Files read on worker threads while the context is created, then uploaded as they are ready
+    struct MeshData
+    {
+        std::vector<float> vertices;
+        std::vector<float> texCoords;
+    };
+    StartupTimeline mStartup;
+    std::map<std::string, std::string> mPreloadedSources;
+
+    std::map<std::string, ShaderSet> mShaders;
     std::time_t mImageChange;
 
-    GLuint mFBO;
-    GLuint mFBOTexture[2];
-    GLuint mFBODepthTexture;
+    RenderGraph mRenderGraph;
 
     // Methods
     void settings();
+    void release();
+    // Returns false if a shader could not be benchmarked
+    bool runBenchmark();
+    void runReplay();
+    void saveFrameImage();
+    Benchmark benchmarkShader();
 
-    static void glMsgCallback(GLenum, GLenum, GLuint, GLenum, GLsizei, const GLchar*, const void*);
     static void scrollCallback(GLFWwindow*, double, double);
+    static void cursorCallback(GLFWwindow*, double, double);
+    static void keyCallback(GLFWwindow*, int, int, int, int);
+    static void windowSizeCallback(GLFWwindow*, int, int);
+    static void windowRefreshCallback(GLFWwindow*);
+    static void traceSignalHandler(int);
 
-    void prepareFBO();
+    void prepareRenderGraph();
+    void updateTargetUsage();
+    bool usesExplicitLod(ShaderSet& pShader);
     bool prepareScreenGeometry();
-    bool prepareObjectGeometry();
+    bool readObjectFile(MeshData& mesh);
+    bool prepareObjectGeometry(const MeshData& mesh);
+    void prepareInstances();
     void prepareTexture();
-    bool compileShader();
+    bool compileShader(ShaderSet& pShader);
     bool verifyShader(GLuint pShader);
     bool verifyProgram(GLuint pProgram);
+    void listUserUniforms(ShaderSet& pShader, GLuint pProgram);
+    void forgetUserUniforms(ShaderSet& pShader, GLuint pProgram);
+    void getUniformLocations(GLuint pProgram, UniformLocations& pLocations);
+    std::vector<GLuint> getPreRasterShaders(ShaderSet& pShader);
+    void prepareFeedbackPrograms(ShaderSet& pShader);
+    void prepareDepthProgram(ShaderSet& pShader);
+    void prepareOverdrawProgram(ShaderSet& pShader);
+    void prepareSpecializedProgram(ShaderSet& pShader, RenderPass* pass, GLuint pPrevious);
+    std::map<std::string, std::vector<double>> getSpecializationValues(ShaderSet& pShader, RenderPass* pass, const glm::mat4& mvp);
+    std::vector<double> getFeedbackKey(ShaderSet& pShader, RenderPass* pass);
+    void setPassUniforms(GLuint program, const UniformLocations& locations, RenderPass* pass, const glm::mat4& mvp);
+    void eventLoop();
+    void renderLoop();
+    void publishInput();
+    void wakeRenderer();
+    bool applyControlValues();
+    bool applyControls(const InputState& previous);
+
+    bool checkFiles();
+    std::vector<std::string> getWatchedFiles();
+    void getUsedInputs(bool& animated, bool& mouse, bool& scroll);
     void draw();
+    void drawPass(RenderPass* pass);
+    void dispatchCompute(ComputePass* compute);
 
-    bool loadTexture(const char* pFilename, GLuint pTexture);
+    bool readImage(const char* pFilename, ImageLoader::Upload& pUpload);
+    bool uploadImage(const ImageLoader::Upload& pUpload, GLuint pTexture);
     bool updateTexture(const char* pFilename, GLuint pTexture);
+    bool loadVirtualTexture(GLuint pTexture);
     bool textureChanged();
     void prepareHUDTexture();
 
+    std::map<std::string, std::string> preloadShaders();
     char* readFile(const char* pFile);
-    bool shaderChanged();
+    ShaderSet& getShader(const std::string& pBase);
+    bool shaderChanged(ShaderSet& pShader);
 };
 
 #endif // SHADEROMATIC_H
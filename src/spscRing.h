@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @spscRing.h
+ * Lock-free ring buffer, between a single producer and a single consumer
+ */
+
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+
+/*************/
+// Size must be a power of two, one slot is kept empty
+template <typename T, size_t Size>
+class SpscRing
+{
+public:
+    // Producer side, returns false if the ring is full
+    bool push(const T& value)
+    {
+        size_t lHead = mHead.load(std::memory_order_relaxed);
+        size_t lNext = (lHead + 1) & (Size - 1);
+        if (lNext == mTail.load(std::memory_order_acquire))
+            return false;
+        mItems[lHead] = value;
+        mHead.store(lNext, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, returns false if the ring is empty
+    bool pop(T& value)
+    {
+        size_t lTail = mTail.load(std::memory_order_relaxed);
+        if (lTail == mHead.load(std::memory_order_acquire))
+            return false;
+        value = mItems[lTail];
+        mTail.store((lTail + 1) & (Size - 1), std::memory_order_release);
+        return true;
+    }
+
+private:
+    static_assert((Size & (Size - 1)) == 0, "SpscRing size must be a power of two");
+
+    T mItems[Size];
+    std::atomic<size_t> mHead {0};
+    std::atomic<size_t> mTail {0};
+};
+
+#endif // SPSCRING_H
@@ -0,0 +1,60 @@
+#include "startupTimeline.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+/*************/
+void StartupTimeline::start()
+{
+    lock_guard<mutex> lLock(mMutex);
+    mOrigin = chrono::steady_clock::now();
+    mEntries.clear();
+    mThreads.clear();
+    mThreads.push_back(this_thread::get_id());
+    mIsDone = false;
+}
+
+/*************/
+void StartupTimeline::add(const char* name, chrono::steady_clock::time_point start, chrono::steady_clock::time_point end)
+{
+    lock_guard<mutex> lLock(mMutex);
+    if (mIsDone)
+        return;
+
+    // Threads are numbered in the order they are seen, the one calling start() first
+    auto lThreadIt = find(mThreads.begin(), mThreads.end(), this_thread::get_id());
+    if (lThreadIt == mThreads.end())
+        lThreadIt = mThreads.insert(mThreads.end(), this_thread::get_id());
+
+    Entry lEntry;
+    lEntry.name = name;
+    lEntry.start = chrono::duration<double, milli>(start - mOrigin).count();
+    lEntry.end = chrono::duration<double, milli>(end - mOrigin).count();
+    lEntry.thread = lThreadIt - mThreads.begin();
+    mEntries.push_back(lEntry);
+}
+
+/*************/
+void StartupTimeline::firstFrame()
+{
+    lock_guard<mutex> lLock(mMutex);
+    if (mIsDone)
+        return;
+    mIsDone = true;
+
+    sort(mEntries.begin(), mEntries.end(), [](const Entry& a, const Entry& b) {return a.start < b.start;});
+
+    ios::fmtflags lFlags = cout.flags();
+    streamsize lPrecision = cout.precision();
+    cout << fixed << setprecision(1);
+    cout << "Startup timeline (msec, thread 0 is the main one):" << endl;
+    for (auto& entry : mEntries)
+        cout << "  " << setw(8) << entry.start << " - " << setw(8) << entry.end << "  [" << entry.thread << "] " << entry.name
+             << " (" << entry.end - entry.start << ")" << endl;
+    cout << "First frame after " << chrono::duration<double, milli>(chrono::steady_clock::now() - mOrigin).count() << " msec" << endl;
+    cout.flags(lFlags);
+    cout.precision(lPrecision);
+}
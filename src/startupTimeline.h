@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @startupTimeline.h
+ * Records the steps of the startup, on whichever thread they run, and
+ * prints them along with the time to the first frame
+ */
+
+#ifndef STARTUPTIMELINE_H
+#define STARTUPTIMELINE_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+
+/*************/
+class StartupTimeline
+{
+public:
+    // Spans a step from its construction to its destruction
+    class Step
+    {
+    public:
+        Step(StartupTimeline& timeline, const char* name) : mTimeline(timeline), mName(name), mScope(name)
+        {
+            mStart = std::chrono::steady_clock::now();
+        }
+
+        ~Step()
+        {
+            mTimeline.add(mName, mStart, std::chrono::steady_clock::now());
+        }
+
+    private:
+        StartupTimeline& mTimeline;
+        const char* mName;
+        ProfileScope mScope;
+        std::chrono::steady_clock::time_point mStart;
+    };
+
+    void start();
+    void add(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+    // Prints the steps once, at the first frame
+    void firstFrame();
+
+private:
+    struct Entry
+    {
+        std::string name;
+        double start;
+        double end;
+        int thread;
+    };
+
+    std::mutex mMutex;
+    std::chrono::steady_clock::time_point mOrigin {std::chrono::steady_clock::now()};
+    std::vector<Entry> mEntries;
+    std::vector<std::thread::id> mThreads;
+    bool mIsDone {false};
+};
+
+#endif // STARTUPTIMELINE_H
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @tripleBuffer.h
+ * Lock-free snapshot of a value, written by one thread and read by another
+ *
+ * The writer fills its own buffer then swaps it with the shared one, the
+ * reader swaps the shared one with its own when it has been refreshed.
+ * Neither side ever waits, and the reader always gets the latest value.
+ */
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+/*************/
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Writer side
+    void write(const T& value)
+    {
+        mBuffers[mBack] = value;
+        int lPrevious = mMiddle.exchange(mBack | FRESH, std::memory_order_acq_rel);
+        mBack = lPrevious & INDEX;
+    }
+
+    // Reader side, returns false if nothing was written since the last read
+    bool read(T& value)
+    {
+        if ((mMiddle.load(std::memory_order_acquire) & FRESH) == 0)
+            return false;
+        int lPrevious = mMiddle.exchange(mFront, std::memory_order_acq_rel);
+        mFront = lPrevious & INDEX;
+        value = mBuffers[mFront];
+        return true;
+    }
+
+private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;
+
+    T mBuffers[3];
+    int mBack {0};
+    std::atomic<int> mMiddle {1};
+    int mFront {2};
+};
+
+#endif // TRIPLEBUFFER_H
@@ -0,0 +1,569 @@
+#include "uniformSpecializer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <regex>
+
+using namespace std;
+
+// GPU times are read back a few frames late, those following a swap are not accounted
+#define SPECIALIZE_SETTLE_DRAWS 8
+
+/*************/
+UniformSpecializer::~UniformSpecializer()
+{
+    stop();
+}
+
+/*************/
+bool UniformSpecializer::start(GLFWwindow* window, int draws)
+{
+    if (mWindow != nullptr)
+        return true;
+
+    // Same hints as the main window, which are still set, but never shown
+    glfwWindowHint(GLFW_VISIBLE, false);
+    mWindow = glfwCreateWindow(16, 16, "shader-0-matic compiler", nullptr, window);
+    if (mWindow == nullptr)
+    {
+        cerr << "Uniform specialization: unable to create the compile context." << endl;
+        return false;
+    }
+
+    mDraws = max(1, draws);
+    mStopping = false;
+    mThread = thread(&UniformSpecializer::run, this);
+    return true;
+}
+
+/*************/
+void UniformSpecializer::stop()
+{
+    if (mWindow == nullptr)
+        return;
+
+    {
+        lock_guard<mutex> lLock(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_one();
+    if (mThread.joinable())
+        mThread.join();
+    glfwDestroyWindow(mWindow);
+    mWindow = nullptr;
+
+    mQueue.clear();
+    mPasses.clear();
+    mRetired.clear();
+}
+
+/*************/
+void UniformSpecializer::run()
+{
+    glfwMakeContextCurrent(mWindow);
+    while (true)
+    {
+        Job* lJob = nullptr;
+        {
+            unique_lock<mutex> lLock(mMutex);
+            mCondition.wait(lLock, [&]() {return mStopping || !mQueue.empty();});
+            if (mStopping)
+                break;
+            lJob = mQueue.front();
+            mQueue.pop_front();
+        }
+
+        compile(*lJob);
+        // The program is complete before the render thread uses it
+        glFinish();
+        lJob->done = true;
+    }
+    glfwMakeContextCurrent(nullptr);
+}
+
+/*************/
+void UniformSpecializer::compile(Job& job)
+{
+    for (auto& stage : job.stages)
+    {
+        if (!stage.source.empty())
+        {
+            const GLchar* lSource = stage.source.c_str();
+            glShaderSource(stage.shader, 1, &lSource, nullptr);
+            glCompileShader(stage.shader);
+
+            GLint lStatus;
+            glGetShaderiv(stage.shader, GL_COMPILE_STATUS, &lStatus);
+            if (!lStatus)
+            {
+                GLchar lLog[1024];
+                glGetShaderInfoLog(stage.shader, sizeof(lLog), nullptr, lLog);
+                job.log = lLog;
+                return;
+            }
+        }
+        glAttachShader(job.program, stage.shader);
+    }
+
+    for (auto& attribute : job.attributes)
+        glBindAttribLocation(job.program, attribute.second, attribute.first.c_str());
+    glLinkProgram(job.program);
+
+    GLint lStatus;
+    glGetProgramiv(job.program, GL_LINK_STATUS, &lStatus);
+    if (!lStatus)
+    {
+        GLchar lLog[1024];
+        glGetProgramInfoLog(job.program, sizeof(lLog), nullptr, lLog);
+        job.log = lLog;
+        return;
+    }
+    job.linked = true;
+}
+
+/*************/
+bool UniformSpecializer::update(const string& pass, GLuint generic, const vector<GLuint>& shaders,
+                                const map<string, vector<double>>& values, bool fragmentOnly)
+{
+    for (auto it = mRetired.begin(); it != mRetired.end();)
+        it = (*it)->done ? mRetired.erase(it) : it + 1;
+
+    PassState& lState = mPasses[pass];
+    GLuint lPrevious = lState.program;
+
+    // Variants sharing the other stages with the generic program, or not, are not interchangeable
+    if (fragmentOnly != lState.fragmentOnly)
+    {
+        drop(lState);
+        retire(lState.job);
+        lState.failed.clear();
+        lState.fragmentOnly = fragmentOnly;
+    }
+
+    // Draws for which each uniform kept its value
+    for (auto it = lState.uniforms.begin(); it != lState.uniforms.end();)
+        it = values.find(it->first) == values.end() ? lState.uniforms.erase(it) : next(it);
+    map<string, vector<double>> lStable;
+    for (auto& value : values)
+    {
+        Tracked& lTracked = lState.uniforms[value.first];
+        if (lTracked.value != value.second)
+        {
+            lTracked.value = value.second;
+            lTracked.draws = 0;
+        }
+        lTracked.draws = min(lTracked.draws + 1, mDraws);
+        if (lTracked.draws >= mDraws)
+            lStable[value.first] = value.second;
+    }
+
+    // Back to the generic program as soon as a frozen value changes
+    for (auto& frozen : lState.frozen)
+    {
+        auto lValueIt = values.find(frozen.first);
+        if (lValueIt != values.end() && lValueIt->second == frozen.second)
+            continue;
+
+        cout << "Uniform specialization: " << frozen.first << " changed, " << pass << " is drawn with the generic program again" << endl;
+        float lGeneric = getGenericTime(pass), lSpecialized = getSpecializedTime(pass);
+        if (lGeneric > 0.f && lSpecialized > 0.f)
+            cout << "Uniform specialization: " << pass << " took " << lGeneric << " msec with the generic program, "
+                 << lSpecialized << " msec with its variants" << endl;
+        drop(lState);
+        break;
+    }
+
+    // Linked variants are swapped in if what they froze still holds
+    if (lState.job && lState.job->done)
+    {
+        unique_ptr<Job> lJob = move(lState.job);
+        bool lHolds = true;
+        for (auto& frozen : lJob->frozen)
+        {
+            auto lValueIt = values.find(frozen.first);
+            lHolds &= lValueIt != values.end() && lValueIt->second == frozen.second;
+        }
+
+        if (!lJob->linked)
+        {
+            cerr << "Uniform specialization: failed to build the variant of " << pass << "." << endl << lJob->log << endl;
+            lState.failed = lJob->requested;
+        }
+        else if (lHolds)
+        {
+            drop(lState);
+            lState.program = move(lJob->program);
+            lState.shaders = move(lJob->shaders);
+            lState.requested = lJob->requested;
+            lState.frozen = lJob->frozen;
+            copyUniforms(generic, lState.program);
+            lState.settle = SPECIALIZE_SETTLE_DRAWS;
+
+            string lNames;
+            for (auto& frozen : lState.frozen)
+                lNames += (lNames.size() ? ", " : "") + frozen.first;
+            cout << "Uniform specialization: " << pass << " uses a variant with " << lState.frozen.size() << " uniforms frozen (" << lNames << ")" << endl;
+        }
+    }
+
+    // A new variant once more uniforms are stable
+    if (!lState.job && !lStable.empty() && lStable != lState.requested && lStable != lState.failed)
+        submit(lState, generic, shaders, lStable);
+
+    return lState.program.get() != lPrevious;
+}
+
+/*************/
+void UniformSpecializer::submit(PassState& state, GLuint generic, const vector<GLuint>& shaders,
+                                const map<string, vector<double>>& stable)
+{
+    // Types of the stable uniforms, and values of those not given
+    map<string, pair<GLenum, vector<double>>> lValues;
+    GLint lCount = 0;
+    glGetProgramiv(generic, GL_ACTIVE_UNIFORMS, &lCount);
+    for (GLint i = 0; i < lCount; ++i)
+    {
+        GLchar lName[256];
+        GLint lSize;
+        GLenum lType;
+        glGetActiveUniform(generic, i, sizeof(lName), nullptr, &lSize, &lType, lName);
+
+        int lComponents;
+        char lBase;
+        auto lStableIt = stable.find(lName);
+        if (lSize != 1 || lStableIt == stable.end() || !getTypeInfo(lType, lComponents, lBase) || lBase == 's')
+            continue;
+
+        vector<double> lValue = lStableIt->second;
+        if (lValue.empty())
+        {
+            GLint lLocation = glGetUniformLocation(generic, lName);
+            GLfloat lFloats[16];
+            GLint lInts[16];
+            GLuint lUints[16];
+            if (lBase == 'f')
+                glGetUniformfv(generic, lLocation, lFloats);
+            else if (lBase == 'u')
+                glGetUniformuiv(generic, lLocation, lUints);
+            else
+                glGetUniformiv(generic, lLocation, lInts);
+            for (int c = 0; c < lComponents; ++c)
+                lValue.push_back(lBase == 'f' ? (double)lFloats[c] : lBase == 'u' ? (double)lUints[c] : (double)lInts[c]);
+        }
+        lValues[lName] = make_pair(lType, lValue);
+    }
+
+    // Declarations of the stable uniforms become constants, stages without any are shared
+    unique_ptr<Job> lJob(new Job());
+    lJob->requested = stable;
+    for (auto shader : shaders)
+    {
+        Stage lStage;
+        lStage.shader = shader;
+        GLint lType = 0;
+        glGetShaderiv(shader, GL_SHADER_TYPE, &lType);
+        if (!state.fragmentOnly || lType == GL_FRAGMENT_SHADER)
+        {
+            GLint lLength = 0;
+            glGetShaderiv(shader, GL_SHADER_SOURCE_LENGTH, &lLength);
+            string lSource(lLength, '\0');
+            glGetShaderSource(shader, lLength, nullptr, &lSource[0]);
+            lSource.resize(strlen(lSource.c_str()));
+
+            bool lChanged = false;
+            for (auto& value : lValues)
+            {
+                regex lDeclaration("(layout\\s*\\([^)]*\\)\\s*)?uniform\\s+((lowp|mediump|highp)\\s+)?(\\w+)\\s+" + value.first + "\\s*(=[^;]*)?;");
+                smatch lMatch;
+                if (!regex_search(lSource, lMatch, lDeclaration))
+                    continue;
+                string lLiteral = getLiteral(lMatch[4].str(), value.second.first, value.second.second);
+                if (lLiteral.empty())
+                    continue;
+
+                lSource = lMatch.prefix().str() + "const " + lMatch[4].str() + " " + value.first + " = " + lLiteral + ";" + lMatch.suffix().str();
+                lJob->frozen[value.first] = stable.at(value.first);
+                lChanged = true;
+            }
+
+            if (lChanged)
+            {
+                lJob->shaders.push_back(GLShader());
+                lStage.shader = lJob->shaders.back().create("specialized", lType);
+                lStage.source = lSource;
+            }
+        }
+        lJob->stages.push_back(lStage);
+    }
+
+    if (lJob->frozen.empty())
+    {
+        state.failed = stable;
+        return;
+    }
+
+    // Vertex attributes where the generic program has them
+    GLint lAttributes = 0;
+    glGetProgramiv(generic, GL_ACTIVE_ATTRIBUTES, &lAttributes);
+    for (GLint i = 0; i < lAttributes; ++i)
+    {
+        GLchar lName[256];
+        GLint lSize;
+        GLenum lType;
+        glGetActiveAttrib(generic, i, sizeof(lName), nullptr, &lSize, &lType, lName);
+        GLint lLocation = glGetAttribLocation(generic, lName);
+        if (lLocation >= 0)
+            lJob->attributes.push_back(make_pair(string(lName), lLocation));
+    }
+
+    // Objects created here are seen by the compile context once flushed
+    lJob->program.create("specialized");
+    glFlush();
+    {
+        lock_guard<mutex> lLock(mMutex);
+        mQueue.push_back(lJob.get());
+    }
+    mCondition.notify_one();
+    state.job = move(lJob);
+}
+
+/*************/
+void UniformSpecializer::drop(PassState& state)
+{
+    if (state.program != 0)
+        state.settle = SPECIALIZE_SETTLE_DRAWS;
+    state.program.reset();
+    state.shaders.clear();
+    state.requested.clear();
+    state.frozen.clear();
+}
+
+/*************/
+void UniformSpecializer::retire(unique_ptr<Job>& job)
+{
+    if (!job)
+        return;
+
+    // Jobs still waiting are simply removed, those being compiled are kept until done
+    bool lQueued = false;
+    {
+        lock_guard<mutex> lLock(mMutex);
+        auto lJobIt = find(mQueue.begin(), mQueue.end(), job.get());
+        if (lJobIt != mQueue.end())
+        {
+            mQueue.erase(lJobIt);
+            lQueued = true;
+        }
+    }
+    if (!lQueued && !job->done)
+        mRetired.push_back(move(job));
+    job.reset();
+}
+
+/*************/
+void UniformSpecializer::forget(const string& pass)
+{
+    auto lStateIt = mPasses.find(pass);
+    if (lStateIt == mPasses.end())
+        return;
+
+    drop(lStateIt->second);
+    retire(lStateIt->second.job);
+    mPasses.erase(lStateIt);
+}
+
+/*************/
+GLuint UniformSpecializer::getProgram(const string& pass) const
+{
+    auto lStateIt = mPasses.find(pass);
+    return lStateIt != mPasses.end() ? lStateIt->second.program.get() : 0;
+}
+
+/*************/
+int UniformSpecializer::getFrozenCount(const string& pass) const
+{
+    auto lStateIt = mPasses.find(pass);
+    return lStateIt != mPasses.end() ? lStateIt->second.frozen.size() : 0;
+}
+
+/*************/
+void UniformSpecializer::addTime(const string& pass, float msec)
+{
+    auto lStateIt = mPasses.find(pass);
+    if (lStateIt == mPasses.end())
+        return;
+
+    PassState& lState = lStateIt->second;
+    if (lState.settle > 0)
+    {
+        lState.settle--;
+        return;
+    }
+    int lVariant = lState.program != 0 ? 1 : 0;
+    lState.times[lVariant] += msec;
+    lState.timed[lVariant]++;
+}
+
+/*************/
+float UniformSpecializer::getGenericTime(const string& pass) const
+{
+    auto lStateIt = mPasses.find(pass);
+    if (lStateIt == mPasses.end() || lStateIt->second.timed[0] == 0)
+        return 0.f;
+    return lStateIt->second.times[0] / lStateIt->second.timed[0];
+}
+
+/*************/
+float UniformSpecializer::getSpecializedTime(const string& pass) const
+{
+    auto lStateIt = mPasses.find(pass);
+    if (lStateIt == mPasses.end() || lStateIt->second.timed[1] == 0)
+        return 0.f;
+    return lStateIt->second.times[1] / lStateIt->second.timed[1];
+}
+
+/*************/
+bool UniformSpecializer::getTypeInfo(GLenum type, int& components, char& base)
+{
+    switch (type)
+    {
+    case GL_FLOAT: components = 1; base = 'f'; return true;
+    case GL_FLOAT_VEC2: components = 2; base = 'f'; return true;
+    case GL_FLOAT_VEC3: components = 3; base = 'f'; return true;
+    case GL_FLOAT_VEC4: components = 4; base = 'f'; return true;
+    case GL_FLOAT_MAT2: components = 4; base = 'f'; return true;
+    case GL_FLOAT_MAT3: components = 9; base = 'f'; return true;
+    case GL_FLOAT_MAT4: components = 16; base = 'f'; return true;
+    case GL_INT: components = 1; base = 'i'; return true;
+    case GL_INT_VEC2: components = 2; base = 'i'; return true;
+    case GL_INT_VEC3: components = 3; base = 'i'; return true;
+    case GL_INT_VEC4: components = 4; base = 'i'; return true;
+    case GL_UNSIGNED_INT: components = 1; base = 'u'; return true;
+    case GL_UNSIGNED_INT_VEC2: components = 2; base = 'u'; return true;
+    case GL_UNSIGNED_INT_VEC3: components = 3; base = 'u'; return true;
+    case GL_UNSIGNED_INT_VEC4: components = 4; base = 'u'; return true;
+    case GL_BOOL: components = 1; base = 'b'; return true;
+    case GL_BOOL_VEC2: components = 2; base = 'b'; return true;
+    case GL_BOOL_VEC3: components = 3; base = 'b'; return true;
+    case GL_BOOL_VEC4: components = 4; base = 'b'; return true;
+    // Units of samplers and images are copied to the variants, never frozen
+    case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_2D_MULTISAMPLE: case GL_SAMPLER_BUFFER: case GL_SAMPLER_2D_SHADOW:
+    case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+    case GL_IMAGE_2D: case GL_INT_IMAGE_2D: case GL_UNSIGNED_INT_IMAGE_2D:
+        components = 1; base = 's'; return true;
+    default:
+        return false;
+    }
+}
+
+/*************/
+string UniformSpecializer::getLiteral(const string& type, GLenum glType, const vector<double>& values)
+{
+    int lComponents;
+    char lBase;
+    if (!getTypeInfo(glType, lComponents, lBase) || lBase == 's')
+        return "";
+
+    // Constructors of the declared type, which take scalars of any kind
+    string lLiteral = type + "(";
+    for (int c = 0; c < lComponents; ++c)
+    {
+        double lValue = c < values.size() ? values[c] : 0.0;
+        char lText[32];
+        if (lBase == 'f')
+        {
+            if (!std::isfinite(lValue))
+                return "";
+            snprintf(lText, sizeof(lText), "%.9g", lValue);
+        }
+        else if (lBase == 'u')
+            snprintf(lText, sizeof(lText), "%luu", (unsigned long)lValue);
+        else if (lBase == 'i')
+            snprintf(lText, sizeof(lText), "%ld", (long)lValue);
+        else
+            snprintf(lText, sizeof(lText), "%s", lValue != 0.0 ? "true" : "false");
+        lLiteral += string(c > 0 ? ", " : "") + lText;
+    }
+    return lLiteral + ")";
+}
+
+/*************/
+void UniformSpecializer::copyUniforms(GLuint from, GLuint to)
+{
+    // Values of the uniforms left, so that the variant draws the same as the generic program
+    GLint lCount = 0;
+    glGetProgramiv(to, GL_ACTIVE_UNIFORMS, &lCount);
+    for (GLint i = 0; i < lCount; ++i)
+    {
+        GLchar lName[256];
+        GLint lSize;
+        GLenum lType;
+        glGetActiveUniform(to, i, sizeof(lName), nullptr, &lSize, &lType, lName);
+
+        int lComponents;
+        char lBase;
+        if (!getTypeInfo(lType, lComponents, lBase))
+            continue;
+
+        string lArray = lName;
+        if (lArray.size() > 3 && lArray.substr(lArray.size() - 3) == "[0]")
+            lArray.resize(lArray.size() - 3);
+        for (GLint e = 0; e < lSize; ++e)
+        {
+            string lElement = lSize > 1 ? lArray + "[" + to_string(e) + "]" : string(lName);
+            GLint lFrom = glGetUniformLocation(from, lElement.c_str());
+            GLint lTo = glGetUniformLocation(to, lElement.c_str());
+            if (lFrom < 0 || lTo < 0)
+                continue;
+
+            GLfloat lFloats[16];
+            GLint lInts[16];
+            GLuint lUints[16];
+            if (lBase == 'f')
+            {
+                glGetUniformfv(from, lFrom, lFloats);
+                if (lType == GL_FLOAT_MAT2)
+                    glProgramUniformMatrix2fv(to, lTo, 1, GL_FALSE, lFloats);
+                else if (lType == GL_FLOAT_MAT3)
+                    glProgramUniformMatrix3fv(to, lTo, 1, GL_FALSE, lFloats);
+                else if (lType == GL_FLOAT_MAT4)
+                    glProgramUniformMatrix4fv(to, lTo, 1, GL_FALSE, lFloats);
+                else if (lComponents == 1)
+                    glProgramUniform1fv(to, lTo, 1, lFloats);
+                else if (lComponents == 2)
+                    glProgramUniform2fv(to, lTo, 1, lFloats);
+                else if (lComponents == 3)
+                    glProgramUniform3fv(to, lTo, 1, lFloats);
+                else
+                    glProgramUniform4fv(to, lTo, 1, lFloats);
+            }
+            else if (lBase == 'u')
+            {
+                glGetUniformuiv(from, lFrom, lUints);
+                if (lComponents == 1)
+                    glProgramUniform1uiv(to, lTo, 1, lUints);
+                else if (lComponents == 2)
+                    glProgramUniform2uiv(to, lTo, 1, lUints);
+                else if (lComponents == 3)
+                    glProgramUniform3uiv(to, lTo, 1, lUints);
+                else
+                    glProgramUniform4uiv(to, lTo, 1, lUints);
+            }
+            else
+            {
+                glGetUniformiv(from, lFrom, lInts);
+                if (lComponents == 1)
+                    glProgramUniform1iv(to, lTo, 1, lInts);
+                else if (lComponents == 2)
+                    glProgramUniform2iv(to, lTo, 1, lInts);
+                else if (lComponents == 3)
+                    glProgramUniform3iv(to, lTo, 1, lInts);
+                else
+                    glProgramUniform4iv(to, lTo, 1, lInts);
+            }
+        }
+    }
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @uniformSpecializer.h
+ * Freezes the uniforms of a pass which have not changed for a number of
+ * draws into constants, in a variant of its program
+ *
+ * Declarations of the stable uniforms are replaced with const ones in the
+ * sources of the program, which are then compiled and linked on a hidden
+ * context sharing the objects of the main one, on a thread of its own.
+ * The variant is swapped in once linked, and dropped as soon as one of
+ * the values it froze changes. GPU times of the pass are accounted to the
+ * program it was drawn with, so that both can be compared.
+ */
+
+#ifndef UNIFORMSPECIALIZER_H
+#define UNIFORMSPECIALIZER_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "GLFW/glfw3.h"
+
+#include "glObject.h"
+
+/*************/
+class UniformSpecializer
+{
+public:
+    ~UniformSpecializer();
+
+    // Creates the hidden context and its thread, from the main thread.
+    // Uniforms are frozen once they kept their value for the given number of draws
+    bool start(GLFWwindow* window, int draws);
+    // Stops the thread and deletes the variants, with the main context current
+    void stop();
+    bool isStarted() const {return mWindow != nullptr;}
+
+    // Follows the values of the uniforms of a pass which may be frozen, an empty value
+    // being read from the generic program when needed. With fragmentOnly, the other
+    // stages are shared with the generic program. Returns true when the program to
+    // draw the pass with changed
+    bool update(const std::string& pass, GLuint generic, const std::vector<GLuint>& shaders,
+                const std::map<std::string, std::vector<double>>& values, bool fragmentOnly);
+    // Drops the variant of a pass, after its generic program changed
+    void forget(const std::string& pass);
+
+    // Variant to draw the pass with, or 0 for the generic program
+    GLuint getProgram(const std::string& pass) const;
+    int getFrozenCount(const std::string& pass) const;
+
+    // GPU time of the pass, accounted to the program it was last drawn with
+    void addTime(const std::string& pass, float msec);
+    // Average times with the generic program and with its variants, 0 until measured
+    float getGenericTime(const std::string& pass) const;
+    float getSpecializedTime(const std::string& pass) const;
+
+private:
+    struct Stage
+    {
+        GLuint shader {0};
+        std::string source; // Empty for a shader of the generic program, attached as is
+    };
+
+    struct Job
+    {
+        std::vector<Stage> stages;
+        std::vector<GLShader> shaders;
+        GLProgram program;
+        std::vector<std::pair<std::string, GLint>> attributes;
+        std::map<std::string, std::vector<double>> requested; // Stable values it was submitted for
+        std::map<std::string, std::vector<double>> frozen;
+        std::string log;
+        bool linked {false};
+        std::atomic<bool> done {false};
+    };
+
+    struct Tracked
+    {
+        std::vector<double> value;
+        int draws {0};
+    };
+
+    struct PassState
+    {
+        bool fragmentOnly {false};
+        std::map<std::string, Tracked> uniforms;
+        std::unique_ptr<Job> job;
+        std::map<std::string, std::vector<double>> failed; // Last stable values no variant could be built for
+
+        GLProgram program;
+        std::vector<GLShader> shaders;
+        std::map<std::string, std::vector<double>> requested;
+        std::map<std::string, std::vector<double>> frozen;
+
+        int settle {0};
+        double times[2] {0.0, 0.0};
+        int timed[2] {0, 0};
+    };
+
+    GLFWwindow* mWindow {nullptr};
+    int mDraws {0};
+    std::map<std::string, PassState> mPasses;
+    std::vector<std::unique_ptr<Job>> mRetired; // Jobs dropped while compiling
+
+    std::thread mThread;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<Job*> mQueue;
+    bool mStopping {false};
+
+    // Compile thread only
+    void run();
+    void compile(Job& job);
+
+    void submit(PassState& state, GLuint generic, const std::vector<GLuint>& shaders,
+                const std::map<std::string, std::vector<double>>& stable);
+    void drop(PassState& state);
+    void retire(std::unique_ptr<Job>& job);
+
+    static bool getTypeInfo(GLenum type, int& components, char& base);
+    static std::string getLiteral(const std::string& type, GLenum glType, const std::vector<double>& values);
+    static void copyUniforms(GLuint from, GLuint to);
+};
+
+#endif // UNIFORMSPECIALIZER_H
@@ -0,0 +1,701 @@
+#include "virtualTexture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+#include "boost/filesystem.hpp"
+
+#include "glState.h"
+#include "parallel.h"
+
+using namespace std;
+
+#define VT_VERSION 1
+#define VT_PAYLOAD (VT_TILE_SIZE - 2 * VT_TILE_BORDER)
+#define VT_TILE_BYTES (VT_TILE_SIZE * VT_TILE_SIZE * 4)
+// Units and binding kept clear of the user shaders and of the culling
+#define VT_PAGE_TABLE_UNIT 12
+#define VT_CACHE_UNIT 13
+#define VT_FEEDBACK_BINDING 8
+#define VT_FEEDBACK_SIZE 4096
+#define VT_FEEDBACK_COUNT 3
+#define VT_UPLOADS_PER_FRAME 16
+#define VT_QUEUE_SIZE 256
+
+// Tiles are named after their level and position, packed the same way by the shaders
+#define VT_KEY(level, x, y) (((uint32_t)(level) << 28) | ((uint32_t)(x) << 14) | (uint32_t)(y))
+#define VT_LEVEL(key) ((int)((key) >> 28))
+#define VT_X(key) ((int)(((key) >> 14) & 0x3FFF))
+#define VT_Y(key) ((int)((key) & 0x3FFF))
+
+char gVirtualTextureHelper[] =
+    "#extension GL_ARB_shader_storage_buffer_object : enable\n"
+    "\n"
+    "uniform usampler2D vtPageTable;\n"
+    "uniform sampler2D vtCache;\n"
+    "uniform vec4 vtInfo; // Size of the image, levels, tiles per side of the cache\n"
+    "uniform int vtFrame;\n"
+    "layout(std430) buffer vtFeedback {uint vtRequests[];};\n"
+    "\n"
+    "vec4 vtTexture(vec2 uv)\n"
+    "{\n"
+    "    const float payload = 124.0;\n"
+    "    const float tileSize = 128.0;\n"
+    "    vec2 coords = clamp(uv, vec2(0.0), vec2(1.0));\n"
+    "    vec2 dx = dFdx(uv * vtInfo.xy);\n"
+    "    vec2 dy = dFdy(uv * vtInfo.xy);\n"
+    "    int levels = int(vtInfo.z);\n"
+    "    int level = int(min(floor(0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0))), vtInfo.z - 1.0));\n"
+    "\n"
+    "    // One fragment out of 16 asks for its tile, a different one at each frame\n"
+    "    ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;\n"
+    "    if (pixel.x + pixel.y * 4 == vtFrame % 16)\n"
+    "    {\n"
+    "        vec2 levelSize = ceil(vtInfo.xy / exp2(float(level)));\n"
+    "        uvec2 tile = uvec2(min(coords * levelSize, levelSize - 0.5) / payload);\n"
+    "        uint request = (uint(level) << 28) | (tile.x << 14) | tile.y;\n"
+    "        vtRequests[((tile.x * 73856093u) ^ (tile.y * 19349663u) ^ (uint(level) * 83492791u)) % uint(vtRequests.length())] = request;\n"
+    "    }\n"
+    "\n"
+    "    // The finest level which is resident\n"
+    "    for (int l = level; l < levels; ++l)\n"
+    "    {\n"
+    "        vec2 levelSize = ceil(vtInfo.xy / exp2(float(l)));\n"
+    "        vec2 texel = min(coords * levelSize, levelSize - 0.5);\n"
+    "        ivec2 tile = ivec2(texel / payload);\n"
+    "        uvec4 entry = texelFetch(vtPageTable, tile, l);\n"
+    "        if (entry.z != 0u)\n"
+    "        {\n"
+    "            vec2 inTile = texel - vec2(tile) * payload + 2.0;\n"
+    "            return textureLod(vtCache, (vec2(entry.xy) * tileSize + inTile) / (vtInfo.w * tileSize), 0.0);\n"
+    "        }\n"
+    "    }\n"
+    "    return vec4(0.0);\n"
+    "}\n";
+
+/*************/
+VirtualTexture::~VirtualTexture()
+{
+    release();
+}
+
+/*************/
+bool VirtualTexture::load(const string& filename, int cacheSize)
+{
+    release();
+
+    if (!openCache(filename) && (!buildCache(filename) || !openCache(filename)))
+    {
+        cerr << "Virtual texture: unable to prepare the tiles of " << filename << "." << endl;
+        return false;
+    }
+
+    // One texel per tile, and as many levels as the pyramid. The sizes of the levels
+    // are halved from a power of two, which leaves room for the tiles of every level
+    int lPageWidth = 1;
+    int lPageHeight = 1;
+    while (lPageWidth < mTilesX[0])
+        lPageWidth *= 2;
+    while (lPageHeight < mTilesY[0])
+        lPageHeight *= 2;
+
+    mPageTable.create("virtual texture page table");
+    GLState::editTexture(GL_TEXTURE_2D, mPageTable, VT_PAGE_TABLE_UNIT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexStorage2D(GL_TEXTURE_2D, getLevels(), GL_RGBA8UI, lPageWidth, lPageHeight);
+    mPageTable.setSize(GLRegistry::getTextureBytes(GL_RGBA8UI, lPageWidth, lPageHeight, getLevels()));
+    for (int level = 0; level < getLevels(); ++level)
+        glClearTexImage(mPageTable, level, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+
+    GLint lMaxSize;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &lMaxSize);
+    mCacheSize = max(1, min(min(cacheSize, 255), lMaxSize / VT_TILE_SIZE));
+    mCache.create("virtual texture cache");
+    GLState::editTexture(GL_TEXTURE_2D, mCache, VT_CACHE_UNIT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, mCacheSize * VT_TILE_SIZE, mCacheSize * VT_TILE_SIZE);
+    mCache.setSize(GLRegistry::getTextureBytes(GL_RGBA8, mCacheSize * VT_TILE_SIZE, mCacheSize * VT_TILE_SIZE));
+    mSlots.assign(mCacheSize * mCacheSize, Slot());
+
+    GLuint lEmpty = VT_NO_TILE;
+    mFeedbacks.resize(VT_FEEDBACK_COUNT);
+    for (auto& feedback : mFeedbacks)
+    {
+        feedback.buffer.create("virtual texture feedback");
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, feedback.buffer);
+        glBufferStorage(GL_SHADER_STORAGE_BUFFER, VT_FEEDBACK_SIZE * sizeof(uint32_t), nullptr, GL_DYNAMIC_STORAGE_BIT);
+        feedback.buffer.setSize(VT_FEEDBACK_SIZE * sizeof(uint32_t));
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &lEmpty);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    mRequests.resize(VT_FEEDBACK_SIZE);
+
+    // The coarsest level is a single tile, always there to fall back to
+    vector<unsigned char> lData(VT_TILE_BYTES);
+    uint32_t lRoot = VT_KEY(getLevels() - 1, 0, 0);
+    if (pread(mFile, lData.data(), VT_TILE_BYTES, getTileOffset(lRoot)) == VT_TILE_BYTES)
+        place(lRoot, lData.data(), true);
+
+    mRunning = true;
+    int lWorkers = max(1, min(4, (int)thread::hardware_concurrency() / 2));
+    for (int i = 0; i < lWorkers; ++i)
+        mWorkers.push_back(thread(&VirtualTexture::loadTiles, this));
+
+    cout << "Virtual texture: " << mWidth << "x" << mHeight << " pixels, " << getLevels() << " levels, cache of "
+         << mSlots.size() << " tiles." << endl;
+    return true;
+}
+
+/*************/
+void VirtualTexture::release()
+{
+    {
+        lock_guard<mutex> lLock(mMutex);
+        mRunning = false;
+        mQueue.clear();
+        mPending.clear();
+        mLoaded.clear();
+    }
+    mCondition.notify_all();
+    for (auto& worker : mWorkers)
+        worker.join();
+    mWorkers.clear();
+
+    if (mFile != -1)
+        close(mFile);
+    mFile = -1;
+
+    mPageTable.reset();
+    mCache.reset();
+    for (auto& feedback : mFeedbacks)
+        if (feedback.fence)
+            glDeleteSync(feedback.fence);
+    mFeedbacks.clear();
+
+    mSlots.clear();
+    mResident.clear();
+    mRequested.clear();
+    mMissing = 0;
+}
+
+/*************/
+string VirtualTexture::addShaderHelper(const string& source)
+{
+    // Without a version directive, the shader would not compile anyway
+    size_t lVersion = source.find("#version");
+    if (source.find("vtTexture") == string::npos || lVersion == string::npos)
+        return source;
+    // After the extension directives, which come before anything else
+    size_t lExtension = source.rfind("#extension");
+    size_t lInsert = source.find('\n', lExtension != string::npos && lExtension > lVersion ? lExtension : lVersion);
+    if (lInsert == string::npos)
+        return source;
+    lInsert++;
+
+    // Errors keep pointing to the lines of the file
+    int lLine = count(source.begin(), source.begin() + lInsert, '\n') + 1;
+    return source.substr(0, lInsert) + gVirtualTextureHelper + "#line " + to_string(lLine) + "\n" + source.substr(lInsert);
+}
+
+/*************/
+void VirtualTexture::setBindings(GLuint program)
+{
+    GLint lLocation = glGetUniformLocation(program, "vtPageTable");
+    if (lLocation != -1)
+        glProgramUniform1i(program, lLocation, VT_PAGE_TABLE_UNIT);
+    lLocation = glGetUniformLocation(program, "vtCache");
+    if (lLocation != -1)
+        glProgramUniform1i(program, lLocation, VT_CACHE_UNIT);
+
+    GLuint lIndex = glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "vtFeedback");
+    if (lIndex != GL_INVALID_INDEX)
+        glShaderStorageBlockBinding(program, lIndex, VT_FEEDBACK_BINDING);
+}
+
+/*************/
+void VirtualTexture::update()
+{
+    if (!isLoaded())
+        return;
+
+    // Frames drawn while nothing was streaming were asked for by something else,
+    // their requests have to be read back before going idle
+    bool lTriggered = !isStreaming();
+    mFrame++;
+    if (lTriggered)
+        mLastTriggeredFrame = mFrame;
+
+    // Requests of the previous frames, from the oldest, once the GPU is done with them
+    bool lRead = false;
+    for (int i = 1; i <= mFeedbacks.size(); ++i)
+    {
+        Feedback& lFeedback = mFeedbacks[(mCurrentFeedback + i) % mFeedbacks.size()];
+        if (!lFeedback.fence)
+            continue;
+
+        GLenum lStatus = glClientWaitSync(lFeedback.fence, 0, 0);
+        if (lStatus != GL_ALREADY_SIGNALED && lStatus != GL_CONDITION_SATISFIED)
+            continue;
+
+        glDeleteSync(lFeedback.fence);
+        lFeedback.fence = 0;
+        readFeedback(lFeedback);
+        lRead = true;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    if (lRead)
+        schedule();
+
+    // The buffer written by the previous frames is read once done. If the GPU lags
+    // too far behind, the same buffer keeps on gathering requests
+    int lNext = (mCurrentFeedback + 1) % mFeedbacks.size();
+    if (mFeedbacks[lNext].fence == 0)
+    {
+        mFeedbacks[mCurrentFeedback].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        mCurrentFeedback = lNext;
+    }
+    mFeedbacks[mCurrentFeedback].frame = mFrame;
+
+    // Tiles read by the workers, within a budget so that a burst does not stall a frame
+    vector<Tile> lLoaded;
+    {
+        lock_guard<mutex> lLock(mMutex);
+        int lCount = min((int)mLoaded.size(), VT_UPLOADS_PER_FRAME);
+        for (int i = 0; i < lCount; ++i)
+        {
+            mPending.erase(mLoaded[i].key);
+            lLoaded.push_back(move(mLoaded[i]));
+        }
+        mLoaded.erase(mLoaded.begin(), mLoaded.begin() + lCount);
+    }
+
+    GLState::bindTexture(VT_PAGE_TABLE_UNIT, GL_TEXTURE_2D, mPageTable);
+    GLState::bindTexture(VT_CACHE_UNIT, GL_TEXTURE_2D, mCache);
+    for (auto& tile : lLoaded)
+        place(tile.key, tile.data.data(), false);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VT_FEEDBACK_BINDING, mFeedbacks[mCurrentFeedback].buffer);
+}
+
+/*************/
+bool VirtualTexture::isStreaming() const
+{
+    if (!isLoaded())
+        return false;
+
+    lock_guard<mutex> lLock(mMutex);
+    return mMissing > 0 || mLastReadFrame < mLastTriggeredFrame || !mPending.empty();
+}
+
+/*************/
+int VirtualTexture::getPendingTiles() const
+{
+    lock_guard<mutex> lLock(mMutex);
+    return mPending.size();
+}
+
+/*************/
+bool VirtualTexture::readLevel(int maxSize, cv::Mat& image)
+{
+    if (mFile == -1)
+        return false;
+
+    int lLevel = 0;
+    int lWidth = mWidth;
+    int lHeight = mHeight;
+    while (lLevel < getLevels() - 1 && max(lWidth, lHeight) > maxSize)
+    {
+        lWidth = (lWidth + 1) / 2;
+        lHeight = (lHeight + 1) / 2;
+        lLevel++;
+    }
+
+    image = cv::Mat(lHeight, lWidth, CV_8UC4);
+    vector<unsigned char> lData(VT_TILE_BYTES);
+    cv::Mat lTile(VT_TILE_SIZE, VT_TILE_SIZE, CV_8UC4, lData.data());
+    for (int y = 0; y < mTilesY[lLevel]; ++y)
+    {
+        for (int x = 0; x < mTilesX[lLevel]; ++x)
+        {
+            if (pread(mFile, lData.data(), VT_TILE_BYTES, getTileOffset(VT_KEY(lLevel, x, y))) != VT_TILE_BYTES)
+                return false;
+            cv::Rect lRect(x * VT_PAYLOAD, y * VT_PAYLOAD, min(VT_PAYLOAD, lWidth - x * VT_PAYLOAD), min(VT_PAYLOAD, lHeight - y * VT_PAYLOAD));
+            cv::Mat lTarget = image(lRect);
+            lTile(cv::Rect(VT_TILE_BORDER, VT_TILE_BORDER, lRect.width, lRect.height)).copyTo(lTarget);
+        }
+    }
+    return true;
+}
+
+/*************/
+bool VirtualTexture::openCache(const string& filename)
+{
+    mCacheFile = filename + ".tiles";
+    if (!boost::filesystem::exists(filename) || !boost::filesystem::exists(mCacheFile))
+        return false;
+
+    mFile = open(mCacheFile.c_str(), O_RDONLY);
+    if (mFile == -1)
+        return false;
+
+    // Tiles built with another layout, or from an older version of the image, are built again
+    Header lHeader;
+    bool lValid = pread(mFile, &lHeader, sizeof(lHeader), 0) == sizeof(lHeader);
+    lValid = lValid && strncmp(lHeader.magic, "SOVT", 4) == 0 && lHeader.version == VT_VERSION;
+    lValid = lValid && lHeader.tileSize == VT_TILE_SIZE && lHeader.border == VT_TILE_BORDER;
+    lValid = lValid && lHeader.sourceTime == (long long)boost::filesystem::last_write_time(filename);
+    if (lValid)
+    {
+        computeLayout(lHeader.width, lHeader.height);
+        lValid = lHeader.levels == getLevels();
+    }
+
+    if (!lValid)
+    {
+        close(mFile);
+        mFile = -1;
+        return false;
+    }
+
+    mWidth = lHeader.width;
+    mHeight = lHeader.height;
+    return true;
+}
+
+/*************/
+bool VirtualTexture::buildCache(const string& filename)
+{
+    cout << "Virtual texture: building the tiles of " << filename << endl;
+
+    // The whole image and its next level are held in memory while building
+    int lWidth, lHeight;
+    if (readImageSize(filename, lWidth, lHeight))
+    {
+        double lNeeded = (double)lWidth * lHeight * 3 * 1.25;
+        double lAvailable = (double)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+        if ((lWidth + VT_PAYLOAD - 1) / VT_PAYLOAD > 0x4000 || (lHeight + VT_PAYLOAD - 1) / VT_PAYLOAD > 0x4000)
+        {
+            cerr << "Virtual texture: " << filename << " is too large (" << lWidth << "x" << lHeight << "), at most "
+                 << 0x4000 * VT_PAYLOAD << " pixels are supported on each side." << endl;
+            return false;
+        }
+        if (lNeeded > lAvailable)
+        {
+            cerr << "Virtual texture: " << filename << " (" << lWidth << "x" << lHeight << ") needs " << (int)(lNeeded / 1e6)
+                 << " MB to be split in tiles, more than the " << (int)(lAvailable / 1e6) << " MB of memory." << endl;
+            return false;
+        }
+    }
+
+    // Kept top-down as decoded, rows being addressed from the bottom when cutting the tiles
+    cv::Mat lLevel;
+    try
+    {
+        lLevel = cv::imread(filename);
+    }
+    catch (cv::Exception& e)
+    {
+        cerr << "Virtual texture: unable to decode " << filename << ": " << e.what() << endl;
+        return false;
+    }
+    if (lLevel.empty())
+    {
+        cerr << "Virtual texture: unable to decode " << filename << "." << endl;
+        return false;
+    }
+    computeLayout(lLevel.cols, lLevel.rows);
+
+    // Written aside, so that an interrupted build is not taken for a valid one
+    string lTemporary = mCacheFile + ".part";
+    int lFile = open(lTemporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (lFile == -1)
+    {
+        cerr << "Virtual texture: unable to write " << lTemporary << "." << endl;
+        return false;
+    }
+
+    Header lHeader;
+    memset(&lHeader, 0, sizeof(lHeader));
+    memcpy(lHeader.magic, "SOVT", 4);
+    lHeader.version = VT_VERSION;
+    lHeader.width = lLevel.cols;
+    lHeader.height = lLevel.rows;
+    lHeader.tileSize = VT_TILE_SIZE;
+    lHeader.border = VT_TILE_BORDER;
+    lHeader.levels = getLevels();
+    lHeader.sourceTime = (long long)boost::filesystem::last_write_time(filename);
+    bool lSuccess = pwrite(lFile, &lHeader, sizeof(lHeader), 0) == sizeof(lHeader);
+
+    for (int level = 0; level < getLevels() && lSuccess; ++level)
+    {
+        atomic<bool> lFailed {false};
+        Parallel::forRange(mTilesX[level] * mTilesY[level], [&](size_t begin, size_t end) {
+            cv::Mat lBordered, lTile;
+            for (size_t i = begin; i < end; ++i)
+            {
+                int x = i % mTilesX[level];
+                int y = i / mTilesX[level];
+
+                // Neighbouring pixels around the payload, for filtering, repeated at the edges of the image
+                int lLeft = x * VT_PAYLOAD - VT_TILE_BORDER;
+                int lBottom = y * VT_PAYLOAD - VT_TILE_BORDER;
+                int lTop = min(lLevel.rows, lBottom + VT_TILE_SIZE);
+                cv::Rect lRect(max(0, lLeft), lLevel.rows - lTop, 0, 0);
+                lRect.width = min(lLevel.cols, lLeft + VT_TILE_SIZE) - lRect.x;
+                lRect.height = lTop - max(0, lBottom);
+                cv::copyMakeBorder(lLevel(lRect), lBordered, lBottom + VT_TILE_SIZE - lTop, max(0, lBottom) - lBottom,
+                                   lRect.x - lLeft, lLeft + VT_TILE_SIZE - lRect.x - lRect.width, cv::BORDER_REPLICATE);
+                cv::flip(lBordered, lBordered, 0);
+                cv::cvtColor(lBordered, lTile, cv::COLOR_BGR2RGBA);
+
+                if (pwrite(lFile, lTile.data, VT_TILE_BYTES, getTileOffset(VT_KEY(level, x, y))) != VT_TILE_BYTES)
+                    lFailed = true;
+            }
+        }, 16);
+        lSuccess = !lFailed;
+
+        if (level < getLevels() - 1)
+        {
+            cv::Mat lNext;
+            cv::resize(lLevel, lNext, cv::Size((lLevel.cols + 1) / 2, (lLevel.rows + 1) / 2), 0, 0, cv::INTER_AREA);
+            lLevel = lNext;
+        }
+    }
+    close(lFile);
+
+    if (!lSuccess || rename(lTemporary.c_str(), mCacheFile.c_str()) != 0)
+    {
+        cerr << "Virtual texture: unable to write " << lTemporary << "." << endl;
+        unlink(lTemporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*************/
+bool VirtualTexture::readImageSize(const string& filename, int& width, int& height)
+{
+    FILE* lFile = fopen(filename.c_str(), "rb");
+    if (lFile == nullptr)
+        return false;
+
+    unsigned char lBytes[24];
+    bool lFound = false;
+    if (fread(lBytes, 1, 24, lFile) == 24)
+    {
+        // PNG: the IHDR chunk comes first, big endian
+        if (memcmp(lBytes, "\x89PNG", 4) == 0 && memcmp(lBytes + 12, "IHDR", 4) == 0)
+        {
+            width = (lBytes[16] << 24) | (lBytes[17] << 16) | (lBytes[18] << 8) | lBytes[19];
+            height = (lBytes[20] << 24) | (lBytes[21] << 16) | (lBytes[22] << 8) | lBytes[23];
+            lFound = width > 0 && height > 0;
+        }
+        // JPEG: segments are skipped up to the start of frame
+        else if (lBytes[0] == 0xFF && lBytes[1] == 0xD8)
+        {
+            long lOffset = 2;
+            unsigned char lSegment[9];
+            while (!lFound && fseek(lFile, lOffset, SEEK_SET) == 0 && fread(lSegment, 1, 9, lFile) >= 4 && lSegment[0] == 0xFF)
+            {
+                int lMarker = lSegment[1];
+                if (lMarker >= 0xC0 && lMarker <= 0xCF && lMarker != 0xC4 && lMarker != 0xC8 && lMarker != 0xCC)
+                {
+                    height = (lSegment[5] << 8) | lSegment[6];
+                    width = (lSegment[7] << 8) | lSegment[8];
+                    lFound = width > 0 && height > 0;
+                    break;
+                }
+                if (lMarker == 0xD9 || lMarker == 0xDA)
+                    break;
+                lOffset += 2 + ((lSegment[2] << 8) | lSegment[3]);
+            }
+        }
+    }
+    fclose(lFile);
+    return lFound;
+}
+
+/*************/
+void VirtualTexture::computeLayout(int width, int height)
+{
+    mTilesX.clear();
+    mTilesY.clear();
+    mLevelFirst.clear();
+
+    // Levels are halved, rounding up, until the image fits in a single tile
+    long lFirst = 0;
+    while (true)
+    {
+        int lTilesX = (width + VT_PAYLOAD - 1) / VT_PAYLOAD;
+        int lTilesY = (height + VT_PAYLOAD - 1) / VT_PAYLOAD;
+        mTilesX.push_back(lTilesX);
+        mTilesY.push_back(lTilesY);
+        mLevelFirst.push_back(lFirst);
+        lFirst += (long)lTilesX * lTilesY;
+        if (lTilesX == 1 && lTilesY == 1)
+            break;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+}
+
+/*************/
+long VirtualTexture::getTileOffset(uint32_t key) const
+{
+    int lLevel = VT_LEVEL(key);
+    long lIndex = mLevelFirst[lLevel] + (long)VT_Y(key) * mTilesX[lLevel] + VT_X(key);
+    return (long)sizeof(Header) + lIndex * VT_TILE_BYTES;
+}
+
+/*************/
+bool VirtualTexture::isValidKey(uint32_t key) const
+{
+    int lLevel = VT_LEVEL(key);
+    return lLevel < getLevels() && VT_X(key) < mTilesX[lLevel] && VT_Y(key) < mTilesY[lLevel];
+}
+
+/*************/
+void VirtualTexture::readFeedback(Feedback& feedback)
+{
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, feedback.buffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, VT_FEEDBACK_SIZE * sizeof(uint32_t), mRequests.data());
+    GLuint lEmpty = VT_NO_TILE;
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &lEmpty);
+    mLastReadFrame = max(mLastReadFrame, feedback.frame);
+
+    // A tile is worth having at the coarser levels too, which show up first
+    for (auto request : mRequests)
+    {
+        if (request == VT_NO_TILE || !isValidKey(request))
+            continue;
+        for (uint32_t key = request; mRequested.insert(key).second && VT_LEVEL(key) < getLevels() - 1;)
+            key = VT_KEY(VT_LEVEL(key) + 1, VT_X(key) / 2, VT_Y(key) / 2);
+    }
+}
+
+/*************/
+void VirtualTexture::schedule()
+{
+    vector<uint32_t> lMissing;
+    for (auto key : mRequested)
+    {
+        auto lResidentIt = mResident.find(key);
+        if (lResidentIt != mResident.end())
+            mSlots[lResidentIt->second].lastUse = mFrame;
+        else
+            lMissing.push_back(key);
+    }
+    mRequested.clear();
+
+    sort(lMissing.begin(), lMissing.end(), [](uint32_t a, uint32_t b) {
+        return VT_LEVEL(a) > VT_LEVEL(b);
+    });
+
+    // Tiles still queued but not requested anymore are dropped
+    {
+        lock_guard<mutex> lLock(mMutex);
+        mMissing = lMissing.size();
+        for (auto key : mQueue)
+            mPending.erase(key);
+        mQueue.clear();
+        for (auto key : lMissing)
+            if (mQueue.size() < VT_QUEUE_SIZE && mPending.insert(key).second)
+                mQueue.push_back(key);
+    }
+    mCondition.notify_all();
+}
+
+/*************/
+bool VirtualTexture::place(uint32_t key, const unsigned char* data, bool pinned)
+{
+    if (mResident.find(key) != mResident.end())
+        return true;
+
+    // A free slot, otherwise the least recently used one
+    int lSlot = -1;
+    for (int i = 0; i < mSlots.size(); ++i)
+    {
+        if (mSlots[i].pinned)
+            continue;
+        if (mSlots[i].key == VT_NO_TILE)
+        {
+            lSlot = i;
+            break;
+        }
+        if (lSlot == -1 || mSlots[i].lastUse < mSlots[lSlot].lastUse)
+            lSlot = i;
+    }
+
+    // Every tile in the cache is used by the current view, which needs a larger cache
+    if (lSlot == -1 || (mSlots[lSlot].key != VT_NO_TILE && mSlots[lSlot].lastUse >= mFrame))
+        return false;
+
+    Slot& lTarget = mSlots[lSlot];
+    if (lTarget.key != VT_NO_TILE)
+    {
+        mResident.erase(lTarget.key);
+        setPageEntry(lTarget.key, -1);
+    }
+
+    GLState::editTexture(GL_TEXTURE_2D, mCache, VT_CACHE_UNIT);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (lSlot % mCacheSize) * VT_TILE_SIZE, (lSlot / mCacheSize) * VT_TILE_SIZE,
+                    VT_TILE_SIZE, VT_TILE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, data);
+
+    lTarget.key = key;
+    lTarget.lastUse = mFrame;
+    lTarget.pinned = pinned;
+    mResident[key] = lSlot;
+    setPageEntry(key, lSlot);
+    return true;
+}
+
+/*************/
+void VirtualTexture::setPageEntry(uint32_t key, int slot)
+{
+    // Position of the tile in the cache, and whether it is resident
+    unsigned char lEntry[4] {0, 0, 0, 0};
+    if (slot >= 0)
+    {
+        lEntry[0] = slot % mCacheSize;
+        lEntry[1] = slot / mCacheSize;
+        lEntry[2] = 1;
+    }
+
+    GLState::editTexture(GL_TEXTURE_2D, mPageTable, VT_PAGE_TABLE_UNIT);
+    glTexSubImage2D(GL_TEXTURE_2D, VT_LEVEL(key), VT_X(key), VT_Y(key), 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, lEntry);
+}
+
+/*************/
+void VirtualTexture::loadTiles()
+{
+    unique_lock<mutex> lLock(mMutex);
+    while (true)
+    {
+        mCondition.wait(lLock, [&]() {return !mRunning || !mQueue.empty();});
+        if (!mRunning)
+            return;
+
+        Tile lTile;
+        lTile.key = mQueue.front();
+        mQueue.pop_front();
+        lLock.unlock();
+
+        lTile.data.resize(VT_TILE_BYTES);
+        bool lRead = pread(mFile, lTile.data.data(), VT_TILE_BYTES, getTileOffset(lTile.key)) == VT_TILE_BYTES;
+
+        lLock.lock();
+        if (lRead)
+            mLoaded.push_back(move(lTile));
+        else
+            mPending.erase(lTile.key);
+    }
+}
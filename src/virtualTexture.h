@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2015 Emmanuel Durand
+ *
+ * This file is part of Shader-0-matic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @virtualTexture.h
+ * Streams the tiles of an image too large to fit in a single texture
+ *
+ * The image is split once into a pyramid of tiles, cached on disk next to
+ * it. Shaders read it with vtTexture(uv), which also records the tiles it
+ * needs in a feedback buffer. These requests are read back a few frames
+ * later, and the missing tiles are loaded by worker threads then copied to
+ * a cache texture. A page table, holding one texel per tile and one level
+ * per level of the pyramid, tells where each resident tile lies in the
+ * cache. Lookups fall back to coarser levels until a tile is loaded.
+ */
+
+#ifndef VIRTUALTEXTURE_H
+#define VIRTUALTEXTURE_H
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "GLFW/glfw3.h"
+#include <opencv2/opencv.hpp>
+
+#include "glObject.h"
+
+#define VT_TILE_SIZE 128
+#define VT_TILE_BORDER 2
+#define VT_NO_TILE 0xFFFFFFFFu
+
+/*************/
+class VirtualTexture
+{
+public:
+    ~VirtualTexture();
+
+    // Builds the tile cache if missing or older than the image, then creates the
+    // textures. The cache texture holds cacheSize x cacheSize tiles
+    bool load(const std::string& filename, int cacheSize = 32);
+    void release();
+    bool isLoaded() const {return mPageTable != 0;}
+
+    // Inserts the declaration of vtTexture after the version directive of a
+    // fragment shader calling it
+    static std::string addShaderHelper(const std::string& source);
+    // Points the samplers and the feedback block of the program to their units
+    void setBindings(GLuint program);
+
+    // Reads back the requests, schedules the missing tiles and uploads those
+    // which are loaded, then binds the textures and the feedback buffer
+    void update();
+    // True while tiles needed by the last frames are not all resident
+    bool isStreaming() const;
+
+    // Copies the first level of the pyramid no larger than maxSize, as RGBA
+    bool readLevel(int maxSize, cv::Mat& image);
+
+    int getWidth() const {return mWidth;}
+    int getHeight() const {return mHeight;}
+    int getLevels() const {return mTilesX.size();}
+    int getFrame() const {return (int)mFrame;}
+    int getResidentTiles() const {return mResident.size();}
+    int getCacheSize() const {return mCacheSize;}
+    int getCacheTiles() const {return mSlots.size();}
+    int getPendingTiles() const;
+
+private:
+    struct Header
+    {
+        char magic[4];
+        int version;
+        int width;
+        int height;
+        int tileSize;
+        int border;
+        int levels;
+        long long sourceTime;
+    };
+
+    struct Slot
+    {
+        uint32_t key {VT_NO_TILE};
+        unsigned long lastUse {0};
+        bool pinned {false};
+    };
+
+    struct Tile
+    {
+        uint32_t key;
+        std::vector<unsigned char> data;
+    };
+
+    struct Feedback
+    {
+        GLBuffer buffer;
+        GLsync fence {0};
+        unsigned long frame {0};
+    };
+
+    std::string mCacheFile {""};
+    int mFile {-1};
+    int mWidth {0};
+    int mHeight {0};
+    std::vector<int> mTilesX;
+    std::vector<int> mTilesY;
+    std::vector<long> mLevelFirst;
+
+    GLTexture mPageTable;
+    GLTexture mCache;
+    int mCacheSize {0};
+    std::vector<Slot> mSlots;
+    std::unordered_map<uint32_t, int> mResident;
+
+    std::vector<Feedback> mFeedbacks;
+    int mCurrentFeedback {0};
+    std::vector<uint32_t> mRequests;
+    unsigned long mFrame {0};
+    unsigned long mLastReadFrame {0};
+    unsigned long mLastTriggeredFrame {0};
+    std::unordered_set<uint32_t> mRequested;
+    int mMissing {0};
+
+    // Shared with the workers
+    std::vector<std::thread> mWorkers;
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mRunning {false};
+    std::deque<uint32_t> mQueue;
+    std::unordered_set<uint32_t> mPending; // Queued, being read, or read and not yet uploaded
+    std::vector<Tile> mLoaded;
+
+    bool openCache(const std::string& filename);
+    bool buildCache(const std::string& filename);
+    // Reads the size from the header of PNG and JPEG files, without decoding them
+    static bool readImageSize(const std::string& filename, int& width, int& height);
+    void computeLayout(int width, int height);
+    long getTileOffset(uint32_t key) const;
+    bool isValidKey(uint32_t key) const;
+
+    void readFeedback(Feedback& feedback);
+    void schedule();
+    bool place(uint32_t key, const unsigned char* data, bool pinned);
+    void setPageEntry(uint32_t key, int slot);
+    void loadTiles();
+};
+
+#endif // VIRTUALTEXTURE_H